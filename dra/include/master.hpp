@@ -72,6 +72,23 @@ public:
     // is thrown
     void set_file_size(size_t ifile, size_t nevents);
     
+    // set the event numbers at which the clusters of the given file start, see InputManagerBackend::get_cluster_starts.
+    // Once known, the end of the ranges returned by consume for this file are moved to the cluster boundary
+    // closest to the requested blocksize (except for the first block), such that ranges do not split clusters.
+    void set_cluster_starts(size_t ifile, const std::vector<size_t> & starts);
+    
+    // set the (sorted) entries to process for the given file, e.g. from a SkimIndex or an explicit entry list, and
+    // the file size, which can be negative if unknown. The ranges returned by consume for this file then contain about
+    // blocksize selected entries each (instead of blocksize entries), and a file without selected entries
+    // is done immediately (counting as empty file if its size is unknown). Must be called before any range of that
+    // file has been consumed.
+    void set_selected_entries(size_t ifile, ssize_t nevents, const std::vector<size_t> & entries);
+    
+    // get the selected entries for the given file, or NULL if set_selected_entries has not been called for that file
+    const std::vector<size_t> * get_selected_entries(size_t ifile) const{
+        return has_selection[ifile] ? &selected_entries[ifile] : nullptr;
+    }
+    
     // add the given EventRange to the list of available EventRanges. It must correspond to a previously
     // consumed one.
     // This is typically used in case of worker failure to re-run other workers on those
@@ -95,9 +112,16 @@ public:
     size_t nfiles_done() const;
     
 private:
+    // get the size of the range to consume from the beginning of the interval [first, last) for file ifile, given the
+    // requested blocksize, taking into account the cluster boundaries
+    size_t aligned_blocksize(size_t ifile, const std::pair<size_t, size_t> & interval, size_t blocksize) const;
+    
     size_t blocksize0;
     std::vector<ssize_t> nevents; // -1 = unknown
     std::vector<IndexRanges> events_left;
+    std::vector<std::vector<size_t>> cluster_starts; // empty = unknown
+    std::vector<bool> has_selection;
+    std::vector<std::vector<size_t>> selected_entries; // only if has_selection
 };
 
     
@@ -214,6 +238,7 @@ private:
     // per-dataset information:
     int idataset;
     size_t nbytes_read_;
+    size_t nbytes_split_; // the part of nbytes_read_ read for events outside the processed range, see ProcessResponse
     
     // per-dataset processing information:
     std::unique_ptr<detail::EventRangeManager> erm;
@@ -3,6 +3,9 @@
 
 #include "dc/include/message.hpp"
 
+#include <vector>
+#include <string>
+
 // This file defines the Messages required for the problem; see stategraph of how they relate to the overall structure
 
 namespace dra {
@@ -24,6 +27,11 @@ public:
     
 };
 
+// compact encoding of a sorted list of entries for sending it in a message: the differences to the previous
+// entry are saved as variable-length integers (7 bits per byte), so dense lists take about one byte per entry.
+std::string encode_entries(const std::vector<size_t> & entries);
+std::vector<size_t> decode_entries(const std::string & data);
+
 // Process a certain event region of the currently configured config file.
 class Process: public dc::Message {
 public:
@@ -31,13 +39,26 @@ public:
     unsigned int ifile; // index into dataset.filenames
     size_t files_hash;
     size_t first, last; // event range: [first, last) in the file are processed (or fewer, if the file contains fewer events)
+    bool use_entries = false; // if true, only the entries in 'entries' within [first, last) are processed
+    std::vector<size_t> entries; // sorted
     
     virtual void write_data(dc::Buffer & out) const{
-        out << idataset << ifile << files_hash << first << last;
+        out << idataset << ifile << files_hash << first << last << static_cast<uint8_t>(use_entries);
+        if(use_entries){
+            out << encode_entries(entries);
+        }
     }
     
     virtual void read_data(dc::Buffer & in){
-        in >> idataset >> ifile >> files_hash >> first >> last;
+        uint8_t use_entries_ = 0;
+        in >> idataset >> ifile >> files_hash >> first >> last >> use_entries_;
+        use_entries = use_entries_;
+        entries.clear();
+        if(use_entries){
+            std::string data;
+            in >> data;
+            entries = decode_entries(data);
+        }
     }
     
 };
@@ -45,18 +66,34 @@ public:
 // as response to Process, send how many events the file had. For statistics,
 // also say how many bytes have been read and how much (real and cpu) time have been
 // consumed to process that part.
+//
+// For the first range of a file, also send the cluster layout of the file (see InputManagerBackend::get_cluster_starts)
+// which allows the Master to align further ranges to clusters. nbytes_split is the (estimated) part of nbytes
+// read for events outside the processed range, because the range starts or ends within a cluster.
 class ProcessResponse: public dc::Message {
 public:
     size_t file_nevents;
     size_t nbytes;
+    size_t nbytes_split;
     float realtime, cputime;
+    std::vector<uint64_t> cluster_starts;
     
     virtual void write_data(dc::Buffer & out) const{
-        out << file_nevents << nbytes << realtime << cputime;
+        out << file_nevents << nbytes << nbytes_split << realtime << cputime;
+        out << static_cast<uint64_t>(cluster_starts.size());
+        for(auto s : cluster_starts){
+            out << s;
+        }
     }
     
     virtual void read_data(dc::Buffer & in){
-        in >> file_nevents >> nbytes >> realtime >> cputime;
+        in >> file_nevents >> nbytes >> nbytes_split >> realtime >> cputime;
+        uint64_t n;
+        in >> n;
+        cluster_starts.resize(n);
+        for(auto & s : cluster_starts){
+            in >> s;
+        }
     }
 };
 
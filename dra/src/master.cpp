@@ -4,6 +4,10 @@
 #include "base/include/utils.hpp"
 #include "ra/include/config.hpp"
 #include "ra/include/root-utils.hpp"
+#include "ra/include/skim-index.hpp"
+
+#include <algorithm>
+#include <iterator>
 
 using namespace dra;
 using namespace dra::detail;
@@ -83,7 +87,7 @@ size_t IndexRanges::size() const{
 }
 
 EventRangeManager::EventRangeManager(size_t nfiles, size_t blocksize_): blocksize0(blocksize_),
-   nevents(nfiles, -1), events_left(nfiles){
+   nevents(nfiles, -1), events_left(nfiles), cluster_starts(nfiles), has_selection(nfiles, false), selected_entries(nfiles){
     // insert first block in each file:
     for(auto & er : events_left){
         er.disjoint_union(IndexRanges(0, blocksize0));
@@ -125,12 +129,16 @@ EventRange EventRangeManager::consume(size_t preferred_ifile, size_t blocksize){
     }
     assert(ifile != prefer_unprocessed);
     assert(!events_left[ifile].empty());
-    bool use_blocksize0 = events_left[ifile].peek().first == 0;
+    // the first block has size blocksize0, unless the selected entries are known:
+    bool use_blocksize0 = events_left[ifile].peek().first == 0 && !has_selection[ifile];
+    if(!use_blocksize0){
+        blocksize = aligned_blocksize(ifile, events_left[ifile].peek(), blocksize);
+    }
     auto interval = events_left[ifile].consume(use_blocksize0 ? blocksize0 : blocksize);
     EventRange result{ifile, interval.first, interval.second};
     // the result should either be the first block or be beyond, within the file:
-    assert((result.first == 0 && result.last == blocksize0) ||
-       (result.first >= blocksize0 && nevents[ifile] >= 0 && result.last <= static_cast<size_t>(nevents[ifile])));
+    assert((result.first == 0 && result.last == blocksize0) || has_selection[ifile] ||
+       (nevents[ifile] >= 0 && result.last <= static_cast<size_t>(nevents[ifile])));
     return result;
 }
 
@@ -141,6 +149,13 @@ void EventRangeManager::set_file_size(size_t ifile, size_t n) {
             throw invalid_argument("inconsistent file sizes");
         }
     }
+    else if(has_selection[ifile]){
+        // events_left only covers the selected entries anyway:
+        if(!selected_entries[ifile].empty() && selected_entries[ifile].back() >= n){
+            throw invalid_argument("selected entries beyond file");
+        }
+        nevents[ifile] = n;
+    }
     else{
         // now that we know the actual file size, we can extend the events_left accordingly:
         nevents[ifile] = n;
@@ -150,10 +165,70 @@ void EventRangeManager::set_file_size(size_t ifile, size_t n) {
     }
 }
 
+void EventRangeManager::set_cluster_starts(size_t ifile, const std::vector<size_t> & starts){
+    assert(ifile < cluster_starts.size());
+    if(!is_sorted(starts.begin(), starts.end())){
+        throw invalid_argument("cluster starts not sorted");
+    }
+    cluster_starts[ifile] = starts;
+}
+
+void EventRangeManager::set_selected_entries(size_t ifile, ssize_t n, const std::vector<size_t> & entries){
+    assert(ifile < nevents.size());
+    if(has_selection[ifile] || nevents[ifile] >= 0 || events_left[ifile].size() != blocksize0){
+        throw invalid_argument("set_selected_entries called after consuming events of that file");
+    }
+    if(!is_sorted(entries.begin(), entries.end()) || (n >= 0 && !entries.empty() && entries.back() >= static_cast<size_t>(n))){
+        throw invalid_argument("selected entries not sorted or beyond file");
+    }
+    has_selection[ifile] = true;
+    selected_entries[ifile] = entries;
+    if(entries.empty()){
+        nevents[ifile] = max<ssize_t>(n, 0);
+        events_left[ifile] = IndexRanges();
+    }
+    else{
+        // if the file size is unknown, process up to the last selected entry:
+        nevents[ifile] = n;
+        events_left[ifile] = IndexRanges(0, n >= 0 ? n : entries.back() + 1);
+    }
+}
+
+size_t EventRangeManager::aligned_blocksize(size_t ifile, const std::pair<size_t, size_t> & interval, size_t blocksize) const{
+    const auto & selected = selected_entries[ifile];
+    if(has_selection[ifile]){
+        // end the range just before the selected entry blocksize positions after the first selected entry in the interval:
+        auto it = lower_bound(selected.begin(), selected.end(), interval.first);
+        if(static_cast<size_t>(selected.end() - it) <= blocksize) return interval.second - interval.first;
+        return min(*(it + blocksize), interval.second) - interval.first;
+    }
+    const auto & starts = cluster_starts[ifile];
+    const size_t target = interval.first + blocksize;
+    if(starts.empty() || target >= interval.second) return blocksize;
+    // candidates for the end of the range are the cluster boundaries within (first, second) and second itself; take the
+    // one closest to target, preferring the larger one in case of a tie:
+    auto it = lower_bound(starts.begin(), starts.end(), target);
+    size_t above = (it != starts.end() && *it < interval.second) ? *it : interval.second;
+    size_t result = above;
+    if(it != starts.begin() && *(it - 1) > interval.first){
+        size_t below = *(it - 1);
+        if(target - below < above - target){
+            result = below;
+        }
+    }
+    return result - interval.first;
+}
+
 void EventRangeManager::add(const EventRange & er){
     assert(er.ifile < nevents.size());
     // note that we always allow adding the first block  of size blocksize0, even if we know that the file size is different.
-    if((nevents[er.ifile] < 0 || er.last > static_cast<size_t>(nevents[er.ifile])) && !(er.first == 0 && er.last == blocksize0)){
+    if(has_selection[er.ifile]){
+        const auto & selected = selected_entries[er.ifile];
+        if(selected.empty() || (nevents[er.ifile] < 0 ? er.last > selected.back() + 1 : er.last > static_cast<size_t>(nevents[er.ifile]))){
+            throw invalid_argument("adding range beyond file");
+        }
+    }
+    else if((nevents[er.ifile] < 0 || er.last > static_cast<size_t>(nevents[er.ifile])) && !(er.first == 0 && er.last == blocksize0)){
         throw invalid_argument("adding range beyond file");
     }
     events_left[er.ifile].disjoint_union(IndexRanges(er.first, er.last)); // can throw
@@ -258,6 +333,7 @@ void Master::init_dataset(size_t id){
     closed.clear();
     needs_merging.clear();
     nbytes_read_ = 0;
+    nbytes_split_ = 0;
     // NOTE: make sure to call the methods of sm. last, as they will call the generate_process methods and friends so
     // we need to make sure they see a consistent state ...
     if(last){
@@ -268,7 +344,42 @@ void Master::init_dataset(size_t id){
     }
     else{
         LOG_INFO("Start processing dataset " << config->datasets[idataset].name);
-        erm.reset(new EventRangeManager(config->datasets[id].files.size(), config->options.blocksize));
+        const s_dataset & dataset = config->datasets[id];
+        erm.reset(new EventRangeManager(dataset.files.size(), config->options.blocksize));
+        // for files with a complete skim index or an explicit entry list, only distribute the ranges containing selected entries:
+        const ptree * skim_cfg = find_skim_index_cfg(*config);
+        size_t nindexed = 0;
+        for(size_t ifile=0; ifile<dataset.files.size(); ++ifile){
+            const auto & f = dataset.files[ifile];
+            bool selected = false;
+            ssize_t nentries = -1;
+            vector<size_t> entries;
+            if(skim_cfg){
+                size_t n;
+                if(SkimIndex(*skim_cfg, dataset, f.path).read(n, entries)){
+                    nentries = n;
+                    selected = true;
+                    ++nindexed;
+                }
+            }
+            if(f.has_entries){
+                if(selected){
+                    vector<size_t> skim_entries;
+                    skim_entries.swap(entries);
+                    set_intersection(f.entries.begin(), f.entries.end(), skim_entries.begin(), skim_entries.end(), back_inserter(entries));
+                }
+                else{
+                    entries = f.entries;
+                }
+                selected = true;
+            }
+            if(selected){
+                erm->set_selected_entries(ifile, nentries, entries);
+            }
+        }
+        if(skim_cfg){
+            LOG_INFO("Using skim index for " << nindexed << " of " << dataset.files.size() << " files");
+        }
         for(auto & observer : observers){
             observer->on_dataset_start(config->datasets[idataset]);
         }
@@ -315,6 +426,11 @@ std::unique_ptr<Process> Master::generate_process(const WorkerId & wid){
     result->first = er.first;
     result->last = er.last;
     result->files_hash = config->datasets[idataset].filenames_hash;
+    const vector<size_t> * selected = erm->get_selected_entries(er.ifile);
+    if(selected){
+        result->use_entries = true;
+        result->entries.assign(lower_bound(selected->begin(), selected->end(), er.first), lower_bound(selected->begin(), selected->end(), er.last));
+    }
     assert(worker_ranges.find(wid) != worker_ranges.end());
     LOG_DEBUG("generate_process for worker " << wid.id() << ": file = " << result->ifile << "; events = " << result->first << " -- " << result->last);
     return move(result);
@@ -392,11 +508,8 @@ void Master::finalize_dataset(const WorkerId & last_worker){
     string unmerged_filename = get_unmerged_filename(last_worker.id());
     stringstream merged_outfilename;
     merged_outfilename << config->options.output_dir << "/" << config->datasets[idataset].name << "." << out_ops->filename_extension();
-    int res = rename(unmerged_filename.c_str(), merged_outfilename.str().c_str());
-    if(res < 0){
-        LOG_ERRNO("renaming output file from '" << unmerged_filename << "' to '" << merged_outfilename.str() << "'");
-        throw runtime_error("error renaming merged output");
-    }
+    // also renames the output chunks, if any:
+    ra::rename_rootfile(unmerged_filename, merged_outfilename.str());
     // go to next dataset:
     init_dataset(idataset + 1);
 }
@@ -517,7 +630,7 @@ void Master::close_complete(const WorkerId & worker, std::unique_ptr<Message> re
                 // remove all merged files:
                 if(!config->options.keep_unmerged){
                     for(auto & s: filenames){
-                        int res = unlink(s.c_str());
+                        int res = ra::remove_rootfile(s);
                         if(res < 0){
                             LOG_ERRNO_LEVEL(loglevel::warning, "Could not remove merged file (after merging): " << s);
                         }
@@ -532,11 +645,7 @@ void Master::close_complete(const WorkerId & worker, std::unique_ptr<Message> re
                 // just rename:
                 for(auto & w_nm : needs_merging){
                     auto wid = w_nm.first.id();
-                    int res = rename(get_unmerged_filename(wid).c_str(), get_filename(wid).c_str());
-                    if(res < 0){
-                        LOG_ERRNO("renaming unmerged file '" << get_unmerged_filename(wid) << "' to '" << get_filename(wid) << "'");
-                        throw runtime_error("error renaming output file (see log for details)");
-                    }
+                    ra::rename_rootfile(get_unmerged_filename(wid), get_filename(wid));
                 }
                 LOG_DEBUG("Done renaming");
                 // go on to next dataset:
@@ -558,10 +667,14 @@ void Master::process_complete(const WorkerId & worker, std::unique_ptr<Message>
     assert(result);
     ProcessResponse & pr = dynamic_cast<ProcessResponse&>(*result);
     nbytes_read_ += pr.nbytes;
+    nbytes_split_ += pr.nbytes_split;
     auto wr = worker_ranges.find(worker);
     assert(wr != worker_ranges.end());
     assert(!wr->second.empty());
     auto & last_er = wr->second.back();
+    if(!pr.cluster_starts.empty()){
+        erm->set_cluster_starts(last_er.ifile, vector<size_t>(pr.cluster_starts.begin(), pr.cluster_starts.end()));
+    }
     erm->set_file_size(last_er.ifile, pr.file_nevents);
     if(erm->available()){
        sm.deactivate_restriction_set(sm.get_graph().get_restriction_set("noprocess"));
@@ -576,6 +689,7 @@ void Master::process_complete(const WorkerId & worker, std::unique_ptr<Message>
         bool all_idle = none_of(all_workers.begin(), all_workers.end(), [this](const WorkerId & w){return sm.state(w).second;});
         if(all_idle){
             LOG_INFO("Processing complete for dataset " << config->datasets[idataset].name << "; closing all output files");
+            LOG_INFO("Read " << nbytes_read_ << " bytes, of which an estimated " << nbytes_split_ << " bytes were for events outside the processed ranges due to ranges splitting clusters");
             sm.set_target_state(sm.get_graph().get_state("close"));
         }
     }
@@ -1,7 +1,47 @@
 #include "messages.hpp"
 
+#include <stdexcept>
+
 using namespace dra;
 
+std::string dra::encode_entries(const std::vector<size_t> & entries){
+    std::string result;
+    size_t previous = 0;
+    for(size_t entry : entries){
+        if(entry < previous) throw std::invalid_argument("encode_entries: entries not sorted");
+        size_t delta = entry - previous;
+        previous = entry;
+        while(delta >= 0x80){
+            result.push_back(static_cast<char>((delta & 0x7f) | 0x80));
+            delta >>= 7;
+        }
+        result.push_back(static_cast<char>(delta));
+    }
+    return result;
+}
+
+std::vector<size_t> dra::decode_entries(const std::string & data){
+    std::vector<size_t> result;
+    size_t previous = 0, delta = 0;
+    int shift = 0;
+    for(char c : data){
+        const unsigned char byte = static_cast<unsigned char>(c);
+        delta |= static_cast<size_t>(byte & 0x7f) << shift;
+        if(byte & 0x80){
+            shift += 7;
+            if(shift >= 64) throw std::invalid_argument("decode_entries: invalid data");
+        }
+        else{
+            previous += delta;
+            result.push_back(previous);
+            delta = 0;
+            shift = 0;
+        }
+    }
+    if(shift != 0) throw std::invalid_argument("decode_entries: truncated data");
+    return result;
+}
+
 REGISTER_MESSAGE(Configure, "dra:conf")
 REGISTER_MESSAGE(Process, "dra:p")
 REGISTER_MESSAGE(ProcessResponse, "dra:pr")
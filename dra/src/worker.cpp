@@ -9,11 +9,36 @@
 #include "TFile.h"
 #include "TTree.h"
 
+#include <algorithm>
+
 using namespace dra;
 using namespace ra;
 using namespace dc;
 using namespace std;
 
+namespace {
+
+// estimate the number of bytes read for events outside of [first, last) from the clusters containing first and last - 1, given
+// nbytes read in total for the range and the cluster starts.
+size_t estimate_nbytes_split(const vector<size_t> & cluster_starts, size_t nevents, size_t first, size_t last, size_t nbytes){
+    if(cluster_starts.empty() || last <= first) return 0;
+    size_t nevents_outside = 0;
+    // the cluster containing first starts at the last cluster start <= first:
+    auto it = upper_bound(cluster_starts.begin(), cluster_starts.end(), first);
+    if(it != cluster_starts.begin() && *(it - 1) < first){
+        nevents_outside += first - *(it - 1);
+    }
+    // the cluster containing last - 1 ends at the first cluster start >= last (or at the end of the file):
+    it = lower_bound(cluster_starts.begin(), cluster_starts.end(), last);
+    const size_t cluster_end = it == cluster_starts.end() ? nevents : *it;
+    if(cluster_end > last){
+        nevents_outside += cluster_end - last;
+    }
+    return static_cast<size_t>(double(nbytes) / (last - first) * nevents_outside);
+}
+
+}
+
 Worker::Worker(): wm(get_stategraph()), logger(Logger::get("dra.Worker")), iworker(-1) {}
 
 // note: define it here and not in the header file to make sure the definition of the classes is available
@@ -69,6 +94,12 @@ std::unique_ptr<dc::Message> Worker::process(const Process & p){
     
     // init input file:
     controller->start_file(p.ifile);
+    if(p.use_entries){
+        controller->set_entry_list(p.entries);
+    }
+    else{
+        controller->clear_entry_list();
+    }
     
     // process:
     AnalysisController::ProcessStatistics stat;
@@ -79,6 +110,12 @@ std::unique_ptr<dc::Message> Worker::process(const Process & p){
     pr->file_nevents = controller->get_file_size();
     pr->nbytes = stat.nbytes_read;
     pr->realtime = pr->cputime = 0.0f; // TODO: report this ...
+    const vector<size_t> cluster_starts = controller->get_cluster_starts();
+    pr->nbytes_split = estimate_nbytes_split(cluster_starts, pr->file_nevents, p.first, min(p.last, pr->file_nevents), stat.nbytes_read);
+    if(p.first == 0){
+        // the Master does not know about this file yet, so send the cluster layout:
+        pr->cluster_starts.assign(cluster_starts.begin(), cluster_starts.end());
+    }
     return move(pr);
 }
 
@@ -100,7 +137,7 @@ std::unique_ptr<dc::Message> Worker::merge(const Merge & m){
     string file2 = get_outfilename_full(m.idataset, m.iworker2);
     ra::merge_rootfiles(file1, {file2});
     if(!config->options.keep_unmerged){
-        int res = unlink(file2.c_str());
+        int res = ra::remove_rootfile(file2);
         if(res < 0){
             LOG_ERRNO("unlinking this file after merging: '" << file2 << "'; ignoring this error");
         }
@@ -1,6 +1,7 @@
 #include "master.hpp"
 #include <boost/test/unit_test.hpp>
 
+using namespace dra;
 using namespace dra::detail;
 using namespace std;
 
@@ -163,6 +164,95 @@ BOOST_AUTO_TEST_CASE(erm_add){
     BOOST_CHECK(erm.available());
 }
 
+BOOST_AUTO_TEST_CASE(erm_clusters){
+    EventRangeManager erm(1, 100);
+    auto er0 = erm.consume();
+    BOOST_CHECK_EQUAL(er0.last, 100u);
+    erm.set_file_size(0, 1000);
+    BOOST_CHECK_THROW(erm.set_cluster_starts(0, {0, 300, 130}), invalid_argument);
+    erm.set_cluster_starts(0, {0, 130, 290, 420, 700});
+    // blocksize 200 would end at 300; the closest cluster boundary is 290:
+    auto er1 = erm.consume(0, 200);
+    BOOST_CHECK_EQUAL(er1.first, 100u);
+    BOOST_CHECK_EQUAL(er1.last, 290u);
+    // 290 + 200 = 490 is closer to 420 than to 700:
+    auto er2 = erm.consume(0, 200);
+    BOOST_CHECK_EQUAL(er2.first, 290u);
+    BOOST_CHECK_EQUAL(er2.last, 420u);
+    // 420 + 500 = 920: closer to the end of the file than to 700:
+    auto er3 = erm.consume(0, 500);
+    BOOST_CHECK_EQUAL(er3.first, 420u);
+    BOOST_CHECK_EQUAL(er3.last, 1000u);
+    BOOST_CHECK(!erm.available());
+}
+
+BOOST_AUTO_TEST_CASE(erm_selected){
+    EventRangeManager erm(2, 3);
+    BOOST_CHECK_THROW(erm.set_selected_entries(0, 100, {5, 2}), invalid_argument);
+    BOOST_CHECK_THROW(erm.set_selected_entries(0, 100, {5, 100}), invalid_argument);
+    erm.set_selected_entries(0, 100, {5, 10, 11, 40, 41, 42, 90});
+    // file without selected entries is done immediately:
+    erm.set_selected_entries(1, 50, {});
+    BOOST_CHECK_EQUAL(erm.nfiles_done(), 1u);
+    BOOST_CHECK_EQUAL(erm.nevents_total(), 150);
+    // ranges contain blocksize selected entries, also for the first one:
+    auto er0 = erm.consume();
+    BOOST_CHECK_EQUAL(er0.ifile, 0u);
+    BOOST_CHECK_EQUAL(er0.first, 0u);
+    BOOST_CHECK_EQUAL(er0.last, 40u);
+    auto er1 = erm.consume(0, 2);
+    BOOST_CHECK_EQUAL(er1.first, 40u);
+    BOOST_CHECK_EQUAL(er1.last, 42u);
+    auto er2 = erm.consume(0, 3);
+    BOOST_CHECK_EQUAL(er2.first, 42u);
+    BOOST_CHECK_EQUAL(er2.last, 100u);
+    BOOST_CHECK(!erm.available());
+    erm.set_file_size(0, 100);
+    BOOST_CHECK_THROW(erm.set_selected_entries(0, 100, {}), invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(erm_selected_unknown_size){
+    EventRangeManager erm(1, 2);
+    erm.set_selected_entries(0, -1, {7, 300, 301, 1000});
+    auto er0 = erm.consume();
+    BOOST_CHECK_EQUAL(er0.first, 0u);
+    BOOST_CHECK_EQUAL(er0.last, 301u);
+    erm.set_file_size(0, 2000);
+    auto er1 = erm.consume();
+    BOOST_CHECK_EQUAL(er1.first, 301u);
+    BOOST_CHECK_EQUAL(er1.last, 1001u);
+    BOOST_CHECK(!erm.available());
+    erm.add(er0);
+    BOOST_CHECK_EQUAL(erm.get_selected_entries(0)->size(), 4u);
+    BOOST_CHECK_THROW(erm.add(EventRange{0, 1900, 2001}), invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(process_entries){
+    const vector<size_t> entries = {0, 1, 2, 130, 20000, 1ul << 40};
+    const string data = encode_entries(entries);
+    BOOST_CHECK_LT(data.size(), 16u);
+    BOOST_CHECK(decode_entries(data) == entries);
+    BOOST_CHECK(decode_entries(encode_entries({})).empty());
+    BOOST_CHECK_THROW(decode_entries(data.substr(0, data.size() - 1)), invalid_argument);
+    
+    Process p;
+    p.idataset = 1;
+    p.ifile = 2;
+    p.files_hash = 3;
+    p.first = 0;
+    p.last = 100;
+    p.use_entries = true;
+    p.entries = entries;
+    dc::Buffer buf;
+    p.write_data(buf);
+    buf.seek(0);
+    Process p2;
+    p2.read_data(buf);
+    BOOST_CHECK(p2.use_entries);
+    BOOST_CHECK(p2.entries == entries);
+    BOOST_CHECK_EQUAL(p2.last, 100u);
+}
+
 BOOST_AUTO_TEST_CASE(erm_blocksize){
     EventRangeManager erm(2, 100);
     auto er0 = erm.consume();
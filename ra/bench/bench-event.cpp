@@ -0,0 +1,65 @@
+#include <boost/test/unit_test.hpp>
+
+#include "event.hpp"
+
+#include <time.h>
+#include <iostream>
+
+using namespace ra;
+using namespace std;
+
+// micro-benchmarks for the Event container. These do not fail on timing, they only
+// report the numbers.
+
+namespace {
+
+double gettime(){
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+const int n_members = 20;
+const int n_events = 200000;
+
+}
+
+BOOST_AUTO_TEST_SUITE(event_bench)
+
+// compare the cost of Event::get via the typed handle to the fully checked 'raw' access
+// which compares the type_info on each call (which is what Event::get<T> did before).
+BOOST_AUTO_TEST_CASE(get){
+    EventStructure es;
+    vector<Event::Handle<double>> handles;
+    vector<Event::RawHandle> raw_handles;
+    for(int i=0; i<n_members; ++i){
+        handles.push_back(es.get_handle<double>("d" + std::to_string(i)));
+        raw_handles.push_back(es.get_raw_handle(typeid(double), "d" + std::to_string(i)));
+    }
+    Event event(es);
+    for(int i=0; i<n_members; ++i){
+        event.set(handles[i], double(i));
+    }
+
+    double sum_checked = 0.0;
+    double t0 = gettime();
+    for(int k=0; k<n_events; ++k){
+        for(const auto & h : raw_handles){
+            sum_checked += *reinterpret_cast<double*>(event.get(typeid(double), h));
+        }
+    }
+    double t1 = gettime();
+    double sum_typed = 0.0;
+    for(int k=0; k<n_events; ++k){
+        for(const auto & h : handles){
+            sum_typed += event.get(h);
+        }
+    }
+    double t2 = gettime();
+    BOOST_CHECK_EQUAL(sum_checked, sum_typed);
+
+    const double n = double(n_events) * n_members;
+    cout << "Event::get per access: checked: " << (t1 - t0) / n * 1e9 << " ns; typed handle: " << (t2 - t1) / n * 1e9 << " ns" << endl;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
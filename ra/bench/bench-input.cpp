@@ -0,0 +1,237 @@
+#include <boost/test/unit_test.hpp>
+
+#include "event.hpp"
+#include "context-backend.hpp"
+#include "base/include/ptree-utils.hpp"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TLorentzVector.h"
+
+#include <time.h>
+#include <iostream>
+#include <unistd.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <algorithm>
+
+using namespace ra;
+using namespace std;
+
+// benchmarks for the input backends. These do not fail on timing, they only
+// report the numbers.
+
+namespace {
+
+double gettime(){
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+const int n_events = 200000;
+
+int remove_entry(const char * path, const struct stat *, int, struct FTW *){
+    return remove(path);
+}
+
+// a temporary directory which is removed with all its content on destruction
+class tmpdir {
+public:
+    explicit tmpdir(const string & prefix): path(prefix + ".XXXXXX"){
+        if(!mkdtemp(&path[0])){
+            throw runtime_error("could not create temporary directory for '" + prefix + "'");
+        }
+    }
+
+    ~tmpdir(){
+        nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    tmpdir(const tmpdir &) = delete;
+
+    const string & get() const{
+        return path;
+    }
+
+private:
+    string path;
+};
+
+void make_bench_tree(const string & filename){
+    TFile f(filename.c_str(), "recreate");
+    TTree * tree = new TTree("events", "events");
+    int i;
+    double d;
+    vector<float> floats;
+    vector<float> * pfloats = &floats;
+    tree->Branch("intdata", &i, "intdata/I");
+    tree->Branch("doubledata", &d, "doubledata/D");
+    tree->Branch("floats", &pfloats);
+    for(int k=0; k<n_events; ++k){
+        i = k;
+        d = 0.5 * k;
+        floats.assign(k % 10, 0.1f * k);
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+}
+
+// read all events of filename with the given input backend and return the rate in events/s.
+double read_all(const string & type, const ptree & cfg, const string & filename){
+    EventStructure es;
+    auto in = InputManagerBackendRegistry::build(type, es, cfg);
+    auto h_intdata = in->declare_event_input<int>("intdata");
+    auto h_doubledata = in->declare_event_input<double>("doubledata");
+    auto h_floats = in->declare_event_input<vector<float>>("floats");
+    Event event(es);
+    double t0 = gettime();
+    size_t n = in->setup_input_file(event, "events", filename);
+    BOOST_REQUIRE_EQUAL(n, size_t(n_events));
+    double sum = 0.0;
+    for(size_t i=0; i<n; ++i){
+        event.invalidate_all();
+        in->read_event(event, i);
+        sum += event.get(h_intdata) + event.get(h_doubledata) + event.get(h_floats).size();
+    }
+    double t1 = gettime();
+    BOOST_CHECK_GT(sum, 0.0);
+    return n / (t1 - t0);
+}
+
+// tree with a split object branch 'cand' similar to the candidates in zsvanalysis, of which many modules only use some data members.
+// TLorentzVector is used as its dictionary is part of ROOT.
+void make_object_tree(const string & filename){
+    TFile f(filename.c_str(), "recreate");
+    TTree * tree = new TTree("events", "events");
+    TLorentzVector cand;
+    TLorentzVector * pcand = &cand;
+    tree->Branch("cand", "TLorentzVector", &pcand, 32000, 99);
+    for(int k=0; k<n_events; ++k){
+        cand.SetPxPyPzE(0.1 * k, 0.2 * k, 0.3 * k, 0.5 * k);
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+}
+
+// read 'cand' for all events, only reading the given data members if not empty. Returns the number of bytes read
+// and sets rate to the number of events per second.
+size_t read_cand(const string & filename, const vector<string> & data_members, double & rate){
+    EventStructure es;
+    auto in = InputManagerBackendRegistry::build("root", es, ptree());
+    Event::Handle<TLorentzVector> h_cand;
+    if(data_members.empty()){
+        h_cand = in->declare_event_input<TLorentzVector>("cand");
+    }
+    else{
+        h_cand = in->declare_partial_input<TLorentzVector>("cand", data_members);
+    }
+    Event event(es);
+    double t0 = gettime();
+    size_t n = in->setup_input_file(event, "events", filename);
+    BOOST_REQUIRE_EQUAL(n, size_t(n_events));
+    for(size_t i=0; i<n; ++i){
+        event.invalidate_all();
+        in->read_event(event, i);
+        BOOST_REQUIRE_EQUAL(event.get(h_cand).E(), 0.5 * i);
+    }
+    double t1 = gettime();
+    rate = n / (t1 - t0);
+    return in->nbytes_read();
+}
+
+// small tree with many branches, to measure the per-file overhead of setting up the input. With extra_branch, the
+// layout differs from the trees without, so switching between the two kinds of files cannot re-use the InTrees.
+const int n_branches = 50;
+
+void make_small_tree(const string & filename, bool extra_branch){
+    TFile f(filename.c_str(), "recreate");
+    TTree * tree = new TTree("events", "events");
+    vector<int> data(n_branches + 1);
+    for(int ib=0; ib<=n_branches; ++ib){
+        if(ib == n_branches && !extra_branch) break;
+        const string bname = "b" + to_string(ib);
+        tree->Branch(bname.c_str(), &data[ib], (bname + "/I").c_str());
+    }
+    for(int k=0; k<100; ++k){
+        fill(data.begin(), data.end(), k);
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+}
+
+// set up all files in filenames in order with the same InputManager, reading the first event of each. Returns the mean time per file in seconds.
+double setup_files(const vector<string> & filenames){
+    EventStructure es;
+    auto in = InputManagerBackendRegistry::build("root", es, ptree());
+    vector<Event::Handle<int>> handles;
+    for(int ib=0; ib<n_branches; ++ib){
+        handles.push_back(in->declare_event_input<int>("b" + to_string(ib)));
+    }
+    Event event(es);
+    double t0 = gettime();
+    for(const auto & filename : filenames){
+        size_t n = in->setup_input_file(event, "events", filename);
+        BOOST_REQUIRE_EQUAL(n, 100u);
+        event.invalidate_all();
+        in->read_event(event, 0);
+        BOOST_REQUIRE_EQUAL(event.get(handles.back()), 0);
+    }
+    double t1 = gettime();
+    return (t1 - t0) / filenames.size();
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(input_bench)
+
+// compare reading from the TTree to reading from the column cache, where the first pass
+// over the column cache includes creating it.
+BOOST_AUTO_TEST_CASE(colcache){
+    tmpdir dir("/tmp/colcache-bench");
+    const string filename = dir.get() + "/bench.root";
+    make_bench_tree(filename);
+
+    ptree cfg;
+    cfg.add_child("cache_dir", ptree(dir.get() + "/cache"));
+    double rate_root = read_all("root", ptree(), filename);
+    double rate_create = read_all("colcache", cfg, filename);
+    double rate_cached = read_all("colcache", cfg, filename);
+    cout << "events/s: root: " << rate_root << "; colcache (creating the cache): " << rate_create << "; colcache (cached): " << rate_cached << endl;
+}
+
+// compare reading complete objects to reading only one of their data members via InputManager::declare_partial_input.
+BOOST_AUTO_TEST_CASE(partial){
+    tmpdir dir("/tmp/partial-bench");
+    const string filename = dir.get() + "/bench.root";
+    make_object_tree(filename);
+
+    double rate_full, rate_partial;
+    const size_t bytes_full = read_cand(filename, {}, rate_full);
+    const size_t bytes_partial = read_cand(filename, {"fE"}, rate_partial);
+    BOOST_CHECK_LT(bytes_partial, bytes_full);
+    cout << "bytes read: complete objects: " << bytes_full << "; only fE: " << bytes_partial << " (" << (100.0 * bytes_partial / bytes_full) << "%)" << endl;
+    cout << "events/s: complete objects: " << rate_full << "; only fE: " << rate_partial << endl;
+}
+
+// per-file overhead of setup_input_file if the files have the same layout (re-using the InTrees of the previous file) compared
+// to alternating layouts (re-creating the InTrees for each file, as is also done for files with derived-cache friends).
+BOOST_AUTO_TEST_CASE(file_switch){
+    tmpdir dir("/tmp/file-switch-bench");
+    const int n_files = 100;
+    vector<string> same, alternating;
+    for(int i=0; i<n_files; ++i){
+        same.push_back(dir.get() + "/same" + to_string(i) + ".root");
+        make_small_tree(same.back(), false);
+        alternating.push_back(dir.get() + "/alternating" + to_string(i) + ".root");
+        make_small_tree(alternating.back(), i % 2 == 1);
+    }
+    double t_same = setup_files(same);
+    double t_alternating = setup_files(alternating);
+    cout << "ms per file: same layout (re-using InTrees): " << 1e3 * t_same << "; alternating layout (re-creating InTrees): " << 1e3 * t_alternating << endl;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -44,8 +44,12 @@ void run(const s_config & config){
         size_t nevents_done = 0;
         size_t nbytes = 0;
         size_t nevents_survived = 0;
+        InputManagerBackend::io_statistics io;
         for(size_t ifile=0; ifile < dataset.files.size(); ++ifile){
             controller.start_file(ifile);
+            if(dataset.files[ifile].has_entries){
+                controller.set_entry_list(dataset.files[ifile].entries);
+            }
             size_t nevents = controller.get_file_size();
             size_t imin = 0;
             while(true){
@@ -59,6 +63,12 @@ void run(const s_config & config){
                 controller.process(imin, imax, &s);
                 nbytes += s.nbytes_read;
                 nevents_survived += s.nevents_survived;
+                io.nbytes_file += s.io.nbytes_file;
+                io.nreadcalls += s.io.nreadcalls;
+                io.ncache_hits += s.io.ncache_hits;
+                io.ncache_misses += s.io.ncache_misses;
+                io.nunzip_found += s.io.nunzip_found;
+                io.nunzip_missed += s.io.nunzip_missed;
                 nevents_done += imax - imin;
                 p->set(events, nevents_done);
                 p->set(mbytes, nbytes * 1e-6);
@@ -80,6 +90,8 @@ void run(const s_config & config){
         }
         p.reset();
         cout << "Events survived for this dataset: " << nevents_survived << endl;
+        LOG_INFO("dataset " << dataset.name << ": read " << io.nbytes_file << " bytes from files in " << io.nreadcalls << " read calls; read cache hits: "
+                 << io.ncache_hits << ", misses: " << io.ncache_misses << "; baskets decompressed in advance: " << io.nunzip_found << ", not in advance: " << io.nunzip_missed);
     }
     if(interrupted){
           LOG_WARNING("Interrupted by SIGINT, not all data has been processed.");
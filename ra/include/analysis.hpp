@@ -4,6 +4,10 @@
 #include "fwd.hpp"
 #include "base/include/registry.hpp"
 
+#include <string>
+#include <vector>
+#include <typeinfo>
+
 namespace ra {
     
 /** \brief Abstract base class for all analysis modules
@@ -47,6 +51,17 @@ public:
      */
     virtual void process(Event & event) = 0;
     
+    /** \brief Method called for a batch of events instead of \c process, if batch processing is enabled
+     * 
+     * Batch processing is enabled via the \c batchsize option. In this case, the AnalysisController
+     * calls this method for all modules in turn for the same batch of events, i.e. the order of calls is
+     * by module first and by event second (rather than the other way round as without batch processing).
+     * 
+     * The default implementation calls \c process for each active event in the batch, so modules only need to
+     * override this method if they can profit from processing several events at once, e.g. by running a tight loop.
+     */
+    virtual void process_batch(EventBatch & batch);
+    
     /** \brief Method called whenever a new input file is opened.
      * 
      * Whenever a new input file is opened, the framework sets up the input according to the information
@@ -60,6 +75,44 @@ public:
      */
     virtual void begin_in_file(const std::string & input_file){}
     
+    /** \brief Method called after processing a range of entries of the current input file
+     *
+     * The entries [ifirst, ilast) of the current input file (of nentries entries in total) have been processed by this
+     * module instance. Note that not all entries in the range are necessarily passed to \c process, e.g. if the
+     * framework uses a skim index (see SkimIndex). In case of multithreading, each thread reports its own part of the range.
+     * This method is not called if the entries to process are restricted to an explicit list (see AnalysisController::set_entry_list).
+     *
+     * The default implementation does nothing; this is only useful for modules keeping track of which parts of the input
+     * have been processed completely.
+     */
+    virtual void end_range(size_t ifirst, size_t ilast, size_t nentries){}
+    
+    /** \brief Method called after all events of the dataset have been processed, before the output is written
+     *
+     * The default implementation does nothing; override it to put the final content into histograms or other output.
+     * In case of multithreading, it is called for the module instance of each thread.
+     */
+    virtual void end_dataset(){}
+    
+    /** \brief An Event member computed by the module, see \c cacheable_outputs
+     */
+    struct cacheable_output {
+        const std::type_info * ti;
+        std::string name;
+    };
+    
+    /** \brief Return the Event members computed by this module which can be cached across runs
+     *
+     * If the \c derived_cache_dir option is set, the AnalysisController writes the members returned here to a cache file per input file
+     * the first time this file is processed completely, and in later runs reads them from that cache instead of calling this module
+     * (see DerivedCache). This is only correct if \c process does nothing but setting these members from other Event content; in particular,
+     * it must not fill histograms, stop the event, or modify other members.
+     *
+     * This method is called after \c begin_dataset; it should return the same members for all datasets. At most 64 members are supported.
+     * The default implementation returns an empty vector, i.e. the module is always called.
+     */
+    virtual std::vector<cacheable_output> cacheable_outputs() const { return std::vector<cacheable_output>(); }
+    
     /** \brief Return whether this AnalysisModule can be considered safe for parallel/distributed execution
      * 
      * This method is used by the framework for basic consistency checks: When executing in a parellel environment,
@@ -67,6 +120,10 @@ public:
      * 
      * Note that the value returned here can depend on the configuration provided in the constructor, but it is called
      * before \c begin_dataset and hence can not depend on any initialization done there.
+     * 
+     * For multithreaded processing within one process (see the \c nthreads option), each thread has its own instance of
+     * every module, processing a part of the events; as for parallel execution, an exception is raised if a module returns
+     * \c false here.
      */
     virtual bool is_parallel_safe() const { return true; }
 };
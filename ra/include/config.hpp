@@ -24,6 +24,9 @@ struct s_options{
     enum e_mergemode { mm_master, mm_workers, mm_nomerge };
     
     int blocksize;
+    int batchsize; // number of events per EventBatch; 1 = no batch processing
+    int nthreads; // number of threads for event processing in AnalysisController
+    int prefetch; // number of events to read ahead in a background thread; 0 = no prefetching
     int maxevents_hint;
     std::string output_dir;
     std::vector<std::string> libraries;
@@ -31,6 +34,7 @@ struct s_options{
     bool keep_unmerged;
     e_mergemode mergemode;
     std::string default_treename;
+    std::string derived_cache_dir; // directory for the cached outputs of modules (see DerivedCache); empty = no caching
     
     explicit s_options(const ptree & options_cfg);
     s_options(const s_options &) = delete;
@@ -42,6 +46,8 @@ struct s_dataset{
         std::string path;
         int nevents; // -1 = auto-detect
         unsigned int skip;
+        bool has_entries; // true if only the entries in 'entries' are to be processed
+        std::vector<size_t> entries; // sorted
         
         explicit s_file(const boost::property_tree::ptree & tree);
         s_file(std::string s);
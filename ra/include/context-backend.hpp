@@ -18,13 +18,64 @@ public:
     // return the number of events in the file.
     virtual size_t setup_input_file(Event & event, const std::string & treename, const std::string & filename) = 0;
     
-    // populate the event container with the data from event number ievent
+    // populate the event container with the data from event number ievent.
+    // With prefetching, this is called in a background thread while other Event containers are processed, so
+    // lazy reads of those must be synchronized with read_event.
     virtual void read_event(Event & event, size_t ievent) = 0;
     
+    // set up reading into an additional Event container, used for batch processing (see EventBatch).
+    // It has to be called after each call to setup_input_file, for each additional Event. After that,
+    // read_event can be called with any of the Event containers.
+    // The default implementation throws a runtime_error, i.e. batch processing is not supported.
+    virtual void add_input_event(Event & event);
+    
     // get the number of bytes read since the last time this function was called. Note that
     // this is not returned by read_event to allow for lazy reads.
     virtual size_t nbytes_read() = 0;
     
+    // I/O statistics about reading the input files, for performance monitoring. Backends which do not support (some of)
+    // these report zero.
+    struct io_statistics {
+        size_t nbytes_file = 0; // number of bytes read from the file, i.e. compressed bytes including read-ahead
+        size_t nreadcalls = 0; // number of read calls to the file
+        size_t ncache_hits = 0, ncache_misses = 0; // number of data blocks found / not found in the read cache
+        size_t nunzip_found = 0, nunzip_missed = 0; // number of baskets found / not found already decompressed by a background thread
+    };
+    
+    // get the I/O statistics since the last time this function was called.
+    virtual io_statistics get_io_statistics();
+    
+    // get the event numbers at which the storage clusters of the current input file start, in increasing order
+    // (for TTrees: the entries at which the baskets of all branches are flushed). Reading events in ranges
+    // aligned to clusters avoids reading and decompressing the same data for neighbouring ranges.
+    // The default implementation returns an empty vector, meaning that the layout is unknown.
+    virtual std::vector<size_t> get_cluster_starts();
+    
+    // hint that only the given (sorted) entries of the current input file will be read, until the next call to
+    // setup_input_file or set_entry_list; NULL means that any entry might be read. Backends reading ahead
+    // can use this to read only the data required for these entries. read_event must still work for any entry.
+    // The default implementation does nothing.
+    virtual void set_entry_list(const std::vector<size_t> * entries);
+    
+    // a tree in another file providing additional event members for the input file, see set_friend_inputs.
+    struct friend_input {
+        std::string filename;
+        std::string treename;
+        // type and name of the event members, which are read from the branches of the same name:
+        std::vector<std::pair<const std::type_info *, std::string>> members;
+    };
+    
+    // read the given members from the friend trees, starting with the next call to setup_input_file, until the next call of this method.
+    // The friend trees must have as many entries as the input tree, and their entries correspond one-to-one. The members are read
+    // for each event in addition to the ones declared via the InputManager and must already exist in the EventStructure.
+    // Returns whether friend trees are supported; the default implementation returns false (and ignores friends).
+    virtual bool set_friend_inputs(const std::vector<friend_input> & friends);
+    
+    // hint that setup_input_file will probably be called next with the given tree and file name, e.g. for the next file of the
+    // dataset. Backends can use this to open that file in the background while the current one is processed.
+    // The default implementation does nothing.
+    virtual void prepare_next_file(const std::string & treename, const std::string & filename);
+    
     virtual ~InputManagerBackend();
     
 protected:
@@ -38,10 +89,11 @@ typedef Registry<ra::InputManagerBackend, std::string, EventStructure &, const p
 class OutputManagerBackend: public OutputManager {
 public:
     // constructor arguments for derived classes:
-    // EventStructure & es, const string & treename, const string & output_basename
-    // where the output_basename is the output filename without extension.
+    // EventStructure & es, const ptree & cfg, const string & treename, const string & output_basename
+    // where cfg is the 'output' configuration section and the output_basename is the output filename without extension.
     
-    // called after each event. event is the always the same for each call.
+    // called after each event. event is the always the same for each call, except for batch processing
+    // where it is one of the Event containers of the EventBatch.
     virtual void write_event(Event & event) = 0;
     virtual void close() = 0;
     
@@ -51,7 +103,7 @@ protected:
     explicit OutputManagerBackend(EventStructure & es): OutputManager(es){}
 };
 
-typedef Registry<ra::OutputManagerBackend, std::string, EventStructure &, const std::string &, const std::string &> OutputManagerBackendRegistry;
+typedef Registry<ra::OutputManagerBackend, std::string, EventStructure &, const ptree &, const std::string &, const std::string &> OutputManagerBackendRegistry;
 
 // a class allowing operations on output files, such as merging.
 // For each OutputManagerBackend implementation, an OutputManagerOperations implementation
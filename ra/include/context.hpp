@@ -2,11 +2,17 @@
 #define RA_CONTEXT_HPP
 
 #include <string>
+#include <vector>
 #include <type_traits>
 #include <typeinfo>
+#include <map>
+#include <deque>
+#include <functional>
+#include <stdexcept>
 
 #include "fwd.hpp"
 #include "event.hpp"
+#include "identifier.hpp"
 
 namespace ra{
    
@@ -36,6 +42,8 @@ public:
     virtual ~InputManager();
     
     /** \brief Declare an input variable in the event tree
+     *
+     * Several modules can declare the same branch, as long as they use the same type and Event member name.
      */
     template<typename T>
     Event::Handle<T> declare_event_input(const std::string & bname, const std::string & ename_ = ""){
@@ -54,15 +62,75 @@ public:
         return es.get_raw_handle(ti, name);
     }
     
+    /** \brief Declare an input variable of class type of which only some data members are used
+     *
+     * For a split branch of class type (including collections such as vector<jet>), only the sub-branches of the given
+     * data members (e.g. "p4" or "p4.fCoordinates.fPt") are read, instead of the complete objects; the values of all other data
+     * members are undefined. If partial input is declared for a branch more than once (e.g. by several modules), the union of the
+     * members is read. If the branch is also declared via declare_event_input (by any module, before or after this call),
+     * the complete objects are read. Input backends not supporting partial input read the complete objects.
+     * 
+     * Note that modules using the Event member only via get_handle, without declaring the input, only see the data members declared
+     * by others, so modules using the complete objects should declare them via declare_event_input.
+     */
+    template<typename T>
+    Event::Handle<T> declare_partial_input(const std::string & bname, const std::vector<std::string> & data_members, const std::string & ename_ = ""){
+        static_assert(!std::is_pointer<T>::value, "T must not be of pointer type");
+        const auto & ename = ename_.empty() ? bname : ename_;
+        if(data_members.empty()){
+            throw std::invalid_argument("declare_partial_input: no data members given for branch '" + bname + "'");
+        }
+        do_declare_partial_input(typeid(T), bname, ename, data_members);
+        return es.get_handle<T>(ename);
+    }
+    
     // "low-level" access; addr has to point to a structure of type ti, which has not necessarily to be in the Event container.
     // If the data is not stored in the Event container, use event_member_name="".
     virtual void do_declare_event_input(const std::type_info & ti, const std::string & bname, const std::string & mname) = 0;
     
+    // the default implementation declares the complete branch via do_declare_event_input
+    virtual void do_declare_partial_input(const std::type_info & ti, const std::string & bname, const std::string & mname,
+                                          const std::vector<std::string> & data_members);
+    
+    /** \brief Get the bit index of a selection in the SelectionMask Event member, assigning the next free index if needed
+     *
+     * Called by Selections::begin_dataset for each selection it computes.
+     */
+    size_t register_selection_bit(const std::string & selection);
+    
+    /** \brief Get the bit index of a selection registered via register_selection_bit, or SelectionMask::npos
+     *
+     * The InputManager is created for each dataset and thread, and the modules of a thread are initialized in the configured
+     * order. So a selection is only found if it is computed by a module configured before the caller, i.e. if its bit is set
+     * before the caller processes the event.
+     */
+    size_t find_selection_bit(const std::string & selection) const;
+    
+    /** \brief Declare a systematic parameter of the event weight set by the calling module, see weight_systematics
+     *
+     * Usually called in begin_dataset. Declaring a parameter more than once has no effect. The returned flag is set once a module
+     * configured later (e.g. HistFiller) uses the variations of this parameter via use_weight_systematic, so it is only final
+     * after begin_dataset of all modules: check it in process to skip setting the scale factors if no one uses them.
+     */
+    const bool & declare_weight_systematic(const identifier & syst_par);
+    
+    /** \brief Mark the variations of a weight systematic parameter as used
+     *
+     * Throws a runtime_error if the parameter has not been declared via declare_weight_systematic by a module configured
+     * before the caller.
+     */
+    void use_weight_systematic(const identifier & syst_par);
+    
 protected:
     
     explicit InputManager(EventStructure & es_): es(es_){}
     
     EventStructure & es;
+    
+private:
+    std::map<std::string, size_t> selection_bits;
+    // declared weight systematic parameters and whether they are used; a deque to keep the references to the flags valid:
+    std::deque<std::pair<identifier, bool>> weight_systs;
 };
 
 
@@ -80,7 +148,32 @@ public:
     */
     virtual void put(const char * name, TH1 * t) = 0;
     
+    /** \brief Put a histogram in the output which is only created when the output is written
+     *
+     * create is called once, just before the output is written, and should return the histogram or nullptr to not write anything;
+     * a histogram returned is put at name as with put. This allows to keep the content in another form while filling, e.g.
+     * to allocate histograms only when used.
+     */
+    void put_deferred(const char * name, const std::function<TH1* ()> & create);
+    
+    // register a function to be called just before the output is written, before the histograms of put_deferred
+    // are created. Used e.g. by Hists to add the autofill contents to its histograms.
+    void before_write(const std::function<void ()> & callback);
+    
     virtual ~HistogramOutputManager();
+    
+protected:
+    // call the functions passed to before_write. To be called by the implementations before writing the histograms,
+    // before put_deferred_histos.
+    void call_before_write();
+    
+    // call the create functions passed to put_deferred and put the histograms returned. To be called by the
+    // implementations before writing the histograms.
+    void put_deferred_histos();
+    
+private:
+    std::vector<std::pair<std::string, std::function<TH1* ()>>> deferred_histos;
+    std::vector<std::function<void ()>> before_write_callbacks;
 };
 
 
@@ -3,10 +3,17 @@
 
 #include "base/include/log.hpp"
 #include "fwd.hpp"
+#include "context-backend.hpp"
 #include "event.hpp"
+#include "analysis.hpp"
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <exception>
 
 namespace ra {
 
@@ -16,6 +23,23 @@ namespace ra {
  * turn is constructed via a configuration file). Then, execute the start_dataset, start_file, and process methods
  * in turn to process all events in all datasets mentioned in the configuration.
  * 
+ * If the \c batchsize option is larger than one, events are processed in batches via AnalysisModule::process_batch,
+ * see EventBatch.
+ * 
+ * If the \c nthreads option is larger than one, the event range passed to \c process is split into \c nthreads
+ * parts which are processed in parallel. Each thread has its own input, Event container, output file and its own
+ * instance of all modules which are parallel safe (see AnalysisModule::is_parallel_safe). Modules which are not
+ * parallel safe have only one instance, whose methods are called by one thread at a time. The output files of the
+ * threads are merged into the output file of the dataset when the dataset is closed.
+ * 
+ * The number of the current entry in the input file is available to the modules as event member "ientry" of type size_t.
+ * If a \c Selections module uses a skim index (see SkimIndex) which is complete for the current file, only the entries
+ * passing the selection are read and processed. In the same way, the entries to process can be restricted
+ * to an explicit list via set_entry_list.
+ * 
+ * If the \c derived_cache_dir option is set, the outputs of modules declaring cacheable outputs are read from
+ * a cache instead of calling the module, if available, see DerivedCache.
+ * 
  * This class avoids duplication between the serial local version (ra/ra) and the distributed versions
  * (e.g. dra/dra_local), which would otherwise contain the same code to construct the modules, initialize output, cleanup, etc.
  */
@@ -49,9 +73,24 @@ public:
     // get the number of events in the file last initialized with start_file
     size_t get_file_size() const;
     
+    // restrict the following calls to process to the given sorted entries of the current file, i.e. only
+    // entries in both the event range and this list are processed. The restriction is in place until the next call
+    // to clear_entry_list or to start_file with another file. Throws an invalid_argument exception if entries
+    // is not sorted or contains entries beyond the end of the file.
+    void set_entry_list(const std::vector<size_t> & entries);
+    void clear_entry_list();
+    
+    // get the event numbers at which clusters start in the file last initialized with start_file,
+    // see InputManagerBackend::get_cluster_starts. Can be empty if the layout is unknown.
+    std::vector<size_t> get_cluster_starts() const;
+    
     
+    // nallocations is the number of heap allocations of Event member data during the 'process' call;
+    // this should be zero in the steady state, i.e. once all members have been set for the first time.
+    // io contains the file-level statistics of the input backend, see InputManagerBackend::get_io_statistics.
     struct ProcessStatistics {
-        size_t nbytes_read, nevents_survived;
+        size_t nbytes_read, nevents_survived, nallocations;
+        InputManagerBackend::io_statistics io;
     };
     
     // run over the given range [ifirst, ilast) of events in the current file.
@@ -68,26 +107,111 @@ private:
     void check_dataset() const;
     void check_file() const;
     
+    // all data needed to process events in one thread. Without multithreading, there is only one.
+    struct thread_state {
+        // the modules called by this thread; points to AnalysisController::modules for the first thread and to owned_modules
+        // for the others.
+        std::vector<AnalysisModule*> modules;
+        std::vector<std::unique_ptr<AnalysisModule>> owned_modules;
+        
+        // per dataset (~in the order of construction):
+        std::unique_ptr<ra::EventStructure> es;
+        std::unique_ptr<ra::OutputManagerBackend> out;
+        std::unique_ptr<ra::InputManagerBackend> in;
+        std::unique_ptr<ra::Event> event; // only without batch processing and prefetching
+        std::unique_ptr<ra::EventBatch> batch; // only with batch processing or prefetching
+        std::unique_ptr<ra::EventBatch> next_batch; // only with prefetching: the batch read in the background
+        std::string outfile_base;
+    };
+    
+    // the entries of the current file to process in one thread: the entries list[begin], ..., list[end-1], or
+    // the entries [begin, end) if list is NULL.
+    struct entry_range {
+        const size_t * list;
+        size_t begin, end;
+        
+        size_t size() const { return end - begin; }
+        size_t operator[](size_t i) const { return list ? list[begin + i] : begin + i; }
+    };
+    
+    // implementation of 'process' without and with batch processing and with prefetching:
+    void process_events(thread_state & ts, const entry_range & entries, size_t & nevents_survived);
+    void process_batches(thread_state & ts, const entry_range & entries, size_t & nevents_survived);
+    void process_prefetch(thread_state & ts, const entry_range & entries, size_t & nevents_survived);
+    
+    // read the entries entries[ifirst], ..., entries[ifirst + n - 1] into the first n events of batch
+    void read_batch(thread_state & ts, EventBatch & batch, const entry_range & entries, size_t ifirst, size_t n);
+    
+    // call the modules for the events of a batch read via read_batch and write the selected events. Without batch processing,
+    // this calls process_event for each event.
+    void run_batch(thread_state & ts, EventBatch & batch, const entry_range & entries, size_t ifirst, size_t & nevents_survived);
+    
+    // call the modules for a single event already read; returns whether the event has been selected, i.e. not stopped.
+    bool process_event(thread_state & ts, Event & event, size_t ientry);
+    
+    // set the outputs of cached modules read for the event invalid, if they were not valid when writing the cache
+    void apply_cache_masks(Event & event);
+    
+    // the total number of allocations of the Event container(s) of all threads
+    size_t nallocations() const;
+    
+    // call task(it) for it = 0, ..., ntasks - 1, where task(0) is called from the calling thread and the others from the worker threads,
+    // and wait for all to finish. Rethrows the first exception thrown by a task.
+    void run_parallel(size_t ntasks, const std::function<void (size_t)> & task);
+    
+    // the main loop of worker thread it, running the tasks passed to run_parallel
+    void worker_loop(size_t it);
+    
+    // close the output of all threads and merge them into the output file of the first thread.
+    void close_outputs();
+    
     std::shared_ptr<Logger> logger;
     
     const s_config & config;
     std::vector<std::unique_ptr<AnalysisModule>> modules;
     std::vector<std::string> module_names;
     
-    // per dataset (~in the order of construction):
+    std::vector<thread_state> threads;
+    
+    // the worker threads for the thread states 1, ..., nthreads - 1, created once in the constructor; see run_parallel.
+    std::vector<std::thread> workers;
+    std::mutex workers_mutex;
+    std::condition_variable workers_cv, workers_done_cv;
+    std::function<void (size_t)> worker_task;
+    size_t worker_ntasks = 0;
+    size_t worker_generation = 0; // incremented for each call of run_parallel
+    size_t nworkers_busy = 0;
+    bool stop_workers = false;
+    std::vector<std::exception_ptr> worker_exceptions;
+    
+    // per dataset:
     size_t current_idataset;
     std::string outfile_base;
-    std::unique_ptr<ra::EventStructure> es;
-    std::unique_ptr<ra::OutputManagerBackend> out;
-    std::unique_ptr<ra::InputManagerBackend> in;
-    std::unique_ptr<ra::Event> event;
-    
-    Event::Handle<bool> handle_stop;
+    Event::Handle<bool> handle_stop; // the same for all threads, as EventStructures are copied
+    Event::Handle<size_t> handle_ientry; // the entry number in the current file
+    // the cacheable outputs of each module (empty if the module outputs are not cached; see DerivedCache), the handles of these outputs
+    // and of the bitmask of valid outputs:
+    std::vector<std::vector<AnalysisModule::cacheable_output>> cache_outputs;
+    std::vector<std::vector<Event::RawHandle>> cache_output_handles;
+    std::vector<Event::Handle<uint64_t>> cache_mask_handles;
     
     // per-file:
     size_t current_ifile;
     //std::unique_ptr<TFile> infile;
     size_t infile_nevents;
+    // the entries passing the selection according to the skim index, if a complete one is used for this file (see SkimIndex):
+    bool use_skim_entries;
+    std::vector<size_t> skim_entries;
+    // the entries set via set_entry_list (restricted to skim_entries, if used):
+    bool use_entry_list;
+    std::vector<size_t> entry_list;
+    // whether the outputs of a module are read from the cache, and the caches written for modules not cached yet (nullptr for
+    // other modules). Caches are only written with one thread and without batch processing.
+    std::vector<bool> module_cached;
+    std::vector<std::unique_ptr<DerivedCache>> cache_writers;
+    
+    // pass the list of entries to be read to the input of all threads:
+    void update_input_entry_list();
 };
 
 }
@@ -0,0 +1,80 @@
+#ifndef RA_DERIVED_CACHE_HPP
+#define RA_DERIVED_CACHE_HPP
+
+#include "fwd.hpp"
+#include "analysis.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace ra {
+
+class OutTree;
+
+/** \brief Cache of the outputs of an AnalysisModule for one input file, saved as friend tree for re-runs
+ *
+ * If the \c derived_cache_dir option is set, the AnalysisController caches the outputs of all modules declaring
+ * cacheable outputs (see AnalysisModule::cacheable_outputs): The first time an input file is processed completely
+ * and in order (i.e. with one thread, without batch processing or prefetching and without skim index or entry list),
+ * the outputs are written to a cache file; in later runs, the outputs are read from this file as friend tree of the input
+ * (see InputManagerBackend::set_friend_inputs) and the module is not called.
+ *
+ * The cache file is <derived_cache_dir>/<module name>-<key>.root where the key is a hash of the configuration of the module and of
+ * all modules before it, the dataset tags, and the path, size and modification time of the input file; changing any of those makes
+ * the old cache unused. Changes of the module code are not detected; in this case, the cache directory has to be cleaned manually.
+ *
+ * The tree in the cache file contains a branch for each output, and the branch mask_member_name() with the bitmask of
+ * outputs which were valid after the module was called; the others have been written as default-constructed objects
+ * and are set invalid after reading. Cache files are written under a temporary name and renamed when complete, so an existing
+ * cache file is always complete.
+ */
+class DerivedCache {
+public:
+    // the cache of the outputs of module imodule (in the modules section of config) for input_file of the given dataset.
+    DerivedCache(const s_config & config, size_t imodule, const s_dataset & dataset, const std::string & input_file);
+
+    // discards the cache file being written, if not complete
+    ~DerivedCache();
+
+    const std::string & get_filename() const{
+        return filename;
+    }
+
+    static const char * const treename;
+
+    // the name of the Event member and branch for the bitmask of valid outputs of the given module
+    static std::string mask_member_name(const std::string & module_name);
+
+    // whether the cache file exists (and is thus complete)
+    bool exists() const;
+
+    // start writing the outputs of an input file with nentries entries from event, which must have been
+    // created from es and contain the outputs and the mask member.
+    void start_writing(EventStructure & es, Event & event, const std::vector<AnalysisModule::cacheable_output> & outputs, size_t nentries);
+
+    // write the outputs of the given entry. Entries must be written in order, starting with 0; otherwise, writing is
+    // stopped and the cache is not created. After the last entry, the cache file is closed and renamed to its final name.
+    void append(size_t ientry);
+
+private:
+    std::string module_name;
+    std::string filename;
+
+    // while writing:
+    std::string tmpfilename;
+    std::unique_ptr<TFile> file;
+    TTree * tree = nullptr; // owned by file
+    std::unique_ptr<OutTree> outtree;
+    uint64_t valid_mask = 0;
+    size_t nentries = 0;
+    size_t next_entry = 0;
+
+    void finish();
+    void discard();
+};
+
+}
+
+#endif
@@ -1,9 +1,20 @@
 #pragma once
 
+// check the type on each typed Event access in debug builds, see Event:
+#if !defined(NDEBUG) && !defined(RA_EVENT_CHECK_TYPES)
+#define RA_EVENT_CHECK_TYPES
+#endif
+
 #include <typeinfo>
 #include <typeindex>
+#include <type_traits>
 #include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <new>
 
 namespace ra {
    
@@ -33,6 +44,17 @@ namespace ra {
  * data. Note that the callback is *only* called when accessing members in 'invalid' state. This effectively caches
  * the result of the callback.
  * 
+ * Type checking: The type of a member is checked when obtaining a Handle<T> via EventStructure::get_handle (or the
+ * get_handle methods of InputManager / OutputManager forwarding to it), so the templated 'get' and 'set' do not repeat
+ * this check on each access: 'get' on a valid member only checks the index of the handle. This is safe as long as handles are only used with Events
+ * created from the EventStructure which created the handle. In debug builds (i.e. without NDEBUG defined), the type is
+ * also checked on each access to find handles used with the wrong Event; for builds with NDEBUG, this can be enabled by
+ * defining RA_EVENT_CHECK_TYPES. The 'raw' methods taking a std::type_info always check the type.
+ * 
+ * Implementation note on memory: small trivial member types (see EventStructure::inline_size) are stored in a single contiguous
+ * 'arena' per Event whose layout is computed once from the EventStructure. All other types are allocated individually ('out-of-line')
+ * on the first 'set'. In both cases, the address of the member data does not change during the lifetime of the Event.
+ * 
  * Implementation note: most methods are implemented twice, once as template methods taking the type of the data member
  * as template argument and once as a 'raw' version using a runtime type_info as additional argument instead of a compile-time
  * template argument. Users usually only need the templated version; the 'raw' versions are needed by the framework to support
@@ -69,13 +91,43 @@ public:
         }
     };
         
+    // type-erased copy assignment *dest = *src of a member type, see get_assign
+    typedef void (*assign_function)(void * dest, const void * src);
+    
     template<typename T>
     Handle<T> get_handle(const std::string & name){
-        return HandleAccess_::create_handle<T>(get_raw_handle(typeid(T), name));
+        return HandleAccess_::create_handle<T>(get_raw_handle(typeid(T), name, inline_size<T>(), alignof(T), assign_of<T>(std::is_copy_assignable<T>())));
     }
     
     RawHandle get_raw_handle(const std::type_info & ti, const std::string & name);
     
+    /** \brief Get a raw handle, providing the information required to store the member inline in the Event arena
+     * 
+     * inline_size is the size in bytes of the type ti if it can be stored inline (see inline_size), 0 otherwise.
+     * align is the alignment requirement of ti. assign is the copy assignment of ti, if known (see get_assign).
+     */
+    RawHandle get_raw_handle(const std::type_info & ti, const std::string & name, size_t inline_size, size_t align, assign_function assign = nullptr);
+    
+    /** \brief The copy assignment for the type of the member, or nullptr if not known
+     * 
+     * It is known if the member has been declared at least once via get_handle with a copy-assignable type. This allows the
+     * framework to copy member data whose type is only known at run time, e.g. from a read buffer into the Event (see InTree::read_buffers).
+     */
+    assign_function get_assign(const RawHandle & handle) const;
+    
+    /// Maximum size in bytes of member types stored inline in the Event arena.
+    static constexpr size_t max_inline_size = 16;
+    
+    /** \brief The size of T in the Event arena, or 0 if T is not stored inline
+     * 
+     * Only small trivial types (such as int, double, bool) are stored inline, as these
+     * can be placed in the arena without any construction / destruction overhead.
+     */
+    template<typename T>
+    static constexpr size_t inline_size(){
+        return (std::is_trivial<T>::value && sizeof(T) <= max_inline_size && alignof(T) <= alignof(uint64_t)) ? sizeof(T) : 0;
+    }
+    
     
     // get the name for the data member of a handle.
     template<typename T>
@@ -111,14 +163,40 @@ public:
         inline static constexpr RawHandle create_raw_handle(const HT & handle_or_index);
     };
     
+    // The layout of the inline members in the Event arena, see Event.
+    // offsets[i] is the byte offset of member i in the arena, or -1 if member i is not stored inline.
+    struct arena_layout {
+        std::vector<int64_t> offsets;
+        size_t size = 0; // total size of the arena in bytes
+    };
+    
+    // compute the arena layout for the current members. The result is cached and only
+    // re-computed if members are added.
+    const arena_layout & layout() const;
+    
 private:
+    // the copy assignment of T as assign_function, or nullptr if T is not copy-assignable
+    template<typename T>
+    static assign_function assign_of(std::true_type){
+        return [](void * dest, const void * src){ *static_cast<T*>(dest) = *static_cast<const T*>(src); };
+    }
+    
+    template<typename T>
+    static assign_function assign_of(std::false_type){
+        return nullptr;
+    }
+    
     struct member_info {
         std::string name;
         const std::type_info & type; // points to static global data
+        size_t inline_size, align;
+        assign_function assign;
         
-        member_info(const std::string & name_, const std::type_info & ti): name(name_), type(ti){}
+        member_info(const std::string & name_, const std::type_info & ti, size_t inline_size_ = 0, size_t align_ = 0, assign_function assign_ = nullptr):
+            name(name_), type(ti), inline_size(inline_size_), align(align_), assign(assign_){}
     };
     std::vector<member_info> member_infos;
+    mutable arena_layout layout_cache;
 };
 
 
@@ -151,11 +229,22 @@ public:
      */
     template<typename T>
     T & get(const Handle<T> & handle, bool check_valid = true){
-        return *(reinterpret_cast<T*>(get(typeid(T), EventStructure::HandleAccess_::create_raw_handle(handle), check_valid ? state::valid : state::invalid)));
+        return const_cast<T&>(static_cast<const Event*>(this)->get(handle, check_valid));
     }
     
     template<typename T>
     const T & get(const Handle<T> & handle, bool check_valid = true) const{
+#ifndef RA_EVENT_CHECK_TYPES
+        // fast path for the common case of a valid member: no type check, see 'check_typed'.
+        auto index = HandleAccess_::index(handle);
+        if(index >= 0 && static_cast<size_t>(index) < member_datas.size()){
+            const member_data & md = member_datas[index];
+            if(md.data != nullptr && is_valid(md)){
+                return *(reinterpret_cast<const T*>(md.data));
+            }
+        }
+#endif
+        // slow path (with full checks) for all other cases, including error handling and calling the get callback:
         return *(reinterpret_cast<const T*>(get(typeid(T), EventStructure::HandleAccess_::create_raw_handle(handle), check_valid ? state::valid : state::invalid)));
     }
     
@@ -184,22 +273,56 @@ public:
      */
     template<typename T, typename U>
     void set(const Handle<T> & handle, U && value){
-        check(typeid(T), HandleAccess_::create_raw_handle(handle), "set");
+        check_typed(typeid(T), HandleAccess_::create_raw_handle(handle), "set");
         auto index = HandleAccess_::index(handle);
         member_data & md = member_datas[index];
         if(md.data != 0){
             *(reinterpret_cast<T*>(md.data)) = std::forward<U>(value);
         }
         else{
-            md.data = new T(std::forward<U>(value));
-            md.eraser = [](void * ptr){ delete reinterpret_cast<T*>(ptr);};
+            construct<T>(md, std::forward<U>(value));
+        }
+        md.valid_generation = generation;
+    }
+    
+    /** \brief Get an element for re-filling it, re-using its memory from previous events
+     * 
+     * This is meant for modules producing new collections (e.g. a filtered vector of objects) for each event:
+     * Rather than filling a new local container and passing it to 'set' (which allocates and frees the container memory
+     * for each event), use
+     * \code
+     * auto & result = event.recycle(handle);
+     * result.clear();
+     * // ... fill result ...
+     * \endcode
+     * This keeps the capacity of the container from the previous events, so in the steady state, no heap memory is allocated.
+     * 
+     * The element's new state is 'valid'. In case the element is nonexistent, it is default-constructed. Otherwise, the returned
+     * element still holds the value from its last 'set' / 'recycle', and it is the caller's responsibility to reset it.
+     * 
+     * Note that this cannot be used for elements managed via a get callback, as the generated value would be overwritten.
+     */
+    template<typename T>
+    T & recycle(const Handle<T> & handle){
+        check_typed(typeid(T), HandleAccess_::create_raw_handle(handle), "recycle");
+        auto index = HandleAccess_::index(handle);
+        member_data & md = member_datas[index];
+        if(md.data == nullptr){
+            construct<T>(md);
         }
-        md.valid = true;
+        md.valid_generation = generation;
+        return *(reinterpret_cast<T*>(md.data));
     }
     
     // set a data member via the handle to the given pointer. Only valid if the member was nonexistent so far (nullptr).
     void set(const std::type_info & ti, const RawHandle & handle, void * data, const std::function<void (void*)> & eraser);
     
+    // make a nonexistent member existent using its storage in the Event arena, without setting a value. The member data is
+    // zero-initialized and its state is 'invalid'.
+    // Returns the address of the member data, or nullptr if the member is not stored inline; in this case, nothing is changed and
+    // the caller has to provide the memory via 'set'.
+    void * set_inline(const std::type_info & ti, const RawHandle & handle);
+    
     /** \brief Install a get callback
      * 
      * The callback is called whenever 'get' is called on an invalid member; after that call
@@ -243,8 +366,13 @@ public:
      * 
      * This is usually called just before reading a new event, to mark all previous
      * data (from the previous event) as invalid to catch unwanted re-use of old data.
+     * 
+     * This is a constant-time operation independent of the number of members: it only increments
+     * the event generation, see member_data.
      */
-    void invalidate_all();
+    void invalidate_all(){
+        ++generation;
+    }
     
     ~Event();
     
@@ -263,10 +391,19 @@ public:
         return structure.type(handle);
     }
     
+    EventStructure::assign_function get_assign(const RawHandle & handle) const{
+        return structure.get_assign(handle);
+    }
+    
     size_t size() const{
         return structure.size();
     }
     
+    /// The number of heap allocations for member data made by this Event since its construction.
+    size_t nallocations() const{
+        return n_allocations;
+    }
+    
 protected:
     Event(){}
     
@@ -275,20 +412,38 @@ protected:
     void check(const std::type_info & ti, const RawHandle & handle, const std::string & where) const;
     void check(const RawHandle & handle, const std::string & where) const;
     
+    // check for a handle obtained as typed Handle<T> with ti=typeid(T). As the type has already been checked
+    // when creating the handle via EventStructure::get_handle, only the index is checked, unless
+    // RA_EVENT_CHECK_TYPES is defined.
+    void check_typed(const std::type_info & ti, const RawHandle & handle, const std::string & where) const{
+#ifdef RA_EVENT_CHECK_TYPES
+        check(ti, handle, where);
+#else
+        check(handle, where);
+#endif
+    }
+    
     // raise a runtime error
     void fail(const std::type_info & ti, const RawHandle & handle, const std::string & msg) const;
     void fail(const RawHandle & handle, const std::string & msg) const;
     
     
     // type-erased data member.
-    // Life-cycle: it is created upon Event creation with data=0, eraser=0, generator=none, valid=false. At this point, it is considered 'nonexistent'
-    // 'set' sets data and eraser, valid=true. Now, it is 'valid'.
+    // Life-cycle: it is created upon Event creation with data=0, eraser=0, generator=none, valid_generation=0. At this point, it is considered 'nonexistent'
+    // 'set' sets data and eraser, valid_generation=generation. Now, it is 'valid'. For members stored inline, 'set' constructs
+    // the value at slot and sets data=slot, but no eraser.
     // 'set_validity' can be used to set it to 'invalid' or 'valid' now.
     // 'set_get_callback' sets generator
     // destructor calls the eraser on data, if eraser is set.
+    //
+    // Validity is not stored as flag but as the event generation at which the member was last marked valid:
+    // the member is valid iff valid_generation equals the current generation of the Event. This allows invalidate_all
+    // to invalidate all members at once by incrementing the generation. Generation 0 is never used by the Event, so
+    // valid_generation=0 always means 'invalid'.
     struct member_data {
-        mutable bool valid = false;
+        mutable uint64_t valid_generation = 0;
         void * data = nullptr; // managed by eraser. Can be 0 if not 'set' yet, but handle exists, or if unmanaged.
+        void * slot = nullptr; // storage in the arena for inline members; nullptr for members stored out-of-line.
         std::function<void (void*)> eraser;
         std::function<void ()> generator;
         
@@ -299,8 +454,36 @@ protected:
         void operator=(member_data && other) = delete;
         member_data(){}
     };
+    // construct the data of a nonexistent member, either at its arena slot or on the heap.
+    template<typename T, typename... Args>
+    void construct(member_data & md, Args &&... args){
+        if(md.slot != nullptr){
+            // inline in the arena: T is trivial, so no eraser is required.
+            md.data = new (md.slot) T(std::forward<Args>(args)...);
+        }
+        else{
+            md.data = new T(std::forward<Args>(args)...);
+            md.eraser = [](void * ptr){ delete reinterpret_cast<T*>(ptr);};
+            ++n_allocations;
+        }
+    }
+    
+    bool is_valid(const member_data & md) const{
+        return md.valid_generation == generation;
+    }
+    
+    void set_valid(const member_data & md, bool valid) const{
+        md.valid_generation = valid ? generation : 0;
+    }
+    
     EventStructure structure;
     std::vector<member_data> member_datas;
+    uint64_t generation = 1;
+    size_t n_allocations = 0;
+    
+    // contiguous storage for all inline members, laid out according to EventStructure::layout. It is never re-allocated
+    // during the lifetime of the Event, as the slot pointers in member_datas point into it.
+    std::unique_ptr<uint64_t[]> arena;
 };
 
 
@@ -0,0 +1,115 @@
+#ifndef RA_EVENTBATCH_HPP
+#define RA_EVENTBATCH_HPP
+
+#include "event.hpp"
+
+#include <vector>
+#include <memory>
+
+namespace ra {
+
+/** \brief A batch of consecutive events, for processing several events with a single call
+ *
+ * The batch consists of up to \c capacity Event containers, all with the same EventStructure. The current
+ * batch contains \c size events; each event is either 'active' or not. Events become inactive if they are
+ * stopped by a module (see \c stop_unless), and no further modules are called for them.
+ *
+ * Usage is via AnalysisModule::process_batch, which is called by the AnalysisController instead of
+ * AnalysisModule::process if the \c batchsize option is larger than one. For reading inputs in tight loops,
+ * use \c get_column:
+ * \code
+ * auto zp4 = batch.get_column(h_zp4);
+ * for(size_t i=0; i<batch.size(); ++i){
+ *    if(!batch.is_active(i)) continue;
+ *    double mll = zp4[i].M();
+ *    ...
+ * }
+ * \endcode
+ * To set members, use \c event(i).set as usual.
+ */
+class EventBatch {
+public:
+
+    /** \brief Read-only view on the values of one event member for all events of the batch
+     *
+     * Only the values for the active events are available (at the time of calling \c get_column);
+     * accessing the value of an inactive event is undefined behavior.
+     */
+    template<typename T>
+    class column {
+    friend class EventBatch;
+    public:
+        const T & operator[](size_t i) const{
+            return *ptrs[i];
+        }
+
+        size_t size() const{
+            return ptrs.size();
+        }
+
+    private:
+        explicit column(size_t n): ptrs(n, nullptr){}
+        std::vector<const T*> ptrs;
+    };
+
+    EventBatch(const EventStructure & es, size_t capacity);
+
+    EventBatch(const EventBatch &) = delete;
+    EventBatch(EventBatch &&) = delete;
+
+    size_t capacity() const{
+        return events.size();
+    }
+
+    // the number of events in the current batch, including inactive events.
+    size_t size() const{
+        return n;
+    }
+
+    Event & event(size_t i){
+        return *events[i];
+    }
+
+    const Event & event(size_t i) const{
+        return *events[i];
+    }
+
+    bool is_active(size_t i) const{
+        return active[i];
+    }
+
+    // the number of active events in the current batch
+    size_t nactive() const;
+
+    // get the values of the member identified by handle for all active events. The
+    // member must be valid for all active events (or generated via a get callback), as for Event::get.
+    template<typename T>
+    column<T> get_column(const Event::Handle<T> & handle) const{
+        column<T> result(n);
+        for(size_t i=0; i<n; ++i){
+            if(!active[i]) continue;
+            result.ptrs[i] = &events[i]->get(handle);
+        }
+        return result;
+    }
+
+
+    // below here: framework internals!
+
+    // start a new batch with the first n events: invalidates all members of all
+    // events and marks all n events as active. n must not exceed the capacity.
+    void reset(size_t n);
+
+    void deactivate(size_t i){
+        active[i] = false;
+    }
+
+private:
+    std::vector<std::unique_ptr<Event>> events;
+    std::vector<bool> active;
+    size_t n;
+};
+
+}
+
+#endif
@@ -8,6 +8,9 @@ namespace ra{
     class Event;
     class EventStructure;
     
+    // eventbatch.hpp:
+    class EventBatch;
+    
     // context.hpp:
     class Configuration;
     class OutputManager;
@@ -20,6 +23,9 @@ namespace ra{
     
     class identifier;
     
+    // derived-cache.hpp:
+    class DerivedCache;
+    
     struct s_options;
     struct s_dataset;
     struct s_config;
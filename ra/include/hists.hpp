@@ -5,6 +5,8 @@
 #include "analysis.hpp"
 #include "config.hpp"
 #include "event.hpp"
+#include "weight_systematics.hpp"
+#include "selections.hpp"
 #include "TH1D.h"
 
 #include "base/include/registry.hpp"
@@ -13,6 +15,8 @@
 
 #include <type_traits>
 #include <functional>
+#include <memory>
+#include <cmath>
 
 namespace ra{
 
@@ -35,6 +39,9 @@ class HistFiller;
  *
  * The class is usually called from a HistsFiller. Instances are constructed at HistsFiller::begin_dataset,
  * so they live only for one dataset.
+ *
+ * The autofill contents are added to the histograms just before the output is written (see OutputManager::before_write)
+ * or when the Hists is destroyed, whichever comes first, so this works the same way with and without HistFiller.
  */
 class Hists{
 public:
@@ -47,11 +54,28 @@ public:
     template<typename T, typename... cargs>
     T * book(const identifier & id, cargs... parameters);
     
+    // like book, but the histogram is only created by the first call to get with this id (not by the first fill), so histograms
+    // never retrieved via get take no memory; to benefit from this, only call get if the histogram is filled. Histograms not
+    // created until the output is written are created empty then, unless set_write_empty(false) is called.
+    // Note that creating the histogram in get is not thread-safe.
+    template<typename T, typename... cargs>
+    void book_deferred(const identifier & id, cargs... parameters);
+    
+    // whether to write the deferred histograms never filled as empty histograms (the default) or to omit them from the output
+    void set_write_empty(bool write_empty);
+    
     // the functor should return not-a-number to prevent filling
     typedef std::function<double (Event &)> event_functor;
     void book_1d_autofill(event_functor f, const char * name, int nbins, double xmin, double xmax, Event::Handle<double> weight_handle = Event::Handle<double>());
+    
+    // book a histogram filled with f(event.get(handle)), where f takes a const T & and should return not-a-number to prevent filling.
+    // The autofill histograms for the same handle are filled together, reading the event member only once. This is
+    // faster than the event_functor version, but the member must be valid for all selected events.
+    template<typename T, typename F>
+    void book_1d_autofill(const Event::Handle<T> & handle, F f, const char * name, int nbins, double xmin, double xmax,
+                          Event::Handle<double> weight_handle = Event::Handle<double>());
 
-    // get a histogram booked with book:
+    // get a histogram booked with book
     TH1 * get(const identifier & id);
     
     virtual ~Hists();
@@ -59,21 +83,178 @@ public:
     // this is called by HistFiller; it calls the virtual 'process' method and then does the autofills.
     void process_all(Event & event);
     
+    // batch version of process_all, called by HistFiller for batch processing: calls 'process' for
+    // all events i with selected[i] != 0, then does the autofills for these events.
+    void process_all(EventBatch & batch, const std::vector<char> & selected);
+    
+    // The autofills are not filled into the histograms directly but into flat arrays of bin contents; this adds the
+    // contents to the histograms and resets the arrays. Called automatically before the output is written and in the
+    // destructor; call it explicitly only to inspect the histograms before that.
+    void sync_autofill();
+    
+    /** \brief Fill the histograms also for the weight variations of the given systematic parameters
+     *
+     * For each parameter p, a copy of all histograms booked so far is put in the directories <dirname>__<p>_minus and
+     * <dirname>__<p>_plus, filled with the event weight multiplied by the scale factor of p at -1 and +1, as set in the
+     * weight_systematics Event member (or 1.0 if not set). The autofill values are computed once for all variations;
+     * the 'process' method is called again for each variation, with the "weight" Event member scaled and 'get'
+     * returning the histograms of the variation.
+     * 
+     * Called by HistFiller after constructing the Hists, so all histograms should be booked in the constructor.
+     */
+    void add_weight_variations(const std::vector<identifier> & syst_pars);
+    
 private:
     
-    struct autofill_histo {
-        event_functor f;
+    // the bin contents and statistics of an autofill histogram, see sync_autofill
+    struct flat_histo {
+        TH1D * histo;
         Event::Handle<double> weight_handle;
-        TH1* histo;
+        int nbins;
+        double xmin, xmax, width; // width = xmax - xmin
+        std::vector<double> sumw, sumw2; // per bin, including underflow (index 0) and overflow (index nbins + 1)
+        double nentries = 0.0;
+        double stats[4] = {0.0, 0.0, 0.0, 0.0}; // sum of w, w^2, w*x, w*x^2 for the in-range entries, as in TH1::GetStats
+        
+        flat_histo(TH1D * histo_, const Event::Handle<double> & weight_handle_, int nbins_, double xmin_, double xmax_): histo(histo_),
+            weight_handle(weight_handle_), nbins(nbins_), xmin(xmin_), xmax(xmax_), width(xmax_ - xmin_), sumw(nbins_ + 2), sumw2(nbins_ + 2){}
+        
+        // as TH1D::Fill, with the bin computed as in TAxis::FindFixBin
+        void fill(double value, double weight){
+            int bin;
+            if(value < xmin) bin = 0;
+            else if(!(value < xmax)) bin = nbins + 1;
+            else bin = 1 + int(nbins * (value - xmin) / width);
+            sumw[bin] += weight;
+            sumw2[bin] += weight * weight;
+            nentries += 1.0;
+            if(bin == 0 || bin == nbins + 1) return;
+            stats[0] += weight;
+            stats[1] += weight * weight;
+            stats[2] += weight * value;
+            stats[3] += weight * value * value;
+        }
     };
     
+    // the autofills reading the same source, i.e. either one handle or all event_functors:
+    class autofill_group {
+    public:
+        virtual void fill(Event & event, Hists & hists) = 0;
+        virtual ~autofill_group(){}
+    };
+    
+    template<typename T>
+    class handle_group: public autofill_group {
+    public:
+        explicit handle_group(const Event::Handle<T> & handle_): handle(handle_){}
+        
+        virtual void fill(Event & event, Hists & hists) override {
+            const T & t = event.get(handle);
+            for(const auto & k : kernels){
+                const double value = k.first(t);
+                if(std::isnan(value)) continue;
+                hists.fill_flat(k.second, value, event);
+            }
+        }
+        
+        Event::Handle<T> handle;
+        std::vector<std::pair<std::function<double (const T &)>, size_t>> kernels; // the function and the index in flat_histos
+    };
+    
+    class functor_group: public autofill_group {
+    public:
+        virtual void fill(Event & event, Hists & hists) override;
+        
+        std::vector<std::pair<event_functor, size_t>> kernels;
+    };
+    
+    // book the histogram and add it to flat_histos, returning the index:
+    size_t book_flat(const char * name, int nbins, double xmin, double xmax, Event::Handle<double> weight_handle);
+    
     std::string dirname; // including the final '/'
     OutputManager & out;
-    std::vector<autofill_histo> autofill_histos;
+    std::shared_ptr<Hists*> self; // shared with the before_write callback; reset in the destructor
+    std::vector<flat_histo> flat_histos;
+    std::vector<std::unique_ptr<autofill_group>> autofill_groups;
+    functor_group * functors = nullptr; // in autofill_groups; nullptr if no event_functor has been booked
     std::map<identifier, TH1*> i2h; // name to histos
+    
+    // a histogram booked with book_deferred; shared with the function passed to OutputManager::put_deferred
+    struct deferred_histo {
+        std::string path; // the full name in the output
+        std::function<TH1* ()> create;
+        TH1 * histo = nullptr; // once created
+        bool write_empty = true;
+    };
+    std::map<identifier, std::shared_ptr<deferred_histo>> deferred; // not yet created
+    
+    template<typename T, typename... cargs>
+    static TH1 * create_histo(const std::string & name, cargs... parameters){
+        T * result = new T(name.c_str(), name.c_str(), parameters...);
+        result->Sumw2();
+        return result;
+    }
+    
+    // put a deferred histogram in the output of deferred with the given path
+    void put_deferred(std::map<identifier, std::shared_ptr<deferred_histo>> & deferred, const identifier & id, const std::string & path,
+                      const std::function<TH1* ()> & create);
+    
+    // fill value into flat_histos[index] and the corresponding histograms of all weight variations
+    void fill_flat(size_t index, double value, Event & event){
+        flat_histo & h = flat_histos[index];
+        const double weight = event.get(h.weight_handle);
+        h.fill(value, weight);
+        for(size_t iv=0; iv<variations.size(); ++iv){
+            variations[iv].flat_histos[index].fill(value, weight * variation_factors[iv]);
+        }
+    }
+    
+    // the weight variations, see add_weight_variations:
+    struct variation {
+        identifier syst_par;
+        bool plus;
+        std::map<identifier, TH1*> i2h;
+        std::map<identifier, std::shared_ptr<deferred_histo>> deferred;
+        std::vector<flat_histo> flat_histos; // same index as in Hists::flat_histos
+    };
+    std::vector<variation> variations;
+    std::vector<double> variation_factors; // per variation, for the current event
+    size_t current_variation = 0; // 0 = nominal, otherwise index in variations + 1
+    Event::Handle<double> h_weight;
+    Event::Handle<weight_systematics> h_systs;
+    
+    void set_variation_factors(Event & event);
+    
+    // call process for all weight variations
+    void process_variations(Event & event);
 };
 
+template<typename T, typename F>
+void Hists::book_1d_autofill(const Event::Handle<T> & handle, F f, const char * name, int nbins, double xmin, double xmax, Event::Handle<double> weight_handle){
+    const size_t index = book_flat(name, nbins, xmin, xmax, weight_handle);
+    handle_group<T> * group = nullptr;
+    for(auto & g : autofill_groups){
+        auto hg = dynamic_cast<handle_group<T>*>(g.get());
+        if(hg && hg->handle == handle){
+            group = hg;
+            break;
+        }
+    }
+    if(!group){
+        group = new handle_group<T>(handle);
+        autofill_groups.emplace_back(group);
+    }
+    group->kernels.emplace_back(std::function<double (const T &)>(f), index);
+}
+
+
 
+template<typename T, typename... cargs>
+void Hists::book_deferred(const identifier & id, cargs... parameters){
+    static_assert(std::is_base_of<TH1,T>::value, "book_deferred is only allowed for histograms; T must derive from TH1");
+    std::string name = id.name();
+    put_deferred(deferred, id, dirname + name, std::bind(&Hists::create_histo<T, cargs...>, name, parameters...));
+}
 
 template<typename T, typename... cargs>
 T * Hists::book(const identifier & id, cargs... parameters){
@@ -111,25 +292,66 @@ T * Hists::book(const identifier & id, cargs... parameters){
  *   - it is checked whether it passes the selection (of not, processing aborts here)
  *   - the event weight is adapted if the 'weights' setting is given
  *   - Hists::process_all is called for all configured \c Hists classes.
- *   - the weight is reverted if necessary
+ * After all directories, the weight is reverted if necessary.
+ * 
+ * Selections run by a \c Selections module configured before the HistFiller are tested via the SelectionMask of the event, so only
+ * one Event member is read for all these directories; other selections are read from their bool Event member. The product of the event weight and the
+ * 'weights' of a directory is computed once per event for all directories with the same 'weights' setting.
+ * 
+ * The optional top-level setting
+ * \code
+ * weight_systematics "elesf musf_id"
+ * \endcode
+ * gives the systematic parameters (see weight_systematics) to fill weight variations for: all histograms of all directories
+ * are also filled with the weight scaled by the factors at -1 and +1 of each parameter, in the same event loop (see
+ * Hists::add_weight_variations). The parameters have to be declared by modules configured before the HistFiller.
+ * 
+ * The optional top-level setting \c write_empty (default: true) can be set to false to omit the histograms booked
+ * with Hists::book_deferred which have never been filled from the output.
  */
 class HistFiller: public AnalysisModule{
 public:
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out);
     virtual void process(Event & event);
+    virtual void process_batch(EventBatch & batch);
     explicit HistFiller(const ptree & cfg);
     
 private:
     struct outdir{
         std::string dirname;
         std::vector<std::unique_ptr<Hists>> hists;
+        std::string selname;
         Event::Handle<bool> sel_handle;
+        size_t sel_bit = SelectionMask::npos; // SelectionMask bit index of the selection, if it is run by a Selections module before this one
         std::vector<Event::Handle<double>> weight_handles;
+        size_t weight_set = 0; // index in weight_sets
     };
     ptree cfg;
     std::vector<outdir> outdirs;
+    std::vector<identifier> syst_pars;
+    bool write_empty;
     
     Event::Handle<double> h_weight;
+    Event::Handle<SelectionMask> h_mask;
+    
+    // the distinct 'weights' settings of the directories; weight_sets[0] is the empty one.
+    std::vector<std::vector<Event::Handle<double>>> weight_sets;
+    std::vector<double> weight_products; // per weight set, for the current event
+    std::vector<char> weight_product_valid;
+    
+    static bool is_selected(const outdir & dir, Event & event, const SelectionMask * mask){
+        if(mask && dir.sel_bit != SelectionMask::npos) return mask->test(dir.sel_bit);
+        return event.get(dir.sel_handle);
+    }
+    
+    const SelectionMask * get_mask(Event & event){
+        return event.get_state(h_mask) == Event::state::valid ? &event.get(h_mask) : nullptr;
+    }
+    
+    // for batch processing:
+    std::vector<char> batch_selected;
+    std::vector<double> batch_weights_before;
+    std::vector<const SelectionMask*> batch_masks;
     
     static void parse_dir_cfg(const ptree & dircfg, outdir & od, const s_dataset & dataset, InputManager & in, OutputManager & out);
 };
@@ -11,14 +11,50 @@
 #include <stdexcept>
 #include <cassert>
 #include <list>
+#include <map>
+#include <functional>
+#include <mutex>
 
 
 namespace ra {
 
 // merge all rootfiles into file1. file1 has to exist (it will be updated during the merge).
-// all files must have the same keys.
+// all files must have the same keys. If the files have manifests, the chunks of the rhs files are appended to the manifest
+// of file1 (without merging the chunks). The rhs files and their manifests are kept, use remove_rootfile to delete them.
 void merge_rootfiles(const std::string & file1, const std::vector<std::string> & rhs_filenames);
 
+// output chunks of the event tree, written if the root output backend rolls over to new files (see the 'rollover_size' and
+// 'rollover_events' output options). The chunks of an output file are listed in its manifest file, see manifest_filename.
+struct output_chunk {
+    std::string filename;
+    size_t nentries;
+};
+
+// the name of the manifest file for the given output root file: the file name with the '.root' extension replaced by '.manifest'
+std::string manifest_filename(const std::string & rootfile);
+
+// read the manifest file. Chunk filenames are relative to the directory of the manifest file in the file; they are returned
+// including that directory. Throws a runtime_error if the file does not exist or cannot be parsed.
+std::vector<output_chunk> read_manifest(const std::string & manifest);
+
+// write the manifest file. Chunk filenames in the same directory as the manifest file are written relative to it.
+void write_manifest(const std::string & manifest, const std::vector<output_chunk> & chunks);
+
+// rename the output root file from to to, including its manifest and the chunks listed there, if there is a manifest.
+void rename_rootfile(const std::string & from, const std::string & to);
+
+// remove the output root file and its manifest, if any, e.g. after merging it via merge_rootfiles. The chunks listed in the
+// manifest are kept, as they are part of the merged output. Returns the result of unlink for the root file.
+int remove_rootfile(const std::string & rootfile);
+
+// allocate a default-constructed object of the given type, which must be known to ROOT. The deallocator
+// to use for deleting the object is written to the second argument.
+void * allocate_type(const std::type_info & ti, std::function<void (void*)> & deallocator);
+
+// get the sub-branches of a split branch which have to be read for the given data members (see InTree::restrict_branch),
+// including the intermediate ones (but not branch itself). Throws an invalid_argument exception if a data member is not found.
+std::vector<TBranch*> get_member_branches(TBranch * branch, const std::vector<std::string> & data_members);
+
 
 // get a (copy of a) histogram from an open root file, with error checking and readable error messages
 template<typename T>
@@ -53,14 +89,57 @@ inline std::unique_ptr<T> gethisto(TFile & infile, const std::string & name){
  *  - in case a no MutableEvent (and only Event) is available, a Event::RawHandle is used to identify the event member
  * Those two each exist either as templates or with a std::type_info as argument. 
  *
+ * It is possible to have more than one InTree for the same TTree (e.g. to read into several Event containers
+ * for batch processing); the branch addresses are re-set as needed when reading, unless the InTrees share read_buffers.
+ * 
+ * Branches can be read in one of three modes (see read_mode): the default mode is given in the constructor via the \c lazy flag,
+ * and can be overridden per branch in \c open_branch.
  */ 
 class InTree {
 public:
+    /** \brief How a branch is read
+     * 
+     *  - eager: read in get_entry
+     *  - lazy: read on the first call to Event::get after get_entry
+     *  - disabled: the branch is not expected to be read and is disabled in the TTree via SetBranchStatus. In case
+     *    it is accessed anyway, it is enabled again and read as for 'lazy', and a warning is issued.
+     */
+    enum class read_mode { eager, lazy, disabled };
+    
     explicit InTree(TTree * tree_, bool lazy = true);
     
     InTree(const InTree &) = delete;
     InTree(InTree &&) = default;
     
+    /** \brief Buffers to read the branches of a TTree into, shared by the InTrees reading this TTree into different Events
+     *
+     * ROOT keeps only one address per branch, so InTrees of the same TTree reading into different Events have to set the branch
+     * address again whenever another InTree has read the branch in the meantime, which is expensive for split branches of class
+     * type. InTrees using the same read_buffers read each branch into a buffer at a fixed address instead and copy the data into
+     * their Event. Branches of class type are only read this way if the copy assignment of their Event member is known (see
+     * EventStructure::get_assign); otherwise, they are read directly into the Event as without read_buffers.
+     */
+    class read_buffers {
+    friend class InTree;
+    public:
+        read_buffers(){}
+        read_buffers(const read_buffers &) = delete;
+        ~read_buffers();
+        
+    private:
+        struct buffer {
+            void * object = nullptr;
+            void * ptr = nullptr; // for class types: the pointer to object, as root needs its address
+            std::function<void (void*)> deallocator;
+        };
+        std::map<std::string, buffer> buffers; // by branch name
+    };
+    
+    // read the branches opened after this call via the given buffers. Usually called right after construction.
+    void set_read_buffers(const std::shared_ptr<read_buffers> & buffers_){
+        buffers = buffers_;
+    }
+    
     template<typename T>
     void open_branch(const std::string & branchname, MutableEvent & event, const std::string & event_member_name = ""){
         open_branch(typeid(T), branchname, event, event_member_name);
@@ -76,7 +155,16 @@ public:
         open_branch(typeid(T), branchname, event, handle);
     }
     
-    void open_branch(const std::type_info & ti, const std::string & branchname, Event & event, const Event::RawHandle & handle);
+    void open_branch(const std::type_info & ti, const std::string & branchname, Event & event, const Event::RawHandle & handle){
+        open_branch(ti, branchname, event, handle, lazy ? read_mode::lazy : read_mode::eager);
+    }
+    
+    void open_branch(const std::type_info & ti, const std::string & branchname, Event & event, const Event::RawHandle & handle, read_mode mode);
+    
+    // restrict reading the branch, which must have been opened before and be a split branch of class type, to the sub-branches
+    // required for the given data members of the class, such as "p4" or "p4.fCoordinates.fPt". The values of all other data members
+    // are undefined after reading. Throws an invalid_argument exception if a data member is not found.
+    void restrict_branch(const std::string & branchname, const std::vector<std::string> & data_members);
     
     // prepare reading the given entry; either reads immediately all data from opened branches or
     // (if lazy=true) prepares the callbacks which trigger this read only on event.get.
@@ -86,6 +174,20 @@ public:
         return n_entries;
     }
     
+    TTree * get_tree() const {
+        return tree;
+    }
+    
+    // a hash of the branch structure of the tree, i.e. the names, titles and classes of all branches. Trees
+    // with the same fingerprint can be read with the same InTree, see switch_tree.
+    static size_t layout_fingerprint(TTree * tree);
+    
+    // read from tree instead of the current tree, keeping all opened branches, their read modes and restrictions and
+    // the Event members they are read into. This is much cheaper than creating a new InTree and opening all branches again, but
+    // only valid if tree has the same layout as the current tree, which is usually checked via layout_fingerprint.
+    // The number of reads per branch (see get_nreads) is reset.
+    void switch_tree(TTree * tree);
+    
     // get number of bytes read since last call to this method (or construction if never called),
     // and reset that counter.
     int64_t get_reset_bytes_read() {
@@ -94,10 +196,22 @@ public:
         return res;
     }
     
+    // get the number of entries read so far for each opened branch, by branch name.
+    std::map<std::string, int64_t> get_nreads() const;
+    
+    // set a mutex to lock for reads triggered by Event::get of lazy branches, which is needed if
+    // these can happen in another thread than the one calling get_entry (e.g. for reading ahead). The mutex is
+    // not locked in get_entry; the caller has to do that if required. The default is not to lock.
+    void set_read_mutex(std::mutex * m){
+        read_mutex = m;
+    }
+    
 private:
     TTree * tree;
     bool lazy;
+    std::mutex * read_mutex = nullptr;
     std::list<void*> ptrs;
+    std::shared_ptr<read_buffers> buffers;
     
     int64_t current_index = -1;
     int64_t n_entries;
@@ -109,14 +223,28 @@ private:
         TBranch * branch = nullptr;
         Event & event;
         Event::RawHandle handle;
+        void * address; // as passed to TBranch::SetAddress
+        read_mode mode;
+        int64_t nreads = 0;
+        std::vector<std::string> data_members; // see restrict_branch; empty = read the complete branch
+        int top_index = -1; // index in the list of top-level branches of the tree, or -1 if not a top-level branch
+        // if reading via read_buffers: the object in the buffer, which is copied to target via assign (for class types) or
+        // by copying size bytes (for fundamental types) after reading
+        void * buffer = nullptr;
+        void * target = nullptr;
+        EventStructure::assign_function assign = nullptr;
+        size_t size = 0;
         
-        explicit binfo(const std::string & branchname_, TBranch * branch_, Event & event_, const Event::RawHandle & handle_):
-            branchname(branchname_), branch(branch_), event(event_), handle(handle_){}
+        explicit binfo(const std::string & branchname_, TBranch * branch_, Event & event_, const Event::RawHandle & handle_, void * address_, read_mode mode_):
+            branchname(branchname_), branch(branch_), event(event_), handle(handle_), address(address_), mode(mode_){}
     };
     
     std::list<binfo> branch_infos; // make as list to keep references to elements valid all the time (needed for Event callback of set_get_callback)
     
-    void read_branch(const binfo & bi);
+    void read_branch(binfo & bi);
+    
+    // enable only the sub-branches required for bi.data_members
+    void apply_restriction(binfo & bi);
 };
 
 /** \brief Wrapper class for writing a TTree
@@ -147,6 +275,12 @@ public:
     // append the current contents to the underlying TTree. At this point, all event content must be valid.
     void append();
     
+    // append the current contents to the underlying TTree, writing a default-constructed object for members which are
+    // not valid (including lazy members not read yet). Bit i of valid_mask is set to whether the member of the i-th
+    // created branch was valid; it is set before filling the tree, so it can be the address of a branch of the same tree.
+    // At most 64 branches are supported.
+    void append_or_default(uint64_t & valid_mask);
+    
 private:
     TTree * tree;
     
@@ -157,7 +291,9 @@ private:
         Event::RawHandle handle;
         TBranch * branch = nullptr;
         bool is_class;
-        bool address_setup = false;
+        void * address = nullptr; // the object the branch address points to; nullptr if not set up yet
+        void ** address_ptr = nullptr; // for class types: the element of addresses passed to root
+        std::shared_ptr<void> default_object; // for append_or_default
         
         explicit binfo(const std::type_info & ti_, const std::string & name_, Event & event_, const Event::RawHandle & handle_): ti(ti_),
             name(name_), event(event_), handle(handle_){}
@@ -166,6 +302,9 @@ private:
     
     std::list<void*> addresses;
     
+    // let the branch of bi point to obj, if it does not already
+    void set_address(binfo & bi, void * obj);
+
 };
 
 
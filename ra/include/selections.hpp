@@ -8,6 +8,8 @@
 
 #include "TH1D.h"
 #include <string>
+#include <vector>
+#include <cstdint>
 
 namespace ra{
 
@@ -28,6 +30,14 @@ public:
     
     /// returns true if the event passes the selection and should be kept, false otherwise
     virtual bool operator()(const Event & e) = 0;
+    
+    /** \brief Evaluate the selection for all active events of a batch
+     * 
+     * Sets result[i] to the selection result for each active event i of the batch; result has the size of the batch.
+     * The default implementation calls operator() for each active event; override it to evaluate the selection in a tight loop.
+     */
+    virtual void select_batch(const EventBatch & batch, std::vector<char> & result);
+    
     virtual ~Selection(){}
 };
 
@@ -36,6 +46,54 @@ typedef ::Registry<Selection, std::string, const ptree &,  InputManager &, Outpu
 #define REGISTER_SELECTION(T) namespace { int dummy##T = ::ra::SelectionRegistry::register_<T>(#T); }
 
 
+/** \brief Bitmask of the results of all selections of an event
+ * 
+ * Each selection run by a \c Selections module is assigned a bit index at begin_dataset (see InputManager::register_selection_bit); in addition
+ * to the bool Event member, its result is set in the SelectionMask Event member \c member_name. This allows modules
+ * testing many selections, such as \c HistFiller, to read one Event member per event instead of one per selection.
+ */
+class SelectionMask {
+public:
+    // the bit index of selections without a bit, see InputManager::find_selection_bit
+    static const size_t npos = static_cast<size_t>(-1);
+    
+    // the name of the Event member
+    static const char * const member_name;
+    
+    // get the mask of the event to set selection results; all bits are cleared for the first call in an event.
+    static SelectionMask & get(Event & event, const Event::Handle<SelectionMask> & handle){
+        if(event.get_state(handle) == Event::state::valid){
+            return event.get(handle);
+        }
+        SelectionMask & result = event.recycle(handle);
+        result.reset();
+        return result;
+    }
+    
+    void set(size_t ibit, bool value){
+        const size_t iword = ibit / 64;
+        if(iword >= words.size()){
+            words.resize(iword + 1, 0);
+        }
+        const uint64_t bit = uint64_t(1) << (ibit % 64);
+        if(value) words[iword] |= bit;
+        else words[iword] &= ~bit;
+    }
+    
+    bool test(size_t ibit) const{
+        const size_t iword = ibit / 64;
+        return iword < words.size() && (words[iword] & (uint64_t(1) << (ibit % 64)));
+    }
+    
+    void reset(){
+        words.assign(words.size(), 0);
+    }
+    
+private:
+    std::vector<uint64_t> words;
+};
+
+
 
 /** \brief AnalysisModule running a given set of Selection modules
  *
@@ -63,23 +121,63 @@ typedef ::Registry<Selection, std::string, const ptree &,  InputManager &, Outpu
  * 
  * The module runs all configured \c Selections in the order given in the configuration (from top to bottom)
  * on the event and saves the result as a boolean value of the user-defined name ("all", "bcand2", and "final_selection"
- * in the above example). Note that order is important if selections refer to each other as for the \c AndSelection.
+ * in the above example), and in the SelectionMask of the event. Note that order is important if selections refer to each other as for the \c AndSelection.
  * 
  * Note that this class only calculates the result of the selection as boolean and stores them to the event. Event
  * processing is *not* stopped in any case by this module. If you want to stop further event processing (i.e. further
  * modules being called for this event), use the \c stop_unless AnalysisModule; you can let it run
  * directly after this Selections module.
+ * 
+ * Optionally, the module saves the entries passing one of the selections as skim index (see SkimIndex), which
+ * can be used in later runs to read only those entries from the input files:
+ * \code
+ * sels {
+ *   type Selections
+ *   ; ... selections as above ...
+ *   skim_index {
+ *     selection final_selection ; the selection to save in the index
+ *     dir skim ; optional, default: "skim"
+ *     use true ; optional, default: false
+ *   }
+ * }
+ * \endcode
+ * 
+ * The index is written whenever input files are processed without a complete skim index. If \c use is true, the index
+ * is used for the input files for which it is complete, i.e. only the passing entries of those are processed. This should
+ * only be enabled if no module requires the other entries; e.g. the cutflow histograms of an \c AndSelection then only
+ * contain the selected events.
  */
 class Selections: public AnalysisModule{
 public:
     Selections(const ptree & cfg);
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out);
+    virtual void begin_in_file(const std::string & input_file);
     virtual void process(Event & event);
+    virtual void process_batch(EventBatch & batch);
+    virtual void end_range(size_t ifirst, size_t ilast, size_t nentries);
+    virtual ~Selections();
     
 private:
+    // write the skim index information recorded for the current input file, if any
+    void write_skim_index();
+    
     ptree cfg;
-    typedef std::tuple<Event::Handle<bool>, std::unique_ptr<Selection>> handle_sel;
+    typedef std::tuple<Event::Handle<bool>, std::unique_ptr<Selection>, size_t> handle_sel; // the last element is the SelectionMask bit index
     std::vector<handle_sel> selections;
+    Event::Handle<SelectionMask> mask_handle;
+    std::vector<char> batch_result;
+    std::vector<SelectionMask*> batch_masks;
+    
+    // skim index:
+    std::string skim_selection; // empty if no skim index is configured
+    Event::Handle<bool> skim_handle;
+    Event::Handle<size_t> ientry_handle;
+    const s_dataset * dataset;
+    std::string input_file;
+    bool skim_record; // false for the input files with a complete index
+    size_t skim_nentries;
+    std::vector<std::pair<size_t, size_t>> skim_ranges;
+    std::vector<size_t> skim_passing;
 };
 
 
@@ -0,0 +1,49 @@
+#ifndef RA_SKIM_INDEX_HPP
+#define RA_SKIM_INDEX_HPP
+
+#include "fwd.hpp"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace ra {
+
+/** \brief Index of the entries of an input file passing a selection, saved in sidecar files for re-runs
+ *
+ * The index is written by the \c Selections module if configured with a \c skim_index section (see there) and
+ * read by the AnalysisController and the dra master to process only the passing entries in later runs.
+ *
+ * The index files are stored in the directory <dir>/<key>/ where dir is the \c skim_index.dir setting of the \c Selections
+ * module (default: "skim"), and the key is a hash of the \c Selections module configuration
+ * (without the \c skim_index section) and the filenames_hash of the dataset; changing either of those makes the
+ * old index unused. Note that changes of modules running before the \c Selections module are not detected.
+ *
+ * As input files can be processed in parts by several processes or threads, each writer writes its own part file with
+ * the processed entry ranges and a bitmap of passing entries in those ranges; the index is complete (and can be used)
+ * once the ranges of all part files cover the whole input file.
+ */
+class SkimIndex {
+public:
+    // the index of input_file of the given dataset, for the configuration selections_cfg of a Selections module
+    SkimIndex(const ptree & selections_cfg, const s_dataset & dataset, const std::string & input_file);
+
+    // write a new part file with the given ranges of processed entries and the passing entries, which
+    // must be sorted and within the ranges. nentries is the number of entries in the input file.
+    void write_part(size_t nentries, const std::vector<std::pair<size_t, size_t>> & ranges, const std::vector<size_t> & passing) const;
+
+    // read all part files. If they cover the whole input file, return true and set nentries and the (sorted) passing entries.
+    // Otherwise, return false.
+    bool read(size_t & nentries, std::vector<size_t> & passing) const;
+
+private:
+    std::string basename; // part file names start with this
+};
+
+// find the configuration of the Selections module which uses its skim index, i.e. has 'skim_index.use' set to true.
+// Returns nullptr if there is none.
+const ptree * find_skim_index_cfg(const s_config & config);
+
+}
+
+#endif
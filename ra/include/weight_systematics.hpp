@@ -2,6 +2,7 @@
 #define RA_WEIGHT_SYSTEMATICS_HPP
 
 #include "identifier.hpp"
+#include "event.hpp"
 #include <tuple>
 #include <vector>
 #include <stdexcept>
@@ -25,17 +26,71 @@
  */
 namespace ra {
 
+/** \brief The weight systematics of an event
+ *
+ * Modules computing a correction to the event weight with an uncertainty declare the systematic parameter once in begin_dataset
+ * via InputManager::declare_weight_systematic and set the scale factors at -1 and +1 for each event in the Event member \c member_name,
+ * if the variations are used at all:
+ * \code
+ * // in begin_dataset:
+ * elesf_used = &in.declare_weight_systematic(elesf_id); // elesf_id is an identifier member, e.g. initialized to "elesf"
+ * h_systs = in.get_handle<weight_systematics>(weight_systematics::member_name);
+ * 
+ * // in process:
+ * if(*elesf_used){
+ *     weight_systematics::get(event, h_systs).set(elesf_id, 1.0 - rel_error, 1.0 + rel_error);
+ * }
+ * \endcode
+ * 
+ * HistFiller uses this to fill the histograms for all weight variations in the same pass as the nominal ones,
+ * see its \c weight_systematics setting.
+ */
 class weight_systematics {
 public:
+    // set the scale factors for the given parameter, replacing any previous setting for this parameter in this event.
     void set(const identifier & syst_par, float minus_weight_factor, float plus_weight_factor){
+        for(auto & s : all_syst){
+            if(std::get<0>(s) == syst_par){
+                std::get<1>(s) = minus_weight_factor;
+                std::get<2>(s) = plus_weight_factor;
+                return;
+            }
+        }
         all_syst.emplace_back(syst_par, minus_weight_factor, plus_weight_factor);
     }
     
     // parameter name, sf at -1.0, sf at +1.0
     typedef std::tuple<identifier, float, float> single_syst;
 
-    const std::vector<single_syst> & get_systs(const identifier & syst_par) const{
-        return all_systs;
+    const std::vector<single_syst> & get_systs() const{
+        return all_syst;
+    }
+    
+    // the scale factor for the given parameter at -1 (plus = false) or +1 (plus = true); 1.0 if not set for this event.
+    float factor(const identifier & syst_par, bool plus) const{
+        for(const auto & s : all_syst){
+            if(std::get<0>(s) == syst_par){
+                return plus ? std::get<2>(s) : std::get<1>(s);
+            }
+        }
+        return 1.0f;
+    }
+    
+    void clear(){
+        all_syst.clear();
+    }
+    
+    // the name of the Event member for the weight systematics of the event
+    static const char * const member_name;
+    
+    // get the weight systematics of the event to set a parameter; this is empty for the first call in an event.
+    static weight_systematics & get(Event & event, const Event::Handle<weight_systematics> & handle){
+        if(event.get_state(handle) == Event::state::valid){
+            return event.get(handle);
+        }
+        weight_systematics & result = event.recycle(handle);
+        result.clear();
+        return result;
     }
     
 private:
@@ -1,7 +1,16 @@
 #include "analysis.hpp"
+#include "eventbatch.hpp"
 
 using namespace ra;
 
 AnalysisModule::~AnalysisModule(){}
 
+void AnalysisModule::process_batch(EventBatch & batch){
+    for(size_t i=0; i<batch.size(); ++i){
+        if(batch.is_active(i)){
+            process(batch.event(i));
+        }
+    }
+}
+
 
@@ -1,6 +1,7 @@
 #include "config.hpp"
 #include "base/include/log.hpp"
 #include "base/include/utils.hpp"
+#include "root-utils.hpp"
 
 #include <fstream>
 #include <boost/property_tree/ptree.hpp>
@@ -9,6 +10,8 @@
 
 #include <set>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 
 using boost::property_tree::ptree;
 using namespace std;
@@ -60,9 +63,27 @@ vector<string> parse_sframe_xml(const string & path){
     return result;
 }
 
+// parse whitespace-separated entry numbers from in, ignoring comments starting with '#'
+void parse_entries(istream & in, vector<size_t> & entries, const string & context){
+    string line;
+    while(getline(in, line)){
+        line = line.substr(0, line.find('#'));
+        istringstream ss(line);
+        string token;
+        while(ss >> token){
+            try{
+                entries.push_back(boost::lexical_cast<size_t>(token));
+            }
+            catch(boost::bad_lexical_cast &){
+                throw runtime_error("invalid entry number '" + token + "' in " + context);
+            }
+        }
+    }
 }
 
-s_options::s_options(const ptree & options_cfg): blocksize(5000), maxevents_hint(-1), output_dir("."), keep_unmerged(false), mergemode(mm_master) {
+}
+
+s_options::s_options(const ptree & options_cfg): blocksize(5000), batchsize(1), nthreads(1), prefetch(0), maxevents_hint(-1), output_dir("."), keep_unmerged(false), mergemode(mm_master) {
     auto logger = Logger::get("ra.config.options");
     std::string verb("info");
     for(const auto & cfg : options_cfg){
@@ -72,6 +93,24 @@ s_options::s_options(const ptree & options_cfg): blocksize(5000), maxevents_hint
                 LOG_THROW("blocksize <= 0 invalid");
             }
         }
+        else if(cfg.first == "batchsize"){
+            batchsize = try_cast<int>("options.batchsize", cfg.second.data());
+            if(batchsize <= 0){
+                LOG_THROW("batchsize <= 0 invalid");
+            }
+        }
+        else if(cfg.first == "nthreads"){
+            nthreads = try_cast<int>("options.nthreads", cfg.second.data());
+            if(nthreads <= 0){
+                LOG_THROW("nthreads <= 0 invalid");
+            }
+        }
+        else if(cfg.first == "prefetch"){
+            prefetch = try_cast<int>("options.prefetch", cfg.second.data());
+            if(prefetch < 0){
+                LOG_THROW("prefetch < 0 invalid");
+            }
+        }
         else if(cfg.first == "output_dir"){
             output_dir = cfg.second.data();
             if(!output_dir.empty() && output_dir[output_dir.size()-1]=='/'){
@@ -93,6 +132,9 @@ s_options::s_options(const ptree & options_cfg): blocksize(5000), maxevents_hint
         else if(cfg.first == "default_treename"){
             default_treename = cfg.second.data();
         }
+        else if(cfg.first == "derived_cache_dir"){
+            derived_cache_dir = cfg.second.data();
+        }
         else if(cfg.first == "keep_unmerged"){
             keep_unmerged = try_cast<bool>("options.keep_unmerged", cfg.second.data());
         }
@@ -116,16 +158,34 @@ s_options::s_options(const ptree & options_cfg): blocksize(5000), maxevents_hint
     }
 }
 
-s_options::s_options(): blocksize(5000), maxevents_hint(-1), output_dir("."), keep_unmerged(false){
+s_options::s_options(): blocksize(5000), batchsize(1), nthreads(1), prefetch(0), maxevents_hint(-1), output_dir("."), keep_unmerged(false){
 }
     
 s_dataset::s_file::s_file(const ptree & cfg){
     path = ptree_get<string>(cfg, "path");
     nevents = ptree_get<int>(cfg, "nevents", -1);
     skip = ptree_get<unsigned int>(cfg, "skip", 0);
+    has_entries = false;
+    auto s_entries = cfg.get_optional<string>("entries");
+    if(s_entries){
+        istringstream in(*s_entries);
+        parse_entries(in, entries, "entries of file '" + path + "'");
+        has_entries = true;
+    }
+    auto entries_file = cfg.get_optional<string>("entries-file");
+    if(entries_file){
+        ifstream in(entries_file->c_str());
+        if(!in){
+            throw runtime_error("could not open entries-file '" + *entries_file + "'");
+        }
+        parse_entries(in, entries, "entries-file '" + *entries_file + "'");
+        has_entries = true;
+    }
+    sort(entries.begin(), entries.end());
+    entries.erase(unique(entries.begin(), entries.end()), entries.end());
 }
 
-s_dataset::s_file::s_file(string s): path(std::move(s)), nevents(-1), skip(0) {}
+s_dataset::s_file::s_file(string s): path(std::move(s)), nevents(-1), skip(0), has_entries(false) {}
 
 s_dataset::s_tags::s_tags(const boost::property_tree::ptree & tree){
     size_t n = 0;
@@ -156,6 +216,15 @@ s_dataset::s_dataset(const ptree & cfg){
                 files.emplace_back(move(f));
             }
         }
+        else if(it.first == "file-manifest"){
+            // the event tree chunks of the output of a previous run, see ra::read_manifest:
+            vector<output_chunk> chunks = read_manifest(it.second.data());
+            LOG_INFO("manifest file '" << it.second.data() << "' had " << chunks.size() << " chunks");
+            for(auto & chunk : chunks){
+                files.emplace_back(std::move(chunk.filename));
+                files.back().nevents = chunk.nentries;
+            }
+        }
         else if(it.first == "sframe-xml-file"){
             vector<string> filenames = parse_sframe_xml(it.second.data());
             LOG_INFO("sframe xml file '" << it.second.data() << "' had " << filenames.size() << " file names");
@@ -0,0 +1,430 @@
+#include "context-backend.hpp"
+#include "event.hpp"
+#include "base/include/utils.hpp"
+#include "base/include/ptree-utils.hpp"
+#include "base/include/log.hpp"
+#include "root-utils.hpp"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TClass.h"
+#include "TBufferFile.h"
+#include "TDataType.h"
+
+#include <map>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace ra;
+using namespace std;
+
+/* Columnar cache input backend
+ *
+ * Reads the declared branches of a TTree from a cache of uncompressed, memory-mapped column files, one per
+ * input file and branch. A missing column file is created from the TTree on setup_input_file, by reading all entries of that
+ * branch once; later runs (e.g. with other configurations on the same dataset) read the mapped pages directly, without
+ * decompression.
+ *
+ * The column files are in the directory <cache_dir>/<file key>/<treename>/ where the file key is a hash of the input
+ * file size and content of its first and last MB (which contain the ROOT file header and the keys list, respectively),
+ * so a re-written input file gets a new cache.
+ *
+ * Column file format (all integers are uint64 in host byte order):
+ *  - header: magic, nentries, elem_size, data_pos, offsets_pos, typename length, typename (padded to 8 bytes)
+ *  - for fundamental types (elem_size > 0): data at data_pos, with nentries * elem_size bytes.
+ *  - for class types (elem_size = 0): data at data_pos, with the objects serialized via TClass::Streamer, and
+ *    nentries + 1 offsets at offsets_pos, relative to data_pos.
+ */
+
+namespace {
+
+const char column_magic[8] = {'r', 'a', 'c', 'o', 'l', '0', '0', '1'};
+
+// name of the type as stored in the column file, to check that the column is read with the correct type
+string column_typename(const std::type_info & ti){
+    TClass * class_ = TBuffer::GetClass(ti);
+    if(class_) return class_->GetName();
+    return TDataType::GetTypeName(TDataType::GetType(ti));
+}
+
+size_t fundamental_size(const std::type_info & ti){
+    if(TBuffer::GetClass(ti)) return 0;
+    TDataType * dt = TDataType::GetDataType(TDataType::GetType(ti));
+    if(!dt){
+        throw invalid_argument("ColumnCacheInputManager: type '" + demangle(ti.name()) + "' not known to ROOT");
+    }
+    return dt->Size();
+}
+
+// FNV-1a
+void hash_update(uint64_t & hash, const char * data, size_t n){
+    for(size_t i=0; i<n; ++i){
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+}
+
+string file_key(const string & filename){
+    const off_t blocksize = 1 << 20;
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw runtime_error("ColumnCacheInputManager: could not open input file '" + filename + "'");
+    }
+    struct stat st;
+    fstat(fd, &st);
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t size = st.st_size;
+    hash_update(hash, reinterpret_cast<const char*>(&size), sizeof(size));
+    vector<char> buf(blocksize);
+    for(off_t offset : {off_t(0), max<off_t>(st.st_size - blocksize, 0)}){
+        ssize_t n = pread(fd, buf.data(), blocksize, offset);
+        if(n < 0){
+            close(fd);
+            throw runtime_error("ColumnCacheInputManager: error reading input file '" + filename + "'");
+        }
+        hash_update(hash, buf.data(), n);
+    }
+    close(fd);
+    stringstream ss;
+    ss << hex << hash;
+    return ss.str();
+}
+
+// a read-only memory-mapped column file
+class column {
+public:
+    explicit column(const string & filename);
+    ~column();
+
+    column(const column &) = delete;
+
+    uint64_t get_nentries() const{
+        return nentries;
+    }
+
+    const string & get_typename() const{
+        return type_name;
+    }
+
+    // get the data of the given entry. n is set to its size in bytes.
+    const char * get(uint64_t ientry, size_t & n) const{
+        if(elem_size > 0){
+            n = elem_size;
+            return data + ientry * elem_size;
+        }
+        n = offsets[ientry + 1] - offsets[ientry];
+        return data + offsets[ientry];
+    }
+
+private:
+    void * mapped;
+    size_t mapped_size;
+    uint64_t nentries, elem_size;
+    string type_name;
+    const char * data;
+    const uint64_t * offsets;
+};
+
+column::column(const string & filename): mapped(MAP_FAILED), mapped_size(0){
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw runtime_error("ColumnCacheInputManager: could not open column file '" + filename + "'");
+    }
+    struct stat st;
+    fstat(fd, &st);
+    mapped_size = st.st_size;
+    if(mapped_size >= sizeof(column_magic) + 5 * sizeof(uint64_t)){
+        mapped = mmap(0, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(mapped == MAP_FAILED || memcmp(mapped, column_magic, sizeof(column_magic)) != 0){
+        if(mapped != MAP_FAILED) munmap(mapped, mapped_size);
+        throw runtime_error("ColumnCacheInputManager: '" + filename + "' is not a valid column file");
+    }
+    const char * base = static_cast<const char*>(mapped);
+    const uint64_t * header = reinterpret_cast<const uint64_t*>(base + sizeof(column_magic));
+    nentries = header[0];
+    elem_size = header[1];
+    const uint64_t header_size = sizeof(column_magic) + 5 * sizeof(uint64_t);
+    const uint64_t data_pos = header[2], offsets_pos = header[3], typename_size = header[4];
+    // check all positions against the file size, so that a truncated or corrupt file cannot make get read outside the
+    // mapped memory. Note that the comparisons are written to avoid overflows for large header values.
+    bool valid = typename_size <= mapped_size - header_size && data_pos >= header_size + typename_size && data_pos <= mapped_size;
+    if(valid && elem_size > 0){
+        valid = nentries <= (mapped_size - data_pos) / elem_size;
+    }
+    else if(valid){
+        valid = offsets_pos % sizeof(uint64_t) == 0 && offsets_pos >= data_pos && offsets_pos <= mapped_size
+            && nentries < (mapped_size - offsets_pos) / sizeof(uint64_t);
+        if(valid){
+            const uint64_t * entry_offsets = reinterpret_cast<const uint64_t*>(base + offsets_pos);
+            valid = entry_offsets[0] == 0;
+            for(uint64_t i=0; valid && i<nentries; ++i){
+                valid = entry_offsets[i] <= entry_offsets[i+1];
+            }
+            valid = valid && entry_offsets[nentries] <= offsets_pos - data_pos;
+        }
+    }
+    if(!valid){
+        munmap(mapped, mapped_size);
+        throw runtime_error("ColumnCacheInputManager: '" + filename + "' has an invalid header (truncated or corrupt column file?)");
+    }
+    data = base + data_pos;
+    offsets = reinterpret_cast<const uint64_t*>(base + offsets_pos);
+    type_name.assign(reinterpret_cast<const char*>(header + 5), typename_size);
+}
+
+column::~column(){
+    munmap(mapped, mapped_size);
+}
+
+// write the column file for a branch. To allow several processes to create the same column concurrently, it is written
+// to a temporary file first which is then renamed.
+void write_column(const string & filename, TTree * tree, const string & branchname, const std::type_info & ti){
+    EventStructure es;
+    auto handle = es.get_raw_handle(ti, branchname);
+    Event event(es);
+    InTree intree(tree, false);
+    intree.open_branch(ti, branchname, event, handle);
+
+    const string tmpfilename = filename + ".tmp" + std::to_string(getpid());
+    ofstream out(tmpfilename, ios::binary);
+    const string type_name = column_typename(ti);
+    const uint64_t nentries = intree.get_entries();
+    const uint64_t elem_size = fundamental_size(ti);
+    const uint64_t header_size = sizeof(column_magic) + 5 * sizeof(uint64_t) + (type_name.size() + 7) / 8 * 8;
+    // header is written at the end, when the offsets are known:
+    out.write(string(header_size, '\0').data(), header_size);
+    TClass * class_ = TBuffer::GetClass(ti);
+    TBufferFile buf(TBuffer::kWrite);
+    vector<uint64_t> offsets(1, 0);
+    for(uint64_t i=0; i<nentries; ++i){
+        intree.get_entry(i);
+        void * addr = event.get(ti, handle);
+        if(class_){
+            buf.Reset();
+            class_->Streamer(addr, buf);
+            out.write(buf.Buffer(), buf.Length());
+            offsets.push_back(offsets.back() + buf.Length());
+        }
+        else{
+            out.write(static_cast<const char*>(addr), elem_size);
+        }
+    }
+    uint64_t offsets_pos = 0;
+    if(class_){
+        // align the offsets to 8 bytes:
+        const uint64_t padding = (8 - offsets.back() % 8) % 8;
+        out.write(string(padding, '\0').data(), padding);
+        offsets_pos = header_size + offsets.back() + padding;
+        out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    }
+    const uint64_t header[5] = {nentries, elem_size, header_size, offsets_pos, type_name.size()};
+    out.seekp(0);
+    out.write(column_magic, sizeof(column_magic));
+    out.write(reinterpret_cast<const char*>(header), 5 * sizeof(uint64_t));
+    out.write(type_name.data(), type_name.size());
+    out.close();
+    if(!out){
+        unlink(tmpfilename.c_str());
+        throw runtime_error("ColumnCacheInputManager: error writing column file '" + filename + "'");
+    }
+    if(rename(tmpfilename.c_str(), filename.c_str()) != 0){
+        unlink(tmpfilename.c_str());
+        throw runtime_error("ColumnCacheInputManager: error renaming column file to '" + filename + "'");
+    }
+}
+
+}
+
+class ColumnCacheInputManager: public InputManagerBackend {
+public:
+    ColumnCacheInputManager(EventStructure & es_, const ptree & cfg);
+
+    virtual void do_declare_event_input(const std::type_info & ti, const std::string & bname, const std::string & mname) override;
+
+    virtual size_t setup_input_file(Event & event, const string & treename, const std::string & filename) override;
+
+    virtual void read_event(Event & event, size_t ievent) override;
+
+    virtual void add_input_event(Event & event) override;
+
+    virtual size_t nbytes_read() override {
+        return nbytes.exchange(0);
+    }
+
+private:
+    struct branchinfo {
+        const type_info & ti;
+        Event::RawHandle handle;
+        std::string branchname;
+        TClass * class_;
+        std::unique_ptr<column> col; // for the current file
+
+        branchinfo(const type_info & ti_, const Event::RawHandle & handle_, const std::string & branchname_): ti(ti_), handle(handle_),
+            branchname(branchname_), class_(TBuffer::GetClass(ti_)){}
+    };
+
+    // per Event container to read into: the address of the member data, for each branch
+    struct event_info {
+        Event * event;
+        std::vector<void*> addrs;
+        uint64_t current_index = 0;
+    };
+
+    void read_member(event_info & ei, size_t ibranch);
+    event_info & setup_event(Event & event);
+
+    std::vector<branchinfo> branch_infos;
+    std::map<const Event*, std::unique_ptr<event_info>> events; // unique_ptr to keep addresses valid for the callbacks
+    std::string cache_dir;
+    bool lazy;
+    std::atomic<size_t> nbytes;
+    std::shared_ptr<Logger> logger;
+};
+
+REGISTER_INPUT_MANAGER_BACKEND(ColumnCacheInputManager, "colcache")
+
+ColumnCacheInputManager::ColumnCacheInputManager(EventStructure & es_, const ptree & cfg): InputManagerBackend(es_), nbytes(0),
+  logger(Logger::get("ra.ColumnCacheInputManager")){
+    cache_dir = ptree_get<string>(cfg, "cache_dir", "colcache");
+    lazy = ptree_get<bool>(cfg, "lazy", false);
+}
+
+void ColumnCacheInputManager::do_declare_event_input(const std::type_info & ti, const std::string & bname, const std::string & mname){
+    Event::RawHandle handle = es.get_raw_handle(ti, mname);
+    for(const auto & bi : branch_infos){
+        if(bi.branchname != bname) continue;
+        if(bi.handle == handle) return; // declared before, e.g. by another module
+        throw invalid_argument("ColumnCacheInputManager: branch '" + bname + "' declared more than once with different type or Event member name");
+    }
+    branch_infos.emplace_back(ti, handle, bname);
+}
+
+size_t ColumnCacheInputManager::setup_input_file(Event & event, const string & treename, const std::string & filename){
+    events.clear();
+    string treedir = treename;
+    replace(treedir.begin(), treedir.end(), '/', '_');
+    const string dir = cache_dir + "/" + file_key(filename) + "/" + treedir;
+    std::unique_ptr<TFile> file;
+    TTree * tree = nullptr;
+    size_t nentries = 0;
+    for(size_t i=0; i<branch_infos.size(); ++i){
+        auto & bi = branch_infos[i];
+        const string colfilename = dir + "/" + bi.branchname;
+        if(!is_regular_file(colfilename)){
+            if(!file){
+                LOG_INFO("creating column cache for '" << filename << "' in " << dir);
+                mkdir_recursive(dir);
+                file.reset(new TFile(filename.c_str(), "read"));
+                if(!file->IsOpen()){
+                    throw runtime_error("ColumnCacheInputManager::setup_input_file: Error opening root file '" + filename + "'");
+                }
+                tree = dynamic_cast<TTree*>(file->Get(treename.c_str()));
+                if(!tree){
+                    throw runtime_error("ColumnCacheInputManager::setup_input_file: did not find TTree '" + treename + "' in file '" + filename + "'");
+                }
+            }
+            write_column(colfilename, tree, bi.branchname, bi.ti);
+        }
+        bi.col.reset(new column(colfilename));
+        if(bi.col->get_typename() != column_typename(bi.ti)){
+            throw runtime_error("ColumnCacheInputManager: Type error for branch '" + bi.branchname + "': column holds type '"
+                + bi.col->get_typename() + "', but tried to read into object of type '" + column_typename(bi.ti) + "'");
+        }
+        if(i > 0 && bi.col->get_nentries() != nentries){
+            throw runtime_error("ColumnCacheInputManager: inconsistent number of entries in column '" + colfilename + "'");
+        }
+        nentries = bi.col->get_nentries();
+    }
+    if(branch_infos.empty()){
+        // no column to get the number of entries from, so read it from the tree:
+        TFile f(filename.c_str(), "read");
+        TTree * t = dynamic_cast<TTree*>(f.Get(treename.c_str()));
+        if(!t){
+            throw runtime_error("ColumnCacheInputManager::setup_input_file: did not find TTree '" + treename + "' in file '" + filename + "'");
+        }
+        nentries = t->GetEntries();
+    }
+    setup_event(event);
+    return nentries;
+}
+
+ColumnCacheInputManager::event_info & ColumnCacheInputManager::setup_event(Event & event){
+    std::unique_ptr<event_info> ei(new event_info());
+    ei->event = &event;
+    for(size_t i=0; i<branch_infos.size(); ++i){
+        const auto & bi = branch_infos[i];
+        void * addr = event.get(bi.ti, bi.handle, Event::state::nonexistent);
+        if(addr == nullptr){
+            addr = event.set_inline(bi.ti, bi.handle);
+        }
+        if(addr == nullptr){
+            std::function<void (void*)> eraser;
+            addr = allocate_type(bi.ti, eraser);
+            event.set(bi.ti, bi.handle, addr, move(eraser));
+            event.set_validity(bi.ti, bi.handle, false);
+        }
+        ei->addrs.push_back(addr);
+        if(lazy){
+            event_info * pei = ei.get();
+            event.set_get_callback(bi.ti, bi.handle, [this, pei, i](){ this->read_member(*pei, i); });
+        }
+        else{
+            event.set_get_callback(bi.ti, bi.handle, std::function<void ()>());
+        }
+    }
+    auto & result = *ei;
+    events[&event] = move(ei);
+    return result;
+}
+
+void ColumnCacheInputManager::add_input_event(Event & event){
+    if(events.empty()){
+        throw runtime_error("ColumnCacheInputManager::add_input_event called before setup_input_file");
+    }
+    setup_event(event);
+}
+
+void ColumnCacheInputManager::read_member(event_info & ei, size_t ibranch){
+    const auto & bi = branch_infos[ibranch];
+    size_t n;
+    const char * data = bi.col->get(ei.current_index, n);
+    if(bi.class_){
+        TBufferFile buf(TBuffer::kRead, n, const_cast<char*>(data), false);
+        bi.class_->Streamer(ei.addrs[ibranch], buf);
+    }
+    else{
+        memcpy(ei.addrs[ibranch], data, n);
+    }
+    ei.event->set_validity(bi.handle, true);
+    nbytes += n;
+}
+
+void ColumnCacheInputManager::read_event(Event & event, size_t ientry){
+    auto it = events.find(&event);
+    if(it == events.end()){
+        throw runtime_error("ColumnCacheInputManager::read_event: Event container was not set up via setup_input_file or add_input_event");
+    }
+    auto & ei = *it->second;
+    ei.current_index = ientry;
+    for(size_t i=0; i<branch_infos.size(); ++i){
+        if(ientry >= branch_infos[i].col->get_nentries()){
+            throw runtime_error("ColumnCacheInputManager::read_event: index out of bounds");
+        }
+        if(lazy){
+            event.set_validity(branch_infos[i].handle, false);
+        }
+        else{
+            read_member(ei, i);
+        }
+    }
+}
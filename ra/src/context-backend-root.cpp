@@ -2,6 +2,7 @@
 #include "event.hpp"
 #include "base/include/utils.hpp"
 #include "base/include/ptree-utils.hpp"
+#include "base/include/log.hpp"
 #include "identifier.hpp"
 #include "root-utils.hpp"
 
@@ -9,13 +10,116 @@
 #include "TFile.h"
 #include "TTree.h"
 #include "TEmulatedCollectionProxy.h"
+#include "TTreeCache.h"
+#include "TTreeCacheUnzip.h"
+#include "TEventList.h"
+#include "TBufferFile.h"
+#include "TDataType.h"
+#include "TThread.h"
 #include "TH1.h"
 
 #include <list>
+#include <algorithm>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <unistd.h>
+#include <fcntl.h>
 
 using namespace ra;
 using namespace std;
 
+namespace {
+
+// statistics of the read cache, see TTreeInputManager::io_totals
+class cache_counts {
+public:
+    virtual size_t nhits() const = 0;
+    virtual size_t nmisses() const = 0;
+    
+    // number of baskets which were / were not decompressed in advance when needed; 0 without parallel unzipping.
+    virtual size_t nunzip_found() const {
+        return 0;
+    }
+    
+    virtual size_t nunzip_missed() const {
+        return 0;
+    }
+    
+    virtual ~cache_counts(){}
+};
+
+// TTreeCache with access to the hit and miss counters; Base is TTreeCache or TTreeCacheUnzip
+template<typename Base>
+class counting_tree_cache: public Base, public cache_counts {
+public:
+    counting_tree_cache(TTree * tree, Int_t buffersize): Base(tree, buffersize){}
+    
+    virtual size_t nhits() const override {
+        return this->fNReadOk;
+    }
+    
+    virtual size_t nmisses() const override {
+        return this->fNReadMiss;
+    }
+};
+
+class counting_unzip_cache: public counting_tree_cache<TTreeCacheUnzip> {
+public:
+    counting_unzip_cache(TTree * tree, Int_t buffersize): counting_tree_cache<TTreeCacheUnzip>(tree, buffersize){}
+    
+    virtual size_t nunzip_found() const override {
+        return fNFound;
+    }
+    
+    virtual size_t nunzip_missed() const override {
+        return fNMissed;
+    }
+};
+
+// give the kernel a readahead hint for the baskets of branch (and its sub-branches) containing entries in [first, last). fd is
+// a file descriptor of the file the branch is stored in.
+void advise_branch(TBranch * branch, int fd, int64_t first, int64_t last){
+    const int nbaskets = branch->GetWriteBasket();
+    const Long64_t * basket_entry = branch->GetBasketEntry();
+    const Int_t * basket_bytes = branch->GetBasketBytes();
+    for(int i=0; i<nbaskets; ++i){
+        const int64_t basket_last = i + 1 < nbaskets ? basket_entry[i+1] : branch->GetEntries();
+        if(basket_last <= first) continue;
+        if(basket_entry[i] >= last) break;
+        posix_fadvise(fd, branch->GetBasketSeek(i), basket_bytes[i], POSIX_FADV_WILLNEED);
+    }
+    TObjArray * subbranches = branch->GetListOfBranches();
+    for(int i=0; i<subbranches->GetEntriesFast(); ++i){
+        TBranch * sub = static_cast<TBranch*>(subbranches->At(i));
+        // skip the sub-branches not read for partially read branches:
+        if(sub->TestBit(kDoNotProcess)) continue;
+        advise_branch(sub, fd, first, last);
+    }
+}
+
+void advise_branches(TTree * tree, const vector<string> & branchnames, int fd, int64_t first, int64_t last){
+    for(const auto & bname : branchnames){
+        TBranch * branch = tree->GetBranch(bname.c_str());
+        if(branch) advise_branch(branch, fd, first, last);
+    }
+}
+
+// the end of the cluster containing entry
+int64_t cluster_end(TTree * tree, int64_t entry){
+    auto it = tree->GetClusterIterator(entry);
+    it();
+    return min<int64_t>(it.GetNextEntry(), tree->GetEntries());
+}
+
+}
+
 class TTreeInputManager: public InputManagerBackend {
 public:
     
@@ -23,12 +127,34 @@ public:
     
     virtual void do_declare_event_input(const std::type_info & ti, const std::string & bname, const std::string & mname) override;
     
+    virtual void do_declare_partial_input(const std::type_info & ti, const std::string & bname, const std::string & mname,
+                                          const std::vector<std::string> & data_members) override;
+    
     virtual size_t setup_input_file(Event & event, const string & treename, const std::string & filename) override;
     
     virtual void read_event(Event & event, size_t ievent) override;
+    
+    virtual void add_input_event(Event & event) override;
+    
+    virtual std::vector<size_t> get_cluster_starts() override;
+    
+    virtual io_statistics get_io_statistics() override;
+    
+    virtual void set_entry_list(const std::vector<size_t> * entries) override;
+    
+    virtual bool set_friend_inputs(const std::vector<friend_input> & friends) override;
+    
+    virtual void prepare_next_file(const std::string & treename, const std::string & filename) override;
+    
+    virtual ~TTreeInputManager();
 
     virtual size_t nbytes_read() override {
-        return intree->get_reset_bytes_read();
+        size_t result = nbytes_read_discarded;
+        nbytes_read_discarded = 0;
+        for(auto & e_intree : intrees){
+            result += e_intree.second.intree->get_reset_bytes_read();
+        }
+        return result;
     }
     
 private:
@@ -38,49 +164,623 @@ private:
         const type_info & ti;
         Event::RawHandle handle;
         std::string branchname;
+        // the data members to read if the branch is only declared via declare_partial_input; empty = read the complete objects
+        std::vector<std::string> data_members;
         
         branchinfo(const type_info & ti_, const Event::RawHandle & handle_, const std::string & branchname_): ti(ti_), handle(handle_), branchname(branchname_){}
     };
     
     void read_branch(branchinfo & bi);
     
+    // find the branchinfo for a branch declared before, or nullptr if not declared yet. Throws an invalid_argument if it has
+    // been declared with another type or Event member.
+    branchinfo * find_declared(const std::string & bname, const Event::RawHandle & handle);
+    
     std::list<branchinfo> branch_infos;
     bool lazy;
     
+    // branch pruning, see the 'prune' option:
+    bool prune;
+    int64_t prune_nevents;
+    std::string prune_profile_filename;
+    int64_t nevents_profiled = 0;
+    bool have_profile = false;
+    std::map<std::string, InTree::read_mode> profile; // by branch name
+    size_t nbytes_read_discarded = 0; // bytes read by InTrees which have been replaced
+    
+    void make_profile();
+    void read_profile();
+    void write_profile() const;
+    
+    // read cache, see 'cache_size' option:
+    int64_t cache_size;
+    int cache_learn_entries;
+    bool parallel_unzip;
+    TTreeCache * cache = nullptr; // owned by tree
+    cache_counts * cache_stats = nullptr; // the same object as cache
+    
+    void setup_cache();
+    
+    // I/O statistics: totals for the current file so far and the part of that already reported:
+    io_statistics io_totals() const;
+    io_statistics io_reported;
+    io_statistics io_previous_files; // not yet reported totals of previous files
+    
+    // the entries set via set_entry_list; only used with a read cache, which then skips the baskets
+    // without any of these entries. Declared before file, as the tree refers to it.
+    std::unique_ptr<TEventList> entry_list;
+    
+    // friend trees, see set_friend_inputs. The branches are read eagerly. The files are declared before file, as
+    // its tree refers to them.
+    std::vector<friend_input> friend_inputs;
+    std::list<branchinfo> friend_branch_infos;
+    std::list<std::unique_ptr<TFile>> friend_files;
+    
     std::unique_ptr<TFile> file;
-    std::unique_ptr<InTree> intree;
+    TTree * tree = nullptr; // owned by file
+    
+    // locked while reading from tree, as lazy reads can happen in another thread than read_event, if
+    // the AnalysisController reads ahead (see 'prefetch' option)
+    std::mutex tree_mutex;
+    
+    // one InTree per Event container to read into. Usually, there is only one, except for batch processing.
+    struct intree_info {
+        std::unique_ptr<InTree> intree;
+        Event * event = nullptr;
+        bool uses_profile; // true if the InTree has been created using the pruning profile
+        bool has_entry = false; // true if an entry has been read into the Event
+    };
+    std::map<const Event*, intree_info> intrees;
+    size_t intrees_fingerprint = 0; // InTree::layout_fingerprint of the tree the intrees were created for
+    bool intrees_friends = false; // true if the intrees were created with friend trees, i.e. also read friend_branch_infos
+    // for batch processing, i.e. if there is more than one InTree: the read buffers shared by all InTrees, so the branch
+    // addresses do not have to be re-set each time another Event is read. Created in the first call to add_input_event.
+    std::shared_ptr<InTree::read_buffers> read_buffers;
+    
+    InTree & create_intree(Event & event);
+    
+    // opening the next file in the background, see 'preopen' option:
+    bool preopen;
+    struct preopened_file {
+        std::string treename, filename;
+        std::unique_ptr<TFile> file; // nullptr if opening failed
+        int fd = -1; // for readahead hints; -1 if not used
+        int64_t advised_end = 0;
+        
+        ~preopened_file(){
+            if(fd >= 0) close(fd);
+        }
+    };
+    std::unique_ptr<preopened_file> next_file; // written by preopen_thread
+    std::thread preopen_thread;
+    
+    void join_preopen();
+    
+    // readahead hints, see 'fadvise' option: a file descriptor of the current input file (-1 if not used), the end of
+    // the entry range for which hints have been given, and the entry from which on to give the next hint.
+    bool fadvise;
+    int fadvise_fd = -1;
+    int64_t fadvise_end = 0, fadvise_next = 0;
+    
+    // the branches to give hints for
+    std::vector<std::string> advise_branchnames() const;
+    void advise_ahead(int64_t ientry);
 };
 
 REGISTER_INPUT_MANAGER_BACKEND(TTreeInputManager, "root")
 
+TTreeInputManager::branchinfo * TTreeInputManager::find_declared(const std::string & bname, const Event::RawHandle & handle){
+    for(auto & bi : branch_infos){
+        if(bi.branchname != bname) continue;
+        if(bi.handle == handle) return &bi;
+        throw invalid_argument("TTreeInputManager: branch '" + bname + "' declared more than once with different type or Event member name");
+    }
+    return nullptr;
+}
+
 void TTreeInputManager::do_declare_event_input(const std::type_info & ti, const std::string & bname, const std::string & mname){
     Event::RawHandle handle = es.get_raw_handle(ti, mname);
+    branchinfo * bi = find_declared(bname, handle);
+    if(bi){
+        // the complete objects are used, so lift a restriction from declare_partial_input:
+        bi->data_members.clear();
+        return;
+    }
     branch_infos.emplace_back(ti, handle, bname);
 }
 
+void TTreeInputManager::do_declare_partial_input(const std::type_info & ti, const std::string & bname, const std::string & mname,
+                                                 const std::vector<std::string> & data_members){
+    Event::RawHandle handle = es.get_raw_handle(ti, mname);
+    branchinfo * bi = find_declared(bname, handle);
+    if(bi && bi->data_members.empty()){
+        // declared completely before
+        return;
+    }
+    if(!bi){
+        branch_infos.emplace_back(ti, handle, bname);
+        bi = &branch_infos.back();
+    }
+    for(const auto & m : data_members){
+        if(find(bi->data_members.begin(), bi->data_members.end(), m) == bi->data_members.end()){
+            bi->data_members.push_back(m);
+        }
+    }
+}
+
 TTreeInputManager::TTreeInputManager(EventStructure & es_, const ptree & cfg): InputManagerBackend(es_) {
     lazy = ptree_get<bool>(cfg, "lazy", false);
+    prune = ptree_get<bool>(cfg, "prune", false);
+    prune_nevents = ptree_get<int64_t>(cfg, "prune_nevents", 1000);
+    prune_profile_filename = ptree_get<string>(cfg, "prune_profile", "");
+    if(prune && prune_nevents <= 0){
+        throw invalid_argument("TTreeInputManager: prune_nevents <= 0 invalid");
+    }
+    if(prune && !prune_profile_filename.empty() && access(prune_profile_filename.c_str(), F_OK) == 0){
+        read_profile();
+    }
+    cache_size = ptree_get<int64_t>(cfg, "cache_size", 0);
+    cache_learn_entries = ptree_get<int>(cfg, "cache_learn_entries", 0);
+    if(cache_size < 0 || cache_learn_entries < 0){
+        throw invalid_argument("TTreeInputManager: cache_size and cache_learn_entries must not be negative");
+    }
+    parallel_unzip = ptree_get<bool>(cfg, "parallel_unzip", false);
+    if(parallel_unzip){
+        // the baskets are decompressed from the cache buffer, so there is nothing to do without cache:
+        if(cache_size == 0){
+            throw invalid_argument("TTreeInputManager: parallel_unzip requires cache_size > 0");
+        }
+        TThread::Initialize();
+        TTreeCacheUnzip::SetParallelUnzip(TTreeCacheUnzip::kForce);
+    }
+    preopen = ptree_get<bool>(cfg, "preopen", false);
+    fadvise = ptree_get<bool>(cfg, "fadvise", false);
+    if(preopen){
+        TThread::Initialize();
+    }
+}
+
+TTreeInputManager::~TTreeInputManager(){
+    join_preopen();
+    if(fadvise_fd >= 0) close(fadvise_fd);
+}
+
+void TTreeInputManager::join_preopen(){
+    if(preopen_thread.joinable()) preopen_thread.join();
+}
+
+void TTreeInputManager::prepare_next_file(const std::string & treename, const std::string & filename){
+    if(!preopen) return;
+    join_preopen();
+    next_file.reset();
+    const vector<string> branchnames = fadvise ? advise_branchnames() : vector<string>();
+    preopen_thread = std::thread([this, treename, filename, branchnames](){
+        std::unique_ptr<preopened_file> result(new preopened_file());
+        result->treename = treename;
+        result->filename = filename;
+        // errors are not reported here; setup_input_file opens the file again in this case, reporting the error.
+        try{
+            std::unique_ptr<TFile> f(new TFile(filename.c_str(), "read"));
+            TTree * t = f->IsOpen() ? dynamic_cast<TTree*>(f->Get(treename.c_str())) : nullptr;
+            if(t){
+                result->file = move(f);
+                if(!branchnames.empty()){
+                    // only works for local files; others cannot be opened this way:
+                    result->fd = open(filename.c_str(), O_RDONLY);
+                    if(result->fd >= 0){
+                        result->advised_end = cluster_end(t, 0);
+                        advise_branches(t, branchnames, result->fd, 0, result->advised_end);
+                    }
+                }
+            }
+        }
+        catch(...){
+            result->file.reset();
+        }
+        next_file = move(result);
+    });
+}
+
+std::vector<std::string> TTreeInputManager::advise_branchnames() const{
+    std::vector<std::string> result;
+    for(const auto & bi : branch_infos){
+        if(have_profile){
+            auto it = profile.find(bi.branchname);
+            if(it != profile.end() && it->second == InTree::read_mode::disabled) continue;
+        }
+        result.push_back(bi.branchname);
+    }
+    return result;
+}
+
+void TTreeInputManager::advise_ahead(int64_t ientry){
+    // once reading the last cluster hinted, give a hint for the rest of the current and for the next cluster. Hints
+    // are only given when reading forward, which is the usual case.
+    if(ientry < fadvise_next) return;
+    const int64_t end = cluster_end(tree, ientry);
+    const int64_t first = max(ientry, fadvise_end);
+    const int64_t last = end < tree->GetEntries() ? cluster_end(tree, end) : end;
+    if(first < last){
+        advise_branches(tree, advise_branchnames(), fadvise_fd, first, last);
+    }
+    fadvise_next = end;
+    fadvise_end = last;
+}
+
+void TTreeInputManager::setup_cache(){
+    cache = nullptr;
+    cache_stats = nullptr;
+    if(cache_size == 0) return;
+    if(parallel_unzip){
+        auto c = new counting_unzip_cache(tree, cache_size);
+        cache = c;
+        cache_stats = c;
+    }
+    else{
+        auto c = new counting_tree_cache<TTreeCache>(tree, cache_size);
+        cache = c;
+        cache_stats = c;
+    }
+    file->SetCacheRead(cache, tree);
+    if(cache_learn_entries > 0){
+        // let root find out which branches are read in the first entries; as only declared branches are ever read,
+        // this can only restrict the cache to a subset of those.
+        TTreeCache::SetLearnEntries(cache_learn_entries);
+    }
+    else{
+        for(const auto & bi : branch_infos){
+            if(have_profile){
+                auto it = profile.find(bi.branchname);
+                if(it != profile.end() && it->second == InTree::read_mode::disabled) continue;
+            }
+            if(!bi.data_members.empty()){
+                TBranch * branch = tree->GetBranch(bi.branchname.c_str());
+                if(!branch) continue; // reported in create_intree
+                cache->AddBranch(branch, false);
+                for(TBranch * b : get_member_branches(branch, bi.data_members)){
+                    cache->AddBranch(b, false);
+                }
+            }
+            else{
+                cache->AddBranch(bi.branchname.c_str(), true);
+            }
+        }
+        cache->StopLearningPhase();
+    }
+}
+
+TTreeInputManager::io_statistics TTreeInputManager::io_totals() const{
+    io_statistics result;
+    if(file){
+        result.nbytes_file = file->GetBytesRead();
+        result.nreadcalls = file->GetReadCalls();
+    }
+    if(cache){
+        result.ncache_hits = cache_stats->nhits();
+        result.ncache_misses = cache_stats->nmisses();
+        result.nunzip_found = cache_stats->nunzip_found();
+        result.nunzip_missed = cache_stats->nunzip_missed();
+    }
+    return result;
+}
+
+TTreeInputManager::io_statistics TTreeInputManager::get_io_statistics(){
+    io_statistics totals = io_totals();
+    io_statistics result = io_previous_files;
+    result.nbytes_file += totals.nbytes_file - io_reported.nbytes_file;
+    result.nreadcalls += totals.nreadcalls - io_reported.nreadcalls;
+    result.ncache_hits += totals.ncache_hits - io_reported.ncache_hits;
+    result.ncache_misses += totals.ncache_misses - io_reported.ncache_misses;
+    result.nunzip_found += totals.nunzip_found - io_reported.nunzip_found;
+    result.nunzip_missed += totals.nunzip_missed - io_reported.nunzip_missed;
+    io_reported = totals;
+    io_previous_files = io_statistics();
+    return result;
+}
+
+void TTreeInputManager::set_entry_list(const std::vector<size_t> * entries){
+    if(!tree) throw runtime_error("TTreeInputManager::set_entry_list called before setup_input_file");
+    // without a cache, only the baskets of the entries actually read are read anyway:
+    if(!cache) return;
+    lock_guard<mutex> lock(tree_mutex);
+    tree->SetEventList(nullptr);
+    entry_list.reset();
+    if(entries){
+        entry_list.reset(new TEventList("", "", entries->size()));
+        entry_list->SetDirectory(nullptr);
+        for(size_t entry : *entries){
+            entry_list->Enter(entry);
+        }
+        tree->SetEventList(entry_list.get());
+    }
+}
+
+bool TTreeInputManager::set_friend_inputs(const std::vector<friend_input> & friends){
+    friend_inputs = friends;
+    friend_branch_infos.clear();
+    for(const auto & fi : friend_inputs){
+        for(const auto & member : fi.members){
+            friend_branch_infos.emplace_back(*member.first, es.get_raw_handle(*member.first, member.second), member.second);
+        }
+    }
+    return true;
+}
+
+void TTreeInputManager::make_profile(){
+    // sum the number of reads for all Event containers:
+    map<string, int64_t> nreads;
+    for(const auto & e_intree : intrees){
+        for(const auto & b_n : e_intree.second.intree->get_nreads()){
+            nreads[b_n.first] += b_n.second;
+        }
+    }
+    size_t n_eager = 0, n_lazy = 0, n_disabled = 0;
+    for(const auto & bi : branch_infos){
+        const int64_t n = nreads[bi.branchname];
+        InTree::read_mode mode;
+        if(n == 0){
+            mode = InTree::read_mode::disabled;
+            ++n_disabled;
+        }
+        else if(n >= nevents_profiled){
+            mode = InTree::read_mode::eager;
+            ++n_eager;
+        }
+        else{
+            mode = InTree::read_mode::lazy;
+            ++n_lazy;
+        }
+        profile[bi.branchname] = mode;
+    }
+    have_profile = true;
+    if(cache && cache_learn_entries == 0){
+        for(const auto & b_mode : profile){
+            if(b_mode.second == InTree::read_mode::disabled){
+                cache->DropBranch(b_mode.first.c_str(), true);
+            }
+        }
+    }
+    auto logger = Logger::get("ra.TTreeInputManager");
+    LOG_INFO("branch access profile from " << nevents_profiled << " events: reading " << n_eager << " branches eagerly, "
+             << n_lazy << " lazily; disabling " << n_disabled << " branches");
+    if(!prune_profile_filename.empty()){
+        write_profile();
+    }
+}
+
+// the profile file has one line per branch, with the branch name and the read mode separated by a space.
+void TTreeInputManager::read_profile(){
+    ifstream in(prune_profile_filename.c_str());
+    string line;
+    while(getline(in, line)){
+        if(line.empty() || line[0] == '#') continue;
+        istringstream ss(line);
+        string branchname, mode;
+        ss >> branchname >> mode;
+        if(mode == "eager"){
+            profile[branchname] = InTree::read_mode::eager;
+        }
+        else if(mode == "lazy"){
+            profile[branchname] = InTree::read_mode::lazy;
+        }
+        else if(mode == "disabled"){
+            profile[branchname] = InTree::read_mode::disabled;
+        }
+        else{
+            throw runtime_error("TTreeInputManager: invalid line '" + line + "' in branch profile file '" + prune_profile_filename + "'");
+        }
+    }
+    if(in.bad()){
+        throw runtime_error("TTreeInputManager: error reading branch profile file '" + prune_profile_filename + "'");
+    }
+    have_profile = true;
+}
+
+void TTreeInputManager::write_profile() const{
+    // write to a temporary file first and rename it, as several processes / threads might write the same file:
+    stringstream tmpname;
+    tmpname << prune_profile_filename << ".tmp-" << getpid() << "-" << this;
+    {
+        ofstream out(tmpname.str().c_str());
+        out << "# branch read profile; one line per branch with branch name and read mode (eager, lazy, or disabled)" << endl;
+        for(const auto & b_mode : profile){
+            out << b_mode.first << " " << (b_mode.second == InTree::read_mode::eager ? "eager" :
+                                           b_mode.second == InTree::read_mode::lazy ? "lazy" : "disabled") << endl;
+        }
+        if(!out){
+            throw runtime_error("TTreeInputManager: error writing branch profile file '" + tmpname.str() + "'");
+        }
+    }
+    if(rename(tmpname.str().c_str(), prune_profile_filename.c_str()) != 0){
+        throw runtime_error("TTreeInputManager: error renaming branch profile file to '" + prune_profile_filename + "'");
+    }
 }
 
 size_t TTreeInputManager::setup_input_file(Event & event, const string & treename, const std::string & filename){
-    file.reset(new TFile(filename.c_str(), "read"));
+    // keep the statistics of the previous file for the next call to get_io_statistics:
+    io_statistics last_file = get_io_statistics();
+    cache = nullptr;
+    // use the file opened by prepare_next_file, if it is the right one:
+    join_preopen();
+    std::unique_ptr<preopened_file> pre = move(next_file);
+    if(pre && (!pre->file || pre->filename != filename || pre->treename != treename)){
+        pre.reset();
+    }
+    file.reset(pre ? pre->file.release() : new TFile(filename.c_str(), "read"));
+    if(fadvise_fd >= 0){
+        close(fadvise_fd);
+        fadvise_fd = -1;
+    }
+    fadvise_end = fadvise_next = 0;
+    if(pre && pre->fd >= 0){
+        fadvise_fd = pre->fd;
+        pre->fd = -1;
+        fadvise_end = pre->advised_end;
+    }
+    else if(fadvise){
+        fadvise_fd = open(filename.c_str(), O_RDONLY);
+    }
+    io_previous_files = last_file;
+    io_reported = io_statistics();
+    entry_list.reset();
     if(!file->IsOpen()){
         throw runtime_error("TTreeInputManager::setup_input_file: Error opening root file '" + filename + "'");
     }
-    TTree * tree = dynamic_cast<TTree*>(file->Get(treename.c_str()));
+    if(!have_profile){
+        // start profiling again for this file:
+        nevents_profiled = 0;
+    }
+    tree = dynamic_cast<TTree*>(file->Get(treename.c_str()));
     if(!tree){
+        intrees.clear();
         throw runtime_error("TTreeInputManager::setup_input_file: did not find TTree '" + treename + "' in file '" + filename + "'");
     }
-    intree.reset(new InTree(tree, lazy));
-    
+    // re-use the InTrees if the tree has the same layout as the previous one, which is the usual case for the files of a dataset. This
+    // is not done with friend trees, which have a different layout for each file, neither for this nor for the previous file (as the
+    // InTrees of the previous file also read the branches of its friends):
+    const size_t fingerprint = InTree::layout_fingerprint(tree);
+    if(fingerprint == intrees_fingerprint && friend_inputs.empty() && !intrees_friends){
+        for(auto & e_intree : intrees){
+            e_intree.second.intree->switch_tree(tree);
+            e_intree.second.has_entry = false;
+        }
+    }
+    else{
+        for(auto & e_intree : intrees){
+            nbytes_read_discarded += e_intree.second.intree->get_reset_bytes_read();
+        }
+        intrees.clear();
+    }
+    intrees_fingerprint = fingerprint;
+    intrees_friends = !friend_inputs.empty();
+    // the previous input tree referring to the previous friend trees has been deleted with its file, so these can be closed now:
+    friend_files.clear();
+    for(size_t i=0; i<friend_inputs.size(); ++i){
+        const auto & fi = friend_inputs[i];
+        std::unique_ptr<TFile> ffile(new TFile(fi.filename.c_str(), "read"));
+        if(!ffile->IsOpen()){
+            throw runtime_error("TTreeInputManager::setup_input_file: Error opening friend root file '" + fi.filename + "'");
+        }
+        TTree * ftree = dynamic_cast<TTree*>(ffile->Get(fi.treename.c_str()));
+        if(!ftree){
+            throw runtime_error("TTreeInputManager::setup_input_file: did not find TTree '" + fi.treename + "' in friend file '" + fi.filename + "'");
+        }
+        if(ftree->GetEntries() != tree->GetEntries()){
+            throw runtime_error("TTreeInputManager::setup_input_file: friend tree in '" + fi.filename + "' has " + std::to_string(ftree->GetEntries())
+                                + " entries, but input file '" + filename + "' has " + std::to_string(tree->GetEntries()));
+        }
+        // use distinct aliases, as the friend trees usually have the same name:
+        tree->AddFriend(ftree, ("friend" + std::to_string(i)).c_str());
+        friend_files.push_back(move(ffile));
+    }
+    setup_cache();
+    auto it = intrees.find(&event);
+    if(it != intrees.end()){
+        return it->second.intree->get_entries();
+    }
+    return create_intree(event).get_entries();
+}
+
+InTree & TTreeInputManager::create_intree(Event & event){
+    std::unique_ptr<InTree> intree(new InTree(tree, lazy));
+    intree->set_read_mutex(&tree_mutex);
+    if(read_buffers){
+        intree->set_read_buffers(read_buffers);
+    }
     for(const auto & bi : branch_infos){
-        intree->open_branch(bi.ti, bi.branchname, event, bi.handle);
+        if(prune){
+            // while profiling, read all branches lazily to find out which ones are used. Branches not
+            // in the profile (which can happen if it was read from a file) are also read lazily.
+            InTree::read_mode mode = InTree::read_mode::lazy;
+            if(have_profile){
+                auto it = profile.find(bi.branchname);
+                if(it != profile.end()) mode = it->second;
+            }
+            intree->open_branch(bi.ti, bi.branchname, event, bi.handle, mode);
+        }
+        else{
+            intree->open_branch(bi.ti, bi.branchname, event, bi.handle);
+        }
+    }
+    for(const auto & bi : branch_infos){
+        if(!bi.data_members.empty()){
+            intree->restrict_branch(bi.branchname, bi.data_members);
+        }
+    }
+    for(const auto & bi : friend_branch_infos){
+        intree->open_branch(bi.ti, bi.branchname, event, bi.handle, InTree::read_mode::eager);
+    }
+    auto & result = *intree;
+    auto & info = intrees[&event];
+    if(info.intree){
+        nbytes_read_discarded += info.intree->get_reset_bytes_read();
+    }
+    info.intree = move(intree);
+    info.event = &event;
+    info.uses_profile = have_profile;
+    return result;
+}
+
+void TTreeInputManager::add_input_event(Event & event){
+    if(!tree){
+        throw runtime_error("TTreeInputManager::add_input_event called before setup_input_file");
+    }
+    auto it = intrees.find(&event);
+    if(it != intrees.end() && it->second.intree->get_tree() == tree){
+        // re-used in setup_input_file
+        return;
+    }
+    if(!read_buffers){
+        // the first additional Event: from now on, all InTrees read via the same buffers, including the ones created already (which
+        // have not read anything yet, as add_input_event is called right after setup_input_file):
+        read_buffers.reset(new InTree::read_buffers());
+        std::vector<Event*> events;
+        for(const auto & e_intree : intrees){
+            events.push_back(e_intree.second.event);
+        }
+        for(Event * e : events){
+            create_intree(*e);
+        }
     }
-    return intree->get_entries();
+    create_intree(event);
+}
+
+std::vector<size_t> TTreeInputManager::get_cluster_starts(){
+    std::vector<size_t> result;
+    if(!tree) return result;
+    const Long64_t nentries = tree->GetEntries();
+    auto it = tree->GetClusterIterator(0);
+    Long64_t start;
+    while((start = it()) < nentries){
+        result.push_back(start);
+    }
+    return result;
 }
 
 void TTreeInputManager::read_event(Event & event, size_t ientry){
-    intree->get_entry(ientry);
+    auto it = intrees.find(&event);
+    if(it == intrees.end()){
+        throw runtime_error("TTreeInputManager::read_event: Event container was not set up via setup_input_file or add_input_event");
+    }
+    lock_guard<mutex> lock(tree_mutex);
+    auto & info = it->second;
+    if(prune && !have_profile){
+        // the previous entry read into this Event has been processed completely, so it can be counted for the profile:
+        if(info.has_entry) ++nevents_profiled;
+        if(nevents_profiled >= prune_nevents){
+            make_profile();
+        }
+    }
+    if(have_profile && !info.uses_profile){
+        // replace the InTree of this Event by one using the profile. This is done here (and not in make_profile for
+        // all Events) as Events not re-read yet might still access lazy members of their current entry.
+        create_intree(event);
+    }
+    if(fadvise_fd >= 0){
+        advise_ahead(ientry);
+    }
+    info.intree->get_entry(ientry);
+    info.has_entry = true;
 }
 
 
@@ -88,7 +788,7 @@ void TTreeInputManager::read_event(Event & event, size_t ientry){
 class TFileOutputManager: public OutputManagerBackend {
 public:
     // outfile ownership is taken by the TFileOutputManager.
-    TFileOutputManager(EventStructure & es, const std::string & event_treename, const std::string & base_outfilename);
+    TFileOutputManager(EventStructure & es, const ptree & cfg, const std::string & event_treename, const std::string & base_outfilename);
     
     virtual void put(const char * name, TH1 * t) override;
     virtual void declare_output(const std::type_info & ti, const identifier & tree_id, const std::string & branchname, const void * t) override;
@@ -105,23 +805,74 @@ public:
 private:
     void setup_output(Event & event);
     
+    // for batch processing, where events are written from different Event containers: on the first call, point the branches
+    // of the output event tree to staging objects, to which write_event copies the members of each event, so the branch addresses
+    // do not change anymore. Branches of class type without known copy assignment (see EventStructure::get_assign) are re-set
+    // to point to the members of event instead.
+    void rebind_output(Event & event);
+    
+    // asynchronous writing, see 'write_queue' option: write_event serializes the output members of the event into the
+    // next free slot of the queue (waiting for one to become free if necessary) and the writer thread deserializes the
+    // slots in order into the staging objects the event tree branches point to, and fills the tree.
+    void enqueue_event(Event & event);
+    void writer_loop();
+    void stop_writer(); // waits until all queued events have been written and re-throws exceptions from the writer thread
+    
+    // create the output event tree in file, with branches pointing to the current addresses of output_branches
+    void create_event_tree(TFile & file);
+    
+    // fill the output event tree, rolling over to a new chunk file if required
+    void fill_event_tree();
+    
+    // rolling over to new output files for the event tree, see 'rollover_size' and 'rollover_events' options. The
+    // event tree is written to chunk files <base_outfilename>-chunk<i>.root then, which are listed in the manifest file
+    // (see manifest_filename) of the output file; the output file itself contains all other output.
+    size_t rollover_size, rollover_events; // 0 = no limit
+    bool rolls_over() const {
+        return rollover_size > 0 || rollover_events > 0;
+    }
+    void open_chunk();
+    void close_chunk();
+    std::string base_outfilename;
+    std::unique_ptr<TFile> chunk_file; // the current chunk, if any
+    std::vector<output_chunk> chunks; // closed chunks
+    
     std::unique_ptr<TFile> outfile;
     std::string event_treename;
-    TTree * event_tree; // owned by outfile
+    TTree * event_tree; // owned by outfile or chunk_file
     
     struct branchinfo {
         Event::RawHandle handle;
         const std::type_info & ti;
         std::string branchname;
+        TBranch * branch = nullptr; // set in setup_output
+        void ** ptrptr = nullptr; // for class types: the address of the pointer to the object, as passed to root
+        void * address = nullptr; // the object written; for class types, the same as *ptrptr
+        TClass * class_ = nullptr; // for class types; nullptr for fundamental types
+        size_t size = 0; // for fundamental types: the size in bytes
+        bool staged = false; // if true, address is a staging object the member is copied to via assign or size bytes, see rebind_output
+        EventStructure::assign_function assign = nullptr;
         
         branchinfo(const Event::RawHandle & handle_, const std::type_info & ti_, const std::string & bname_): handle(handle_), ti(ti_), branchname(bname_){}
     };
     
     std::vector<branchinfo> output_branches; // in the output event tree
     bool setup_output_called;
+    const Event * output_event; // the Event the branch addresses of the output event tree point to
     
     std::map<identifier, TTree*> trees; // additional trees beyond the event tree
     std::list<void*> ptrs; // keep a list of pointers, so we can give root the *address* of the pointer
+    
+    size_t write_queue; // number of queue slots; 0 = write synchronously
+    std::vector<std::vector<std::unique_ptr<TBufferFile>>> queue; // queue[islot][ibranch]
+    size_t queue_first = 0, queue_n = 0; // the index of the oldest used slot and the number of used slots
+    std::vector<std::pair<void*, std::function<void (void*)>>> staging_objects; // per branch: object and deallocator; the object is nullptr for branches not staged in rebind_output
+    std::thread writer;
+    bool writer_stop = false;
+    std::exception_ptr writer_exception;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    std::mutex file_mutex; // locked while accessing outfile or its trees if the writer thread is running
 };
 
 
@@ -252,8 +1003,14 @@ TTree * create_ttree(TFile & file, const string & name){
 
 }
 
-TFileOutputManager::TFileOutputManager(EventStructure & es_, const string & event_treename_, const string & base_outfilename):
-    OutputManagerBackend(es_), event_treename(event_treename_),event_tree(0), setup_output_called(false){
+TFileOutputManager::TFileOutputManager(EventStructure & es_, const ptree & cfg, const string & event_treename_, const string & base_outfilename):
+    OutputManagerBackend(es_), base_outfilename(base_outfilename), event_treename(event_treename_),event_tree(0), setup_output_called(false), output_event(nullptr){
+    write_queue = ptree_get<size_t>(cfg, "write_queue", 0);
+    if(write_queue > 0){
+        TThread::Initialize();
+    }
+    rollover_size = static_cast<size_t>(ptree_get<double>(cfg, "rollover_size", 0.0) * 1024 * 1024);
+    rollover_events = ptree_get<size_t>(cfg, "rollover_events", 0);
         string filename_full = base_outfilename + ".root";
     outfile.reset(new TFile(filename_full.c_str(), "recreate"));
     if(!outfile->IsOpen()){
@@ -264,6 +1021,7 @@ TFileOutputManager::TFileOutputManager(EventStructure & es_, const string & even
 
 void TFileOutputManager::put(const char * name_, TH1 * histo){
     assert(outfile);
+    lock_guard<mutex> lock(file_mutex);
     // find last '/' to get directory name:
     auto path_name = get_path_name(name_);
     root_cd(*outfile, path_name.first);
@@ -275,21 +1033,132 @@ void TFileOutputManager::put(const char * name_, TH1 * histo){
 void TFileOutputManager::declare_event_output(const std::type_info & ti, const std::string & bname, const std::string & mname){
     auto handle = es.get_raw_handle(ti, mname);
     output_branches.emplace_back(handle, ti, bname);
+    auto & b = output_branches.back();
+    b.class_ = TBuffer::GetClass(ti);
+    if(!b.class_){
+        TDataType * dt = TDataType::GetDataType(TDataType::GetType(ti));
+        if(!dt){
+            throw invalid_argument("declare_event_output: type of branch '" + bname + "' not known to ROOT");
+        }
+        b.size = dt->Size();
+    }
 }
 
 void TFileOutputManager::setup_output(Event & event){
-    if(!event_tree){
-        event_tree = create_ttree(*outfile, event_treename);
+    for(auto & b : output_branches){
+        void * addr;
+        if(write_queue > 0){
+            // the branches point to staging objects owned by this class, see writer_loop:
+            std::function<void (void*)> deallocator;
+            addr = allocate_type(b.ti, deallocator);
+            staging_objects.emplace_back(addr, move(deallocator));
+        }
+        else{
+            addr = event.get(b.ti, b.handle, Event::state::invalid);
+        }
+        ptrs.push_back(addr);
+        b.address = addr;
+        if(TBuffer::GetClass(b.ti)){
+            b.ptrptr = &ptrs.back();
+        }
     }
-    for(const auto & b : output_branches){
+    // with rollover, the tree is created in the chunk file on the first fill:
+    if(!event_tree && !rolls_over()){
+        create_event_tree(*outfile);
+    }
+    output_event = &event;
+}
+
+void TFileOutputManager::create_event_tree(TFile & file){
+    event_tree = create_ttree(file, event_treename);
+    for(auto & b : output_branches){
+        ttree_branch(event_tree, b.branchname, b.address, b.ptrptr, b.ti);
+        b.branch = event_tree->GetBranch(b.branchname.c_str());
+    }
+}
+
+void TFileOutputManager::rebind_output(Event & event){
+    if(staging_objects.empty()){
+        for(auto & b : output_branches){
+            b.assign = event.get_assign(b.handle);
+            if(b.class_ && !b.assign){
+                staging_objects.emplace_back(nullptr, std::function<void (void*)>());
+                continue;
+            }
+            std::function<void (void*)> deallocator;
+            void * addr = allocate_type(b.ti, deallocator);
+            staging_objects.emplace_back(addr, move(deallocator));
+            b.staged = true;
+            b.address = addr;
+            if(b.ptrptr){
+                *b.ptrptr = addr;
+            }
+            if(b.branch){
+                b.branch->SetAddress(b.ptrptr ? static_cast<void*>(b.ptrptr) : addr);
+            }
+        }
+    }
+    for(auto & b : output_branches){
+        if(b.staged) continue;
         void * addr = event.get(b.ti, b.handle, Event::state::invalid);
-        ptrs.push_back(addr);
-        void *& ptrptr = ptrs.back();
-        ttree_branch(event_tree, b.branchname, addr, &ptrptr, b.ti);
+        b.address = addr;
+        if(b.ptrptr){
+            *b.ptrptr = addr;
+        }
+        if(!b.branch) continue; // no event tree at the moment, see fill_event_tree
+        b.branch->SetAddress(b.ptrptr ? static_cast<void*>(b.ptrptr) : addr);
     }
+    output_event = &event;
+}
+
+void TFileOutputManager::fill_event_tree(){
+    if(!rolls_over()){
+        event_tree->Fill();
+        return;
+    }
+    if(!chunk_file){
+        open_chunk();
+    }
+    event_tree->Fill();
+    // the size is only approximate, as it only includes the baskets written so far:
+    if((rollover_events > 0 && size_t(event_tree->GetEntries()) >= rollover_events) ||
+       (rollover_size > 0 && size_t(event_tree->GetZipBytes()) >= rollover_size)){
+        close_chunk();
+    }
+}
+
+void TFileOutputManager::open_chunk(){
+    const string filename = base_outfilename + "-chunk" + std::to_string(chunks.size()) + ".root";
+    TDirectory * dir = gDirectory;
+    chunk_file.reset(new TFile(filename.c_str(), "recreate"));
+    gDirectory = dir;
+    if(!chunk_file->IsOpen()){
+        chunk_file.reset();
+        throw runtime_error("Error opening output chunk file '" + filename + "'");
+    }
+    create_event_tree(*chunk_file);
+}
+
+void TFileOutputManager::close_chunk(){
+    output_chunk chunk;
+    chunk.filename = chunk_file->GetName();
+    chunk.nentries = event_tree->GetEntries();
+    TDirectory * dir = gDirectory;
+    chunk_file->cd();
+    chunk_file->Write();
+    gDirectory = dir;
+    chunk_file->Close();
+    // the event tree has been deleted with the file:
+    chunk_file.reset();
+    event_tree = nullptr;
+    for(auto & b : output_branches){
+        b.branch = nullptr;
+    }
+    chunks.push_back(move(chunk));
 }
 
 void TFileOutputManager::declare_output(const std::type_info & ti, const identifier & tree_id, const std::string & branchname, const void * caddr){
+    lock_guard<mutex> lock(file_mutex);
     TTree *& tree = trees[tree_id];
     if(!tree){
         tree = create_ttree(*outfile, tree_id.name());
@@ -303,6 +1172,7 @@ void TFileOutputManager::declare_output(const std::type_info & ti, const identif
 
 void TFileOutputManager::write_output(const identifier & tree_id){
     assert(outfile);
+    lock_guard<mutex> lock(file_mutex);
     auto it = trees.find(tree_id);
     if(it==trees.end()){
         throw invalid_argument("did not find tree '" + tree_id.name() + "'");
@@ -314,27 +1184,151 @@ void TFileOutputManager::write_event(Event & event){
     if(!setup_output_called){
         setup_output(event);
         setup_output_called = true;
+        if(write_queue > 0){
+            writer = std::thread([this](){ this->writer_loop(); });
+        }
     }
     assert(outfile);
-    if(!event_tree) return;
+    if(!event_tree && !rolls_over()) return;
+    if(write_queue > 0){
+        enqueue_event(event);
+        return;
+    }
+    if(&event != output_event){
+        // happens for batch processing, where events are written from different Event containers:
+        rebind_output(event);
+    }
     // read all event members; this is to make sure info is up to date in case of lazy reads:
     for(const auto & b : output_branches){
-        event.get(b.ti, b.handle);
+        const void * addr = event.get(b.ti, b.handle);
+        if(!b.staged) continue;
+        if(b.assign){
+            b.assign(b.address, addr);
+        }
+        else{
+            memcpy(b.address, addr, b.size);
+        }
     }
     if(!setup_output_called){
         setup_output(event);
     }
-    event_tree->Fill();
+    fill_event_tree();
+}
+
+void TFileOutputManager::enqueue_event(Event & event){
+    unique_lock<mutex> lock(queue_mutex);
+    queue_changed.wait(lock, [this](){ return queue_n < write_queue || writer_exception; });
+    if(writer_exception){
+        rethrow_exception(writer_exception);
+    }
+    if(queue.empty()){
+        queue.resize(write_queue);
+    }
+    auto & slot = queue[(queue_first + queue_n) % write_queue];
+    // the slot is not used by the writer thread, so serialize without holding the lock (this also
+    // triggers lazy reads of the event members):
+    lock.unlock();
+    if(slot.empty()){
+        for(size_t i=0; i<output_branches.size(); ++i){
+            slot.emplace_back(new TBufferFile(TBuffer::kWrite));
+        }
+    }
+    for(size_t i=0; i<output_branches.size(); ++i){
+        const auto & b = output_branches[i];
+        void * addr = event.get(b.ti, b.handle);
+        TBufferFile & buf = *slot[i];
+        buf.SetWriteMode();
+        buf.Reset();
+        if(b.class_){
+            b.class_->Streamer(addr, buf);
+        }
+        else{
+            buf.WriteFastArray(static_cast<char*>(addr), b.size);
+        }
+    }
+    lock.lock();
+    ++queue_n;
+    queue_changed.notify_all();
+}
+
+void TFileOutputManager::writer_loop(){
+    while(true){
+        unique_lock<mutex> lock(queue_mutex);
+        queue_changed.wait(lock, [this](){ return queue_n > 0 || writer_stop; });
+        if(queue_n == 0) return; // writer_stop and all events written
+        auto & slot = queue[queue_first];
+        lock.unlock();
+        try{
+            for(size_t i=0; i<output_branches.size(); ++i){
+                const auto & b = output_branches[i];
+                TBufferFile & buf = *slot[i];
+                buf.SetReadMode();
+                buf.Reset();
+                if(b.class_){
+                    b.class_->Streamer(staging_objects[i].first, buf);
+                }
+                else{
+                    buf.ReadFastArray(static_cast<char*>(staging_objects[i].first), b.size);
+                }
+            }
+            lock_guard<mutex> file_lock(file_mutex);
+            fill_event_tree();
+        }
+        catch(...){
+            lock.lock();
+            writer_exception = current_exception();
+            queue_changed.notify_all();
+            return;
+        }
+        lock.lock();
+        queue_first = (queue_first + 1) % write_queue;
+        --queue_n;
+        queue_changed.notify_all();
+    }
+}
+
+void TFileOutputManager::stop_writer(){
+    if(!writer.joinable()) return;
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        writer_stop = true;
+        queue_changed.notify_all();
+    }
+    writer.join();
+    if(writer_exception){
+        rethrow_exception(writer_exception);
+    }
 }
 
 void TFileOutputManager::close(){
+    stop_writer();
+    if(chunk_file){
+        close_chunk();
+    }
+    if(outfile && rolls_over()){
+        write_manifest(manifest_filename(outfile->GetName()), chunks);
+    }
     if(outfile){
+        call_before_write();
+        put_deferred_histos();
         outfile->cd();
         outfile->Write();
         outfile.reset();
     }
+    for(auto & obj : staging_objects){
+        if(obj.first){
+            obj.second(obj.first);
+        }
+    }
+    staging_objects.clear();
 }
 
 TFileOutputManager::~TFileOutputManager(){
-    close();
+    try{
+        close();
+    }
+    catch(std::exception & ex){
+        auto logger = Logger::get("ra.TFileOutputManager");
+        LOG_ERROR("exception while closing the output file: " << ex.what());
+    }
 }
@@ -1,7 +1,31 @@
 #include "context-backend.hpp"
 
+#include <stdexcept>
+
 using namespace ra;
 
+void InputManagerBackend::add_input_event(Event &){
+    throw std::runtime_error("this InputManagerBackend does not support reading more than one Event (batch processing)");
+}
+
+InputManagerBackend::io_statistics InputManagerBackend::get_io_statistics(){
+    return io_statistics();
+}
+
+std::vector<size_t> InputManagerBackend::get_cluster_starts(){
+    return std::vector<size_t>();
+}
+
+void InputManagerBackend::set_entry_list(const std::vector<size_t> *){
+}
+
+bool InputManagerBackend::set_friend_inputs(const std::vector<friend_input> &){
+    return false;
+}
+
+void InputManagerBackend::prepare_next_file(const std::string &, const std::string &){
+}
+
 InputManagerBackend::~InputManagerBackend(){}
 OutputManagerBackend::~OutputManagerBackend(){}
 OutputManagerOperations::~OutputManagerOperations(){}
@@ -1,7 +1,72 @@
 #include "context.hpp"
 
+#include "TH1.h"
+
+#include <stdexcept>
+
 using namespace ra;
+using namespace std;
+
+void HistogramOutputManager::put_deferred(const char * name, const std::function<TH1* ()> & create){
+    deferred_histos.emplace_back(name, create);
+}
+
+void HistogramOutputManager::before_write(const std::function<void ()> & callback){
+    before_write_callbacks.push_back(callback);
+}
+
+void HistogramOutputManager::call_before_write(){
+    for(const auto & callback : before_write_callbacks){
+        callback();
+    }
+    before_write_callbacks.clear();
+}
+
+void HistogramOutputManager::put_deferred_histos(){
+    for(const auto & d : deferred_histos){
+        TH1 * histo = d.second();
+        if(histo){
+            put(d.first.c_str(), histo);
+        }
+    }
+    deferred_histos.clear();
+}
 
 HistogramOutputManager::~HistogramOutputManager(){}
 OutputManager::~OutputManager(){}
 InputManager::~InputManager(){}
+
+size_t InputManager::register_selection_bit(const std::string & selection){
+    auto it = selection_bits.find(selection);
+    if(it != selection_bits.end()) return it->second;
+    const size_t ibit = selection_bits.size();
+    selection_bits[selection] = ibit;
+    return ibit;
+}
+
+size_t InputManager::find_selection_bit(const std::string & selection) const{
+    auto it = selection_bits.find(selection);
+    return it == selection_bits.end() ? static_cast<size_t>(-1) : it->second;
+}
+
+const bool & InputManager::declare_weight_systematic(const identifier & syst_par){
+    for(const auto & s : weight_systs){
+        if(s.first == syst_par) return s.second;
+    }
+    weight_systs.emplace_back(syst_par, false);
+    return weight_systs.back().second;
+}
+
+void InputManager::use_weight_systematic(const identifier & syst_par){
+    for(auto & s : weight_systs){
+        if(s.first == syst_par){
+            s.second = true;
+            return;
+        }
+    }
+    throw std::runtime_error("weight systematic '" + syst_par.name() + "' has not been declared by any module before");
+}
+
+void InputManager::do_declare_partial_input(const std::type_info & ti, const std::string & bname, const std::string & mname, const std::vector<std::string> &){
+    do_declare_event_input(ti, bname, mname);
+}
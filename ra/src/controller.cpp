@@ -3,15 +3,26 @@
 #include "config.hpp"
 #include "context-backend.hpp"
 #include "analysis.hpp"
+#include "eventbatch.hpp"
+#include "root-utils.hpp"
+#include "skim-index.hpp"
+#include "derived-cache.hpp"
 
 #include "TFile.h"
 #include "TTree.h"
+#include "TThread.h"
+
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+#include <unistd.h>
 
 using namespace ra;
 using namespace std;
 
 AnalysisController::AnalysisController(const s_config & config_, bool parallel): logger(Logger::get("ra.AnalysisController")),
-  config(config_), current_idataset(-1), current_ifile(-1), infile_nevents(0) {
+  config(config_), current_idataset(-1), current_ifile(-1), infile_nevents(0), use_skim_entries(false), use_entry_list(false) {
     for(const string & sp : config.options.searchpaths){
         add_searchpath(sp, -1);
     }
@@ -20,15 +31,87 @@ AnalysisController::AnalysisController(const s_config & config_, bool parallel):
         load_lib(lib);
     }
     
+    const size_t nthreads = config.options.nthreads;
+    if(nthreads > 1 || config.options.prefetch > 0){
+        TThread::Initialize();
+    }
+    threads.resize(nthreads);
+    
     // construct modules:
     for(auto & module_cfg : config.modules_cfg){
         const string & name = module_cfg.first;
         string type = ptree_get<string>(module_cfg.second, "type");
         modules.emplace_back(AnalysisModuleRegistry::build(type, module_cfg.second));
         module_names.push_back(name);
-        if(parallel && !modules.back()->is_parallel_safe()){
+        const bool parallel_safe = modules.back()->is_parallel_safe();
+        if(parallel && !parallel_safe){
             LOG_THROW("Error: module " << module_names.back() << " is not parallel safe.");
         }
+        // each thread has its own instance of every module, so modules only seeing a part of the events are not supported:
+        if(nthreads > 1 && !parallel_safe){
+            LOG_THROW("Error: module " << module_names.back() << " is not parallel safe, but nthreads = " << nthreads);
+        }
+        threads[0].modules.push_back(modules.back().get());
+        for(size_t it=1; it<nthreads; ++it){
+            threads[it].owned_modules.emplace_back(AnalysisModuleRegistry::build(type, module_cfg.second));
+            threads[it].modules.push_back(threads[it].owned_modules.back().get());
+        }
+    }
+    // the first thread state is processed by the thread calling process, the others by persistent worker threads:
+    for(size_t it=1; it<nthreads; ++it){
+        workers.emplace_back(&AnalysisController::worker_loop, this, it);
+    }
+}
+
+void AnalysisController::worker_loop(size_t it){
+    size_t generation = 0;
+    unique_lock<mutex> lock(workers_mutex);
+    while(true){
+        workers_cv.wait(lock, [&](){ return stop_workers || worker_generation != generation; });
+        if(stop_workers) return;
+        generation = worker_generation;
+        if(it < worker_ntasks){
+            lock.unlock();
+            try{
+                worker_task(it);
+            }
+            catch(...){
+                worker_exceptions[it] = current_exception();
+            }
+            lock.lock();
+        }
+        if(--nworkers_busy == 0){
+            workers_done_cv.notify_all();
+        }
+    }
+}
+
+void AnalysisController::run_parallel(size_t ntasks, const std::function<void (size_t)> & task){
+    if(ntasks == 1){
+        task(0);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(workers_mutex);
+        worker_task = task;
+        worker_ntasks = ntasks;
+        worker_exceptions.assign(ntasks, exception_ptr());
+        nworkers_busy = workers.size();
+        ++worker_generation;
+    }
+    workers_cv.notify_all();
+    try{
+        task(0);
+    }
+    catch(...){
+        worker_exceptions[0] = current_exception();
+    }
+    {
+        unique_lock<mutex> lock(workers_mutex);
+        workers_done_cv.wait(lock, [this](){ return nworkers_busy == 0; });
+    }
+    for(auto & ex : worker_exceptions){
+        if(ex) rethrow_exception(ex);
     }
 }
 
@@ -37,9 +120,15 @@ void AnalysisController::start_dataset(size_t idataset, const string & new_outfi
     LOG_DEBUG("start_dataset idataset = " << idataset << "; outfile_base = " << new_outfile_base);
     // cleanup previous per-file info:
     current_ifile = -1;
-    in.reset();
-    event.reset();
-    out.reset();
+    cache_writers.clear();
+    module_cached.clear();
+    for(auto & ts : threads){
+        ts.in.reset();
+        ts.event.reset();
+        ts.batch.reset();
+        ts.next_batch.reset();
+    }
+    close_outputs();
     
     current_idataset = idataset;
     if(idataset == size_t(-1)) return;
@@ -51,16 +140,86 @@ void AnalysisController::start_dataset(size_t idataset, const string & new_outfi
     outfile_base = new_outfile_base;
     const s_dataset & dataset = config.datasets[current_idataset];
     
-    es.reset(new EventStructure());
-    handle_stop = es->get_handle<bool>("stop");
     string output_type = ptree_get<string>(config.output_cfg, "type");
-    out = OutputManagerBackendRegistry::build(output_type, *es, dataset.treename, outfile_base);
     string input_type = ptree_get<string>(config.input_cfg, "type");
-    in = InputManagerBackendRegistry::build(input_type, *es, config.input_cfg);
-    for(auto & m : modules){
-        m->begin_dataset(dataset, *in, *out);
+    for(size_t it=0; it<threads.size(); ++it){
+        auto & ts = threads[it];
+        if(it == 0){
+            ts.es.reset(new EventStructure());
+            handle_stop = ts.es->get_handle<bool>("stop");
+            handle_ientry = ts.es->get_handle<size_t>("ientry");
+            ts.outfile_base = outfile_base;
+        }
+        else{
+            // start with a copy of the EventStructure of the first thread, so the handles of all threads are the same.
+            ts.es.reset(new EventStructure(*threads[0].es));
+            ts.outfile_base = outfile_base + "-thread" + std::to_string(it);
+        }
+        ts.out = OutputManagerBackendRegistry::build(output_type, *ts.es, config.output_cfg, dataset.treename, ts.outfile_base);
+        ts.in = InputManagerBackendRegistry::build(input_type, *ts.es, config.input_cfg);
+        for(size_t im=0; im<modules.size(); ++im){
+            ts.modules[im]->begin_dataset(dataset, *ts.in, *ts.out);
+        }
+        if(it == 0){
+            // the cached modules and their outputs; the mask members have to be declared before creating the Event containers:
+            cache_outputs.assign(modules.size(), vector<AnalysisModule::cacheable_output>());
+            cache_output_handles.assign(modules.size(), vector<Event::RawHandle>());
+            cache_mask_handles.assign(modules.size(), Event::Handle<uint64_t>());
+            if(!config.options.derived_cache_dir.empty()){
+                for(size_t im=0; im<modules.size(); ++im){
+                    cache_outputs[im] = modules[im]->cacheable_outputs();
+                    if(cache_outputs[im].empty()) continue;
+                    for(const auto & output : cache_outputs[im]){
+                        cache_output_handles[im].push_back(ts.es->get_raw_handle(*output.ti, output.name));
+                    }
+                    cache_mask_handles[im] = ts.es->get_handle<uint64_t>(DerivedCache::mask_member_name(module_names[im]));
+                }
+            }
+        }
+        if(config.options.batchsize > 1 || config.options.prefetch > 0){
+            // with prefetching, events are read in blocks of one batch, or 'prefetch' events without batch processing:
+            const size_t capacity = config.options.batchsize > 1 ? config.options.batchsize : config.options.prefetch;
+            ts.batch.reset(new EventBatch(*ts.es, capacity));
+            if(config.options.prefetch > 0){
+                ts.next_batch.reset(new EventBatch(*ts.es, capacity));
+            }
+        }
+        else{
+            ts.event.reset(new Event(*ts.es));
+        }
+    }
+}
+
+void AnalysisController::close_outputs(){
+    if(!threads[0].out) return;
+    for(size_t it=0; it<threads.size(); ++it){
+        for(size_t im=0; im<modules.size(); ++im){
+            threads[it].modules[im]->end_dataset();
+        }
+    }
+    vector<string> filenames;
+    for(auto & ts : threads){
+        ts.out->close();
+        ts.out.reset();
+        ts.es.reset();
+        filenames.push_back(ts.outfile_base);
+    }
+    if(threads.size() == 1) return;
+    // merge the output of the other threads into the output of the first thread:
+    const string output_type = ptree_get<string>(config.output_cfg, "type");
+    auto out_ops = OutputManagerOperationsRegistry::build(output_type);
+    for(auto & fn : filenames){
+        fn += "." + out_ops->filename_extension();
+    }
+    const string file0 = filenames[0];
+    filenames.erase(filenames.begin());
+    merge_rootfiles(file0, filenames);
+    for(const auto & fn : filenames){
+        int res = remove_rootfile(fn);
+        if(res != 0){
+            LOG_ERRNO("unlinking thread output file after merging: '" << fn << "'; ignoring this error");
+        }
     }
-    event.reset(new Event(*es));
 }
 
 const s_dataset & AnalysisController::current_dataset() const{
@@ -90,11 +249,124 @@ void AnalysisController::start_file(size_t ifile){
         throw invalid_argument("no such file in current dataset");
     }
     const auto & f = dataset.files[ifile];
-    for(auto & m : modules){
-        m->begin_in_file(f.path);
+    // read the outputs of modules from their caches, where available:
+    cache_writers.clear();
+    cache_writers.resize(modules.size());
+    module_cached.assign(modules.size(), false);
+    vector<unique_ptr<DerivedCache>> caches(modules.size());
+    vector<InputManagerBackend::friend_input> friends;
+    for(size_t im=0; im<modules.size(); ++im){
+        if(cache_outputs[im].empty()) continue;
+        caches[im].reset(new DerivedCache(config, im, dataset, f.path));
+        if(!caches[im]->exists()) continue;
+        InputManagerBackend::friend_input fi;
+        fi.filename = caches[im]->get_filename();
+        fi.treename = DerivedCache::treename;
+        for(const auto & output : cache_outputs[im]){
+            fi.members.emplace_back(output.ti, output.name);
+        }
+        fi.members.emplace_back(&typeid(uint64_t), DerivedCache::mask_member_name(module_names[im]));
+        LOG_DEBUG("reading outputs of module " << module_names[im] << " for file '" << f.path << "' from cache '" << fi.filename << "'");
+        friends.push_back(move(fi));
+        module_cached[im] = true;
+    }
+    bool friends_supported = true;
+    for(auto & ts : threads){
+        friends_supported = ts.in->set_friend_inputs(friends) && friends_supported;
+    }
+    if(!friends_supported){
+        module_cached.assign(modules.size(), false);
+    }
+    for(size_t it=0; it<threads.size(); ++it){
+        auto & ts = threads[it];
+        for(size_t im=0; im<modules.size(); ++im){
+            ts.modules[im]->begin_in_file(f.path);
+        }
+        if(ts.batch){
+            infile_nevents = ts.in->setup_input_file(ts.batch->event(0), dataset.treename, f.path);
+            for(size_t i=1; i<ts.batch->capacity(); ++i){
+                ts.in->add_input_event(ts.batch->event(i));
+            }
+            if(ts.next_batch){
+                for(size_t i=0; i<ts.next_batch->capacity(); ++i){
+                    ts.in->add_input_event(ts.next_batch->event(i));
+                }
+            }
+        }
+        else{
+            infile_nevents = ts.in->setup_input_file(*ts.event, dataset.treename, f.path);
+        }
     }
-    infile_nevents = in->setup_input_file(*event, dataset.treename, f.path);
     current_ifile = ifile;
+    // the next file is probably the next one in the dataset; let the input prepare that while this one is processed:
+    if(ifile + 1 < dataset.files.size()){
+        for(auto & ts : threads){
+            ts.in->prepare_next_file(dataset.treename, dataset.files[ifile + 1].path);
+        }
+    }
+    use_skim_entries = false;
+    skim_entries.clear();
+    use_entry_list = false;
+    entry_list.clear();
+    const ptree * skim_cfg = find_skim_index_cfg(config);
+    if(skim_cfg){
+        SkimIndex index(*skim_cfg, dataset, f.path);
+        size_t nentries;
+        if(index.read(nentries, skim_entries)){
+            if(nentries == infile_nevents){
+                use_skim_entries = true;
+                LOG_DEBUG("using skim index for file '" << f.path << "': " << skim_entries.size() << " of " << nentries << " entries selected");
+            }
+            else{
+                LOG_WARNING("skim index for file '" << f.path << "' has " << nentries << " entries, but the file has " << infile_nevents << "; ignoring index");
+                skim_entries.clear();
+            }
+        }
+    }
+    update_input_entry_list();
+    // write the caches not available yet. This requires processing all entries in order, which is checked by DerivedCache::append;
+    // the caches are discarded otherwise.
+    if(friends_supported && threads.size() == 1 && threads[0].event && !use_skim_entries){
+        for(size_t im=0; im<modules.size(); ++im){
+            if(!caches[im] || module_cached[im]) continue;
+            caches[im]->start_writing(*threads[0].es, *threads[0].event, cache_outputs[im], infile_nevents);
+            cache_writers[im] = move(caches[im]);
+        }
+    }
+}
+
+void AnalysisController::set_entry_list(const std::vector<size_t> & entries){
+    check_file();
+    if(!is_sorted(entries.begin(), entries.end())){
+        throw invalid_argument("set_entry_list: entries not sorted");
+    }
+    if(!entries.empty() && entries.back() >= infile_nevents){
+        throw invalid_argument("set_entry_list: entry " + std::to_string(entries.back()) + " beyond end of file with "
+                               + std::to_string(infile_nevents) + " entries");
+    }
+    entry_list.clear();
+    if(use_skim_entries){
+        set_intersection(entries.begin(), entries.end(), skim_entries.begin(), skim_entries.end(), back_inserter(entry_list));
+    }
+    else{
+        entry_list = entries;
+    }
+    use_entry_list = true;
+    update_input_entry_list();
+}
+
+void AnalysisController::clear_entry_list(){
+    if(!use_entry_list) return;
+    use_entry_list = false;
+    entry_list.clear();
+    update_input_entry_list();
+}
+
+void AnalysisController::update_input_entry_list(){
+    const vector<size_t> * entries = use_entry_list ? &entry_list : use_skim_entries ? &skim_entries : nullptr;
+    for(auto & ts : threads){
+        ts.in->set_entry_list(entries);
+    }
 }
 
 size_t AnalysisController::get_file_size() const{
@@ -102,6 +374,11 @@ size_t AnalysisController::get_file_size() const{
     return infile_nevents;
 }
 
+std::vector<size_t> AnalysisController::get_cluster_starts() const{
+    check_file();
+    return threads[0].in->get_cluster_starts();
+}
+
 void AnalysisController::process(size_t imin, size_t imax, ProcessStatistics * stats){
     LOG_DEBUG("process events " << imin << " -- " << imax);
     check_file();
@@ -117,43 +394,241 @@ void AnalysisController::process(size_t imin, size_t imax, ProcessStatistics * s
     if(imax < imin){
         LOG_THROW("process called with imax < imin");
     }
-    size_t nevents_survived = 0;
-    for(size_t ientry = imin; ientry < imax; ++ientry){
-        event->invalidate_all();
+    const size_t nallocations_before = nallocations();
+    entry_range all_entries{nullptr, imin, imax};
+    const vector<size_t> * list = use_entry_list ? &entry_list : use_skim_entries ? &skim_entries : nullptr;
+    if(list){
+        all_entries.list = list->data();
+        all_entries.begin = lower_bound(list->begin(), list->end(), imin) - list->begin();
+        all_entries.end = lower_bound(list->begin(), list->end(), imax) - list->begin();
+    }
+    // split the entries into one contiguous part per thread:
+    const size_t nthreads = max<size_t>(1, min(threads.size(), all_entries.size()));
+    vector<size_t> nevents_survived(nthreads, 0);
+    auto process_range = [&](size_t it){
+        const size_t n = all_entries.size();
+        const entry_range entries{all_entries.list, all_entries.begin + n * it / nthreads, all_entries.begin + n * (it + 1) / nthreads};
+        auto & ts = threads[it];
+        if(ts.next_batch){
+            process_prefetch(ts, entries, nevents_survived[it]);
+        }
+        else if(ts.batch){
+            process_batches(ts, entries, nevents_survived[it]);
+        }
+        else{
+            process_events(ts, entries, nevents_survived[it]);
+        }
+        // the part of [imin, imax) this thread is responsible for. With an explicit entry list, the entries
+        // not in the list have not been processed, so the range is not complete:
+        if(use_entry_list) return;
+        const size_t ifirst = it == 0 ? imin : entries[0];
+        const size_t ilast = it + 1 == nthreads ? imax : entries[entries.size()];
+        for(size_t im=0; im<modules.size(); ++im){
+            ts.modules[im]->end_range(ifirst, ilast, infile_nevents);
+        }
+    };
+    run_parallel(nthreads, process_range);
+    if(stats){
+        stats->nbytes_read = 0;
+        stats->nevents_survived = 0;
+        stats->io = InputManagerBackend::io_statistics();
+        for(size_t it=0; it<threads.size(); ++it){
+            stats->nbytes_read += threads[it].in->nbytes_read();
+            auto io = threads[it].in->get_io_statistics();
+            stats->io.nbytes_file += io.nbytes_file;
+            stats->io.nreadcalls += io.nreadcalls;
+            stats->io.ncache_hits += io.ncache_hits;
+            stats->io.ncache_misses += io.ncache_misses;
+            stats->io.nunzip_found += io.nunzip_found;
+            stats->io.nunzip_missed += io.nunzip_missed;
+            if(it < nthreads){
+                stats->nevents_survived += nevents_survived[it];
+            }
+        }
+        stats->nallocations = nallocations() - nallocations_before;
+    }
+}
+
+void AnalysisController::process_events(thread_state & ts, const entry_range & entries, size_t & nevents_survived){
+    Event & event = *ts.event;
+    for(size_t i = 0; i < entries.size(); ++i){
+        const size_t ientry = entries[i];
+        event.invalidate_all();
+        try{
+            ts.in->read_event(event, ientry);
+        }
+        catch(...){
+            LOG_ERROR("Exception caught in read_entry while reading entry " << ientry << " of file " << current_dataset().files[current_ifile].path << "; re-throwing.");
+            throw;
+        }
+        event.set(handle_ientry, ientry);
+        apply_cache_masks(event);
+        if(process_event(ts, event, ientry)){
+            ++nevents_survived;
+            ts.out->write_event(event);
+        }
+    }
+}
+
+bool AnalysisController::process_event(thread_state & ts, Event & event, size_t ientry){
+    for(size_t i=0; i<modules.size(); ++i){
+        if(module_cached[i]) continue;
+        try{
+            ts.modules[i]->process(event);
+        }
+        catch(...){
+            LOG_ERROR("Exception caught while calling 'process' method of module " << i << " (name: "
+                      << module_names[i] << ") for entry " << ientry << " of file "
+                      << current_dataset().files[current_ifile].path << "; re-throwing.");
+            throw;
+        }
+        if(cache_writers[i]) cache_writers[i]->append(ientry);
+        if(event.get_state(handle_stop) == Event::state::valid && event.get(handle_stop)){
+            // the caches of the remaining modules contain all entries as well, with the outputs not valid for this one:
+            for(size_t j=i+1; j<modules.size(); ++j){
+                if(cache_writers[j]) cache_writers[j]->append(ientry);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void AnalysisController::apply_cache_masks(Event & event){
+    for(size_t im=0; im<modules.size(); ++im){
+        if(!module_cached[im]) continue;
+        const uint64_t mask = event.get(cache_mask_handles[im]);
+        for(size_t k=0; k<cache_outputs[im].size(); ++k){
+            if(!(mask & (uint64_t(1) << k))){
+                event.set_validity(*cache_outputs[im][k].ti, cache_output_handles[im][k], false);
+            }
+        }
+    }
+}
+
+void AnalysisController::process_batches(thread_state & ts, const entry_range & entries, size_t & nevents_survived){
+    EventBatch & batch = *ts.batch;
+    const size_t n = entries.size();
+    for(size_t ifirst = 0; ifirst < n; ifirst += batch.capacity()){
+        read_batch(ts, batch, entries, ifirst, min(batch.capacity(), n - ifirst));
+        run_batch(ts, batch, entries, ifirst, nevents_survived);
+    }
+}
+
+void AnalysisController::process_prefetch(thread_state & ts, const entry_range & entries, size_t & nevents_survived){
+    const size_t capacity = ts.batch->capacity();
+    const size_t n = entries.size();
+    read_batch(ts, *ts.batch, entries, 0, min(capacity, n));
+    for(size_t ifirst = 0; ifirst < n; ifirst += capacity){
+        // read the next batch in the background while running the modules on the current one:
+        const size_t inext = ifirst + capacity;
+        exception_ptr read_exception;
+        thread reader;
+        if(inext < n){
+            reader = thread([&, inext](){
+                try{
+                    read_batch(ts, *ts.next_batch, entries, inext, min(capacity, n - inext));
+                }
+                catch(...){
+                    read_exception = current_exception();
+                }
+            });
+        }
+        try{
+            run_batch(ts, *ts.batch, entries, ifirst, nevents_survived);
+        }
+        catch(...){
+            if(reader.joinable()) reader.join();
+            throw;
+        }
+        if(reader.joinable()) reader.join();
+        if(read_exception) rethrow_exception(read_exception);
+        swap(ts.batch, ts.next_batch);
+    }
+}
+
+void AnalysisController::read_batch(thread_state & ts, EventBatch & batch, const entry_range & entries, size_t ifirst, size_t n){
+    batch.reset(n);
+    for(size_t i=0; i<n; ++i){
+        const size_t ientry = entries[ifirst + i];
         try{
-            in->read_event(*event, ientry);
+            ts.in->read_event(batch.event(i), ientry);
         }
         catch(...){
             LOG_ERROR("Exception caught in read_entry while reading entry " << ientry << " of file " << current_dataset().files[current_ifile].path << "; re-throwing.");
             throw;
         }
-        bool event_selected = true;
-        for(size_t i=0; i<modules.size(); ++i){
+        batch.event(i).set(handle_ientry, ientry);
+        apply_cache_masks(batch.event(i));
+    }
+}
+
+void AnalysisController::run_batch(thread_state & ts, EventBatch & batch, const entry_range & entries, size_t ifirst, size_t & nevents_survived){
+    const size_t n = batch.size();
+    if(config.options.batchsize > 1){
+        for(size_t im=0; im<modules.size(); ++im){
+            if(module_cached[im]) continue;
             try{
-                modules[i]->process(*event);
+                ts.modules[im]->process_batch(batch);
             }
             catch(...){
-                LOG_ERROR("Exception caught while calling 'process' method of module " << i << " (name: "
-                          << module_names[i] << ") for entry " << ientry << " of file "
+                LOG_ERROR("Exception caught while calling 'process_batch' method of module " << im << " (name: "
+                          << module_names[im] << ") for entries " << entries[ifirst] << " -- " << (entries[ifirst + n - 1] + 1) << " of file "
                           << current_dataset().files[current_ifile].path << "; re-throwing.");
                 throw;
             }
-            if(event->get_state(handle_stop) == Event::state::valid && event->get(handle_stop)){
-                event_selected = false;
-                break;
+            for(size_t i=0; i<n; ++i){
+                if(!batch.is_active(i)) continue;
+                const Event & e = batch.event(i);
+                if(e.get_state(handle_stop) == Event::state::valid && e.get(handle_stop)){
+                    batch.deactivate(i);
+                }
             }
         }
-        if(event_selected){
+    }
+    else{
+        for(size_t i=0; i<n; ++i){
+            if(!process_event(ts, batch.event(i), entries[ifirst + i])){
+                batch.deactivate(i);
+            }
+        }
+    }
+    for(size_t i=0; i<n; ++i){
+        if(batch.is_active(i)){
             ++nevents_survived;
-            out->write_event(*event);
+            ts.out->write_event(batch.event(i));
         }
     }
-    if(stats){
-        stats->nbytes_read = in->nbytes_read();
-        stats->nevents_survived = nevents_survived;
+}
+
+size_t AnalysisController::nallocations() const{
+    size_t result = 0;
+    for(const auto & ts : threads){
+        if(ts.batch){
+            for(size_t i=0; i<ts.batch->capacity(); ++i){
+                result += ts.batch->event(i).nallocations();
+            }
+            if(ts.next_batch){
+                for(size_t i=0; i<ts.next_batch->capacity(); ++i){
+                    result += ts.next_batch->event(i).nallocations();
+                }
+            }
+        }
+        else{
+            result += ts.event->nallocations();
+        }
     }
+    return result;
 }
 
 AnalysisController::~AnalysisController(){
+    {
+        lock_guard<mutex> lock(workers_mutex);
+        stop_workers = true;
+    }
+    workers_cv.notify_all();
+    for(auto & w : workers){
+        w.join();
+    }
     start_dataset(-1, "");
 }
@@ -0,0 +1,131 @@
+#include "derived-cache.hpp"
+#include "config.hpp"
+#include "root-utils.hpp"
+#include "base/include/utils.hpp"
+#include "base/include/log.hpp"
+
+#include <boost/property_tree/info_parser.hpp>
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace ra;
+using namespace std;
+
+const char * const DerivedCache::treename = "derived";
+
+DerivedCache::DerivedCache(const s_config & config, size_t imodule, const s_dataset & dataset, const std::string & input_file){
+    if(imodule >= config.modules_cfg.size()){
+        throw invalid_argument("DerivedCache: module index out of range");
+    }
+    // the key: everything the outputs of the module can depend on, except the code:
+    stringstream key;
+    size_t im = 0;
+    for(const auto & module_cfg : config.modules_cfg){
+        key << module_cfg.first << "\n";
+        boost::property_tree::write_info(key, module_cfg.second);
+        if(im == imodule){
+            module_name = module_cfg.first;
+            break;
+        }
+        ++im;
+    }
+    for(const auto & tag : dataset.tags.keyval){
+        key << tag.first << "=" << tag.second << "\n";
+    }
+    key << input_file << "\n";
+    struct stat st;
+    if(stat(input_file.c_str(), &st) == 0){
+        key << st.st_size << " " << st.st_mtime << "\n";
+    }
+    stringstream fname;
+    fname << config.options.derived_cache_dir << "/" << module_name << "-" << hex << std::hash<string>()(key.str()) << ".root";
+    filename = fname.str();
+}
+
+DerivedCache::~DerivedCache(){
+    discard();
+}
+
+std::string DerivedCache::mask_member_name(const std::string & module_name){
+    return "derived_cache_mask_" + module_name;
+}
+
+bool DerivedCache::exists() const{
+    return access(filename.c_str(), F_OK) == 0;
+}
+
+void DerivedCache::start_writing(EventStructure & es, Event & event, const std::vector<AnalysisModule::cacheable_output> & outputs, size_t nentries_){
+    if(file){
+        throw logic_error("DerivedCache::start_writing called twice");
+    }
+    if(outputs.size() > 64){
+        throw invalid_argument("DerivedCache: module '" + module_name + "' has more than 64 cacheable outputs");
+    }
+    nentries = nentries_;
+    next_entry = 0;
+    mkdir_recursive(filename.substr(0, filename.rfind('/')));
+    tmpfilename = filename + ".tmp-" + hostname() + "-" + std::to_string(getpid());
+    // creating the file makes it the current directory; restore that to not affect other output:
+    TDirectory * dir = gDirectory;
+    file.reset(new TFile(tmpfilename.c_str(), "recreate"));
+    if(!file->IsOpen()){
+        gDirectory = dir;
+        file.reset();
+        throw runtime_error("DerivedCache: could not create cache file '" + tmpfilename + "'");
+    }
+    tree = new TTree(treename, treename);
+    tree->SetDirectory(file.get());
+    gDirectory = dir;
+    outtree.reset(new OutTree(tree));
+    for(const auto & output : outputs){
+        outtree->create_branch(*output.ti, output.name, event, es.get_raw_handle(*output.ti, output.name));
+    }
+    const string mask_name = mask_member_name(module_name);
+    tree->Branch(mask_name.c_str(), &valid_mask, (mask_name + "/l").c_str());
+}
+
+void DerivedCache::append(size_t ientry){
+    if(!file) return;
+    if(ientry != next_entry){
+        auto logger = Logger::get("ra.DerivedCache");
+        LOG_DEBUG("entries not processed in order (expected entry " << next_entry << ", got " << ientry << "); not writing cache file '" << filename << "'");
+        discard();
+        return;
+    }
+    outtree->append_or_default(valid_mask);
+    ++next_entry;
+    if(next_entry == nentries){
+        finish();
+    }
+}
+
+void DerivedCache::finish(){
+    TDirectory * dir = gDirectory;
+    file->cd();
+    tree->Write();
+    gDirectory = dir;
+    outtree.reset();
+    file->Close();
+    file.reset();
+    tree = nullptr;
+    if(rename(tmpfilename.c_str(), filename.c_str()) != 0){
+        unlink(tmpfilename.c_str());
+        throw runtime_error("DerivedCache: error renaming cache file to '" + filename + "'");
+    }
+}
+
+void DerivedCache::discard(){
+    if(!file) return;
+    outtree.reset();
+    file->Close();
+    file.reset();
+    tree = nullptr;
+    unlink(tmpfilename.c_str());
+}
@@ -21,17 +21,51 @@ std::ostream & ra::operator<<(std::ostream & out, Event::state p){
 }
 
 EventStructure::RawHandle EventStructure::get_raw_handle(const std::type_info & ti, const std::string & name){
+    return get_raw_handle(ti, name, 0, 0);
+}
+
+EventStructure::RawHandle EventStructure::get_raw_handle(const std::type_info & ti, const std::string & name, size_t inline_size, size_t align, assign_function assign){
     // check if it exists already. Note that this is a slow (O(N)) operation, but
     // this should be ok as we do not expect this method to be called often
     for(size_t i=0; i<member_infos.size(); ++i){
         if(member_infos[i].name == name && member_infos[i].type == ti){
+            // the member might have been declared via the 'raw' method before, without inline information:
+            if(member_infos[i].inline_size == 0 && inline_size > 0){
+                member_infos[i].inline_size = inline_size;
+                member_infos[i].align = align;
+                layout_cache.offsets.clear();
+            }
+            if(member_infos[i].assign == nullptr){
+                member_infos[i].assign = assign;
+            }
             return HandleAccess_::create_raw_handle(static_cast<int64_t>(i));
         }
     }
-    member_infos.emplace_back(name, ti);
+    member_infos.emplace_back(name, ti, inline_size, align, assign);
     return HandleAccess_::create_raw_handle(static_cast<int64_t>(member_infos.size() - 1));
 }
 
+const EventStructure::arena_layout & EventStructure::layout() const{
+    if(layout_cache.offsets.size() == member_infos.size()) return layout_cache;
+    // place members with largest alignment first; this avoids any padding as all
+    // sizes are multiples of the alignment.
+    vector<size_t> order;
+    for(size_t i=0; i<member_infos.size(); ++i){
+        if(member_infos[i].inline_size > 0) order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [this](size_t i, size_t j){ return member_infos[i].align > member_infos[j].align; });
+    layout_cache.offsets.assign(member_infos.size(), -1);
+    size_t offset = 0;
+    for(size_t i : order){
+        const auto & mi = member_infos[i];
+        offset = (offset + mi.align - 1) / mi.align * mi.align;
+        layout_cache.offsets[i] = offset;
+        offset += mi.inline_size;
+    }
+    layout_cache.size = offset;
+    return layout_cache;
+}
+
 
 const std::type_info & EventStructure::type(const EventStructure::RawHandle & handle) const{
     auto index = HandleAccess_::index(handle);
@@ -39,6 +73,12 @@ const std::type_info & EventStructure::type(const EventStructure::RawHandle & ha
     return member_infos[index].type;
 }
 
+EventStructure::assign_function EventStructure::get_assign(const RawHandle & handle) const{
+    auto index = HandleAccess_::index(handle);
+    assert(index >= 0 && static_cast<size_t>(index) < member_infos.size());
+    return member_infos[index].assign;
+}
+
 std::string EventStructure::name(const RawHandle & handle){
     auto index = HandleAccess_::index(handle);
     assert(index >= 0 && static_cast<size_t>(index) < member_infos.size());
@@ -46,7 +86,18 @@ std::string EventStructure::name(const RawHandle & handle){
 }
 
 
-Event::Event(const EventStructure & es): structure(es), member_datas(es.member_infos.size()){}
+Event::Event(const EventStructure & es): structure(es), member_datas(es.member_infos.size()){
+    const auto & layout = es.layout();
+    if(layout.size == 0) return;
+    const size_t n = (layout.size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    arena.reset(new uint64_t[n]());
+    char * base = reinterpret_cast<char*>(arena.get());
+    for(size_t i=0; i<member_datas.size(); ++i){
+        if(layout.offsets[i] >= 0){
+            member_datas[i].slot = base + layout.offsets[i];
+        }
+    }
+}
 
 void Event::fail(const std::type_info & ti, const EventStructure::RawHandle & handle, const string & msg) const{
     std::stringstream errmsg;
@@ -80,7 +131,19 @@ void Event::set(const std::type_info & ti, const RawHandle & handle, void * data
     }
     md.eraser = eraser;
     md.data = data;
-    md.valid = true;
+    set_valid(md, true);
+}
+
+void * Event::set_inline(const std::type_info & ti, const RawHandle & handle){
+    check(ti, handle, "set_inline");
+    auto index = HandleAccess_::index(handle);
+    member_data & md = member_datas[index];
+    if(md.data != nullptr){
+        throw invalid_argument("set_inline: tries to reset member already set.");
+    }
+    md.data = md.slot;
+    set_valid(md, false);
+    return md.data;
 }
 
 void * Event::get(const std::type_info & ti, const EventStructure::RawHandle & handle, state minimum_state){
@@ -100,7 +163,7 @@ const void * Event::get(const std::type_info & ti, const EventStructure::RawHand
     }
     // generate if invalid and can be generated.
     bool has_generator = static_cast<bool>(md.generator);
-    if(!md.valid && has_generator){
+    if(!is_valid(md) && has_generator){
         try{
             md.generator();
         }
@@ -111,7 +174,7 @@ const void * Event::get(const std::type_info & ti, const EventStructure::RawHand
         }
     }
     // easiest case: data is there and valid:
-    if(md.valid || minimum_state == state::invalid){
+    if(is_valid(md) || minimum_state == state::invalid){
         return md.data;
     }
     else{
@@ -144,14 +207,14 @@ void Event::set_validity(const std::type_info & ti, const EventStructure::RawHan
     check(ti, handle, "set_validity");
     auto index = HandleAccess_::index(handle);
     member_data & md = member_datas[index];
-    md.valid = valid;
+    set_valid(md, valid);
 }
 
 void Event::set_validity(const EventStructure::RawHandle & handle, bool valid){
     check(handle, "set_validity");
     auto index = HandleAccess_::index(handle);
     member_data & md = member_datas[index];
-    md.valid = valid;
+    set_valid(md, valid);
 }
 
 Event::member_data::~member_data(){
@@ -160,12 +223,6 @@ Event::member_data::~member_data(){
     }
 }
 
-void Event::invalidate_all(){
-    for(auto & md : member_datas){
-        md.valid = false;
-    }
-}
-
 void Event::set_get_callback(const std::type_info & ti, const RawHandle & handle, const std::function<void ()> & callback){
     check(ti, handle, "set_get_callback");
     auto index = HandleAccess_::index(handle);
@@ -175,7 +232,7 @@ void Event::set_get_callback(const std::type_info & ti, const RawHandle & handle
     }
     md.generator = callback;
     if(callback){
-        md.valid = false;
+        set_valid(md, false);
     }
 }
 
@@ -184,7 +241,7 @@ Event::state Event::get_state(const std::type_info & ti, const RawHandle & handl
     auto index = HandleAccess_::index(handle);
     const member_data & md = member_datas[index];
     if(md.data == nullptr) return state::nonexistent;
-    return md.valid ? state::valid : state::invalid;
+    return is_valid(md) ? state::valid : state::invalid;
 }
 
 Event::~Event(){
@@ -0,0 +1,33 @@
+#include "eventbatch.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+using namespace ra;
+using namespace std;
+
+EventBatch::EventBatch(const EventStructure & es, size_t capacity): active(capacity, false), n(0){
+    if(capacity == 0){
+        throw invalid_argument("EventBatch: capacity must be larger than zero");
+    }
+    events.reserve(capacity);
+    for(size_t i=0; i<capacity; ++i){
+        events.emplace_back(new Event(es));
+    }
+}
+
+size_t EventBatch::nactive() const{
+    return count(active.begin(), active.begin() + n, true);
+}
+
+void EventBatch::reset(size_t n_){
+    if(n_ > events.size()){
+        throw invalid_argument("EventBatch::reset: batch size exceeds capacity");
+    }
+    n = n_;
+    for(size_t i=0; i<n; ++i){
+        events[i]->invalidate_all();
+        active[i] = true;
+    }
+    fill(active.begin() + n, active.end(), false);
+}
@@ -1,4 +1,5 @@
 #include "hists.hpp"
+#include "eventbatch.hpp"
 #include "TFile.h"
 #include "config.hpp"
 
@@ -9,6 +10,7 @@
 #include <vector>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
 
 using namespace std;
 using namespace ra;
@@ -18,37 +20,226 @@ Hists::Hists(const std::string & dirname_, const s_dataset & dataset, OutputMana
     if(!dirname.empty()){
         if(dirname[dirname.size() - 1] != '/') dirname += '/';
     }
+    self = make_shared<Hists*>(this);
+    shared_ptr<Hists*> s = self;
+    out.before_write([s]{
+        if(*s) (*s)->sync_autofill();
+    });
 }
 
-Hists::~Hists(){}
+Hists::~Hists(){
+    *self = nullptr;
+    sync_autofill();
+}
 
-void Hists::book_1d_autofill(event_functor f, const char * name, int nbins, double xmin, double xmax, Event::Handle<double> weight_handle){
+size_t Hists::book_flat(const char * name, int nbins, double xmin, double xmax, Event::Handle<double> weight_handle){
+    if(nbins <= 0 || !(xmin < xmax)){
+        throw invalid_argument(string("book_1d_autofill: invalid binning for histogram '") + name + "'");
+    }
     TH1D * histo = book<TH1D>(name, nbins, xmin, xmax);
     Event::Handle<double> invalid_handle;
     if(weight_handle == invalid_handle){
         weight_handle = out.get_handle<double>("weight");
     }
-    autofill_histos.emplace_back(autofill_histo{move(f), weight_handle, histo});
+    flat_histos.emplace_back(histo, weight_handle, nbins, xmin, xmax);
+    return flat_histos.size() - 1;
+}
+
+void Hists::book_1d_autofill(event_functor f, const char * name, int nbins, double xmin, double xmax, Event::Handle<double> weight_handle){
+    const size_t index = book_flat(name, nbins, xmin, xmax, weight_handle);
+    if(!functors){
+        functors = new functor_group();
+        autofill_groups.emplace_back(functors);
+    }
+    functors->kernels.emplace_back(move(f), index);
+}
+
+void Hists::functor_group::fill(Event & event, Hists & hists){
+    for(const auto & k : kernels){
+        const double value = k.first(event);
+        if(std::isnan(value)) continue;
+        hists.fill_flat(k.second, value, event);
+    }
 }
 
 void Hists::process_all(Event & e){
     process(e);
-    const Event::Handle<double> invalid_handle;
-    for(auto & it : autofill_histos){
-        double value = it.f(e);
-        if(std::isnan(value)) continue;
-        double weight = e.get(it.weight_handle);
-        it.histo->Fill(value, weight);
+    if(!variations.empty()){
+        set_variation_factors(e);
+        process_variations(e);
+    }
+    for(auto & g : autofill_groups){
+        g->fill(e, *this);
+    }
+}
+
+void Hists::process_all(EventBatch & batch, const std::vector<char> & selected){
+    const size_t n = batch.size();
+    for(size_t i=0; i<n; ++i){
+        if(selected[i]) process(batch.event(i));
+    }
+    if(variations.empty()){
+        for(auto & g : autofill_groups){
+            for(size_t i=0; i<n; ++i){
+                if(selected[i]) g->fill(batch.event(i), *this);
+            }
+        }
+    }
+    else{
+        // the variation factors are per event, so loop over the events first:
+        for(size_t i=0; i<n; ++i){
+            if(!selected[i]) continue;
+            Event & event = batch.event(i);
+            set_variation_factors(event);
+            process_variations(event);
+            for(auto & g : autofill_groups){
+                g->fill(event, *this);
+            }
+        }
+    }
+}
+
+void Hists::add_weight_variations(const std::vector<identifier> & syst_pars){
+    if(!variations.empty()){
+        throw logic_error("Hists::add_weight_variations called twice");
+    }
+    h_weight = out.get_handle<double>("weight");
+    h_systs = out.get_handle<weight_systematics>(weight_systematics::member_name);
+    const string base = dirname.empty() ? string() : dirname.substr(0, dirname.size() - 1);
+    for(const auto & syst_par : syst_pars){
+        for(bool plus : {false, true}){
+            variation v;
+            v.syst_par = syst_par;
+            v.plus = plus;
+            const string vdir = base + "__" + syst_par.name() + (plus ? "_plus/" : "_minus/");
+            map<TH1*, TH1*> copies;
+            for(const auto & it : i2h){
+                TH1 * copy = static_cast<TH1*>(it.second->Clone());
+                copy->Reset();
+                out.put((vdir + it.first.name()).c_str(), copy);
+                v.i2h[it.first] = copy;
+                copies[it.second] = copy;
+            }
+            v.flat_histos = flat_histos;
+            for(auto & h : v.flat_histos){
+                h.histo = static_cast<TH1D*>(copies[h.histo]);
+                h.sumw.assign(h.sumw.size(), 0.0);
+                h.sumw2.assign(h.sumw2.size(), 0.0);
+                h.nentries = 0.0;
+                for(int i=0; i<4; ++i){
+                    h.stats[i] = 0.0;
+                }
+            }
+            for(const auto & it : deferred){
+                put_deferred(v.deferred, it.first, vdir + it.first.name(), it.second->create);
+            }
+            variations.emplace_back(move(v));
+        }
+    }
+    variation_factors.assign(variations.size(), 1.0);
+}
+
+void Hists::set_variation_factors(Event & event){
+    const weight_systematics * systs = event.get_state(h_systs) == Event::state::valid ? &event.get(h_systs) : nullptr;
+    for(size_t iv=0; iv<variations.size(); ++iv){
+        variation_factors[iv] = systs ? systs->factor(variations[iv].syst_par, variations[iv].plus) : 1.0;
+    }
+}
+
+void Hists::process_variations(Event & event){
+    double & weight = event.get(h_weight);
+    const double weight_before = weight;
+    for(size_t iv=0; iv<variations.size(); ++iv){
+        weight = weight_before * variation_factors[iv];
+        current_variation = iv + 1;
+        process(event);
+    }
+    weight = weight_before;
+    current_variation = 0;
+}
+
+void Hists::sync_autofill(){
+    auto sync = [](std::vector<flat_histo> & histos){
+        for(auto & h : histos){
+            if(h.nentries == 0.0) continue;
+            // get the statistics before changing the contents: if the histogram has no statistics, root computes them from the contents.
+            double stats[4];
+            h.histo->GetStats(stats);
+            for(int i=0; i<4; ++i){
+                stats[i] += h.stats[i];
+                h.stats[i] = 0.0;
+            }
+            double * contents = h.histo->GetArray();
+            double * sumw2 = h.histo->GetSumw2()->GetArray();
+            for(int i=0; i<h.nbins+2; ++i){
+                contents[i] += h.sumw[i];
+                sumw2[i] += h.sumw2[i];
+                h.sumw[i] = h.sumw2[i] = 0.0;
+            }
+            h.histo->PutStats(stats);
+            h.histo->SetEntries(h.histo->GetEntries() + h.nentries);
+            h.nentries = 0.0;
+        }
+    };
+    sync(flat_histos);
+    for(auto & v : variations){
+        sync(v.flat_histos);
+    }
+}
+
+void Hists::put_deferred(std::map<identifier, std::shared_ptr<deferred_histo>> & deferred_histos, const identifier & id, const std::string & path,
+                         const std::function<TH1* ()> & create){
+    auto d = make_shared<deferred_histo>();
+    d->path = path;
+    d->create = create;
+    deferred_histos[id] = d;
+    out.put_deferred(path.c_str(), [d]() -> TH1* {
+        if(d->histo || !d->write_empty) return nullptr;
+        d->histo = d->create();
+        return d->histo;
+    });
+}
+
+void Hists::set_write_empty(bool write_empty){
+    for(auto & it : deferred){
+        it.second->write_empty = write_empty;
+    }
+    for(auto & v : variations){
+        for(auto & it : v.deferred){
+            it.second->write_empty = write_empty;
+        }
     }
 }
 
 TH1* Hists::get(const identifier & id){
-    auto it = i2h.find(id);
-    if(it!=i2h.end()) return it->second;
+    auto & histos = current_variation == 0 ? i2h : variations[current_variation - 1].i2h;
+    auto it = histos.find(id);
+    if(it!=histos.end()) return it->second;
+    auto & deferred_histos = current_variation == 0 ? deferred : variations[current_variation - 1].deferred;
+    auto dit = deferred_histos.find(id);
+    if(dit!=deferred_histos.end()){
+        deferred_histo & d = *dit->second;
+        d.histo = d.create();
+        out.put(d.path.c_str(), d.histo);
+        histos[id] = d.histo;
+        deferred_histos.erase(dit);
+        return d.histo;
+    }
     throw runtime_error("did not find histogram '" + id.name() + "'");
 }
 
-HistFiller::HistFiller(const ptree & cfg_): cfg(cfg_){}
+HistFiller::HistFiller(const ptree & cfg_): cfg(cfg_){
+    write_empty = ptree_get<bool>(cfg, "write_empty", true);
+    string systs = ptree_get<string>(cfg, "weight_systematics", "");
+    boost::trim(systs);
+    if(!systs.empty()){
+        vector<string> vsysts;
+        boost::split(vsysts, systs, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+        for(const auto & syst : vsysts){
+            syst_pars.emplace_back(syst);
+        }
+    }
+}
 
 // Fill od.hists
 // od.dirname and od.selid should be set to their defaults.
@@ -72,7 +263,8 @@ void HistFiller::parse_dir_cfg(const ptree & dircfg, outdir & od, const s_datase
             }
         }
         else if(it.first == "selection"){
-            od.sel_handle = in.get_handle<bool>(it.second.data());
+            od.selname = it.second.data();
+            od.sel_handle = in.get_handle<bool>(od.selname);
         }
         else if(it.first == "weights"){
             vector<string> vweights;
@@ -90,9 +282,18 @@ void HistFiller::parse_dir_cfg(const ptree & dircfg, outdir & od, const s_datase
 void HistFiller::begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
     outdirs.clear();
     h_weight = in.get_handle<double>("weight");
+    h_mask = in.get_handle<SelectionMask>(SelectionMask::member_name);
     boost::optional<ptree> last_dir_cfg;
+    for(const auto & syst_par : syst_pars){
+        try{
+            in.use_weight_systematic(syst_par);
+        }
+        catch(runtime_error & ex){
+            throw runtime_error(string("HistFiller: ") + ex.what());
+        }
+    }
     for(const auto & it : cfg){
-        if(it.first=="type") continue;
+        if(it.first=="type" || it.first=="weight_systematics" || it.first=="write_empty") continue;
         if(it.first=="_cfg"){
             last_dir_cfg = it.second;
         }
@@ -106,6 +307,7 @@ void HistFiller::begin_dataset(const s_dataset & dataset, InputManager & in, Out
             for(const auto & sel : vsels){
                 outdir od;
                 od.dirname = sel;
+                od.selname = sel;
                 od.sel_handle = in.get_handle<bool>(sel);
                 parse_dir_cfg(*last_dir_cfg, od, dataset, in, out);
                 outdirs.emplace_back(move(od));
@@ -114,20 +316,53 @@ void HistFiller::begin_dataset(const s_dataset & dataset, InputManager & in, Out
         else{
             outdir od;
             od.dirname = it.first;
+            od.selname = it.first;
             od.sel_handle = in.get_handle<bool>(it.first);
             parse_dir_cfg(it.second, od, dataset, in, out);
             outdirs.emplace_back(move(od));
         }
     }
+    weight_sets.assign(1, vector<Event::Handle<double>>());
+    for(auto & dir : outdirs){
+        // only selections of Selections modules configured before this one have their bit set when this module
+        // processes the event; for the others, the Event member is used:
+        dir.sel_bit = in.find_selection_bit(dir.selname);
+        auto it = find(weight_sets.begin(), weight_sets.end(), dir.weight_handles);
+        dir.weight_set = it - weight_sets.begin();
+        if(it == weight_sets.end()){
+            weight_sets.push_back(dir.weight_handles);
+        }
+    }
+    weight_products.assign(weight_sets.size(), 0.0);
+    weight_product_valid.assign(weight_sets.size(), 0);
+    for(auto & dir : outdirs){
+        for(auto & hf : dir.hists){
+            if(!syst_pars.empty()){
+                hf->add_weight_variations(syst_pars);
+            }
+            hf->set_write_empty(write_empty);
+        }
+    }
 }
 
 void HistFiller::process(Event & event){
+    const SelectionMask * mask = get_mask(event);
+    double & weight = event.get(h_weight);
+    const double weight_before = weight;
+    size_t current_set = 0; // the weight set weight currently corresponds to
     for(auto & dir : outdirs){
-        if(!event.get(dir.sel_handle)) continue;
-        double & weight = event.get(h_weight);
-        double weight_before = weight;
-        for(auto & wh : dir.weight_handles){
-            weight *= event.get(wh);
+        if(!is_selected(dir, event, mask)) continue;
+        if(dir.weight_set != current_set){
+            if(!weight_product_valid[dir.weight_set]){
+                double product = weight_before;
+                for(auto & wh : weight_sets[dir.weight_set]){
+                    product *= event.get(wh);
+                }
+                weight_products[dir.weight_set] = product;
+                weight_product_valid[dir.weight_set] = 1;
+            }
+            weight = weight_products[dir.weight_set];
+            current_set = dir.weight_set;
         }
         for(auto & hf : dir.hists){
             try{
@@ -139,8 +374,60 @@ void HistFiller::process(Event & event){
                 throw;
             }
         }
+    }
+    if(current_set != 0){
         weight = weight_before;
     }
+    weight_product_valid.assign(weight_product_valid.size(), 0);
+}
+
+void HistFiller::process_batch(EventBatch & batch){
+    const size_t n = batch.size();
+    batch_selected.resize(n);
+    batch_weights_before.resize(n);
+    batch_masks.assign(n, nullptr);
+    for(size_t i=0; i<n; ++i){
+        if(batch.is_active(i)){
+            batch_masks[i] = get_mask(batch.event(i));
+        }
+    }
+    for(auto & dir : outdirs){
+        bool any_selected = false;
+        for(size_t i=0; i<n; ++i){
+            batch_selected[i] = batch.is_active(i) && is_selected(dir, batch.event(i), batch_masks[i]);
+            any_selected = any_selected || batch_selected[i];
+        }
+        if(!any_selected) continue;
+        const auto & weight_handles = weight_sets[dir.weight_set];
+        if(!weight_handles.empty()){
+            for(size_t i=0; i<n; ++i){
+                if(!batch_selected[i]) continue;
+                Event & event = batch.event(i);
+                double & weight = event.get(h_weight);
+                batch_weights_before[i] = weight;
+                for(auto & wh : weight_handles){
+                    weight *= event.get(wh);
+                }
+            }
+        }
+        for(auto & hf : dir.hists){
+            try{
+                hf->process_all(batch, batch_selected);
+            }
+            catch(...){
+                auto logger = Logger::get("Hists");
+                LOG_ERROR("HistFiller::process_batch: about to re-throwing exception in HistFiller dir " << dir.dirname);
+                throw;
+            }
+        }
+        if(!weight_handles.empty()){
+            for(size_t i=0; i<n; ++i){
+                if(batch_selected[i]){
+                    batch.event(i).get(h_weight) = batch_weights_before[i];
+                }
+            }
+        }
+    }
 }
 
 REGISTER_ANALYSIS_MODULE(HistFiller)
@@ -16,7 +16,11 @@
 #include <cassert>
 #include <unordered_map>
 #include <set>
+#include <fstream>
+#include <sstream>
+#include <cstring>
 #include <limits.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace ra;
@@ -142,6 +146,128 @@ std::string get_realpath(const string & fname){
     return path.get();
 }
 
+// the directory part of path including the trailing '/', or "" if path has no directory part
+string dir_part(const string & path){
+    size_t p = path.rfind('/');
+    if(p == string::npos) return "";
+    return path.substr(0, p + 1);
+}
+
+string without_root_extension(const string & rootfile){
+    const string ext = ".root";
+    if(rootfile.size() >= ext.size() && rootfile.compare(rootfile.size() - ext.size(), ext.size(), ext) == 0){
+        return rootfile.substr(0, rootfile.size() - ext.size());
+    }
+    return rootfile;
+}
+
+// append the chunks of the manifests of rhs_filenames to the manifest of file1, see merge_rootfiles
+void merge_manifests(const std::string & file1, const std::vector<std::string> & rhs_filenames){
+    const string manifest1 = manifest_filename(file1);
+    std::vector<output_chunk> chunks;
+    bool have_manifest = false;
+    if(access(manifest1.c_str(), F_OK) == 0){
+        chunks = read_manifest(manifest1);
+        have_manifest = true;
+    }
+    for(const auto & fn : rhs_filenames){
+        const string manifest = manifest_filename(fn);
+        if(access(manifest.c_str(), F_OK) != 0) continue;
+        for(auto & chunk : read_manifest(manifest)){
+            chunks.push_back(move(chunk));
+        }
+        have_manifest = true;
+    }
+    if(!have_manifest) return;
+    write_manifest(manifest1, chunks);
+}
+
+}
+
+std::string ra::manifest_filename(const std::string & rootfile){
+    return without_root_extension(rootfile) + ".manifest";
+}
+
+std::vector<ra::output_chunk> ra::read_manifest(const std::string & manifest){
+    ifstream in(manifest);
+    if(!in){
+        throw runtime_error("could not open manifest file '" + manifest + "'");
+    }
+    const string dir = dir_part(manifest);
+    std::vector<output_chunk> result;
+    string line;
+    while(getline(in, line)){
+        if(line.empty()) continue;
+        // the format is '<filename> <nentries>' per line:
+        size_t p = line.rfind(' ');
+        if(p == string::npos || p == 0){
+            throw runtime_error("invalid line '" + line + "' in manifest file '" + manifest + "'");
+        }
+        output_chunk chunk;
+        chunk.filename = line.substr(0, p);
+        if(chunk.filename[0] != '/'){
+            chunk.filename = dir + chunk.filename;
+        }
+        stringstream ss(line.substr(p + 1));
+        ss >> chunk.nentries;
+        if(!ss){
+            throw runtime_error("invalid line '" + line + "' in manifest file '" + manifest + "'");
+        }
+        result.push_back(move(chunk));
+    }
+    return result;
+}
+
+void ra::write_manifest(const std::string & manifest, const std::vector<output_chunk> & chunks){
+    const string dir = dir_part(manifest);
+    const string tmpname = manifest + ".tmp";
+    ofstream out(tmpname);
+    for(const auto & chunk : chunks){
+        string filename = chunk.filename;
+        if(dir_part(filename) == dir){
+            filename = filename.substr(dir.size());
+        }
+        else if(filename[0] != '/'){
+            filename = get_realpath(filename);
+        }
+        out << filename << " " << chunk.nentries << "\n";
+    }
+    out.close();
+    if(!out){
+        unlink(tmpname.c_str());
+        throw runtime_error("error writing manifest file '" + manifest + "'");
+    }
+    if(rename(tmpname.c_str(), manifest.c_str()) != 0){
+        unlink(tmpname.c_str());
+        throw runtime_error("error renaming manifest file to '" + manifest + "'");
+    }
+}
+
+void ra::rename_rootfile(const std::string & from, const std::string & to){
+    const string from_manifest = manifest_filename(from);
+    if(access(from_manifest.c_str(), F_OK) == 0){
+        // rename the chunks named after from:
+        const string from_base = without_root_extension(from), to_base = without_root_extension(to);
+        auto chunks = read_manifest(from_manifest);
+        for(auto & chunk : chunks){
+            if(chunk.filename.compare(0, from_base.size(), from_base) != 0) continue;
+            const string new_filename = to_base + chunk.filename.substr(from_base.size());
+            if(rename(chunk.filename.c_str(), new_filename.c_str()) != 0){
+                throw runtime_error("error renaming output chunk '" + chunk.filename + "' to '" + new_filename + "'");
+            }
+            chunk.filename = new_filename;
+        }
+        write_manifest(manifest_filename(to), chunks);
+        unlink(from_manifest.c_str());
+    }
+    if(rename(from.c_str(), to.c_str()) != 0){
+        throw runtime_error("error renaming output file '" + from + "' to '" + to + "'");
+    }
+}
+
+int ra::remove_rootfile(const std::string & rootfile){
+    unlink(manifest_filename(rootfile).c_str());
+    return unlink(rootfile.c_str());
 }
 
 
@@ -180,14 +306,14 @@ void ra::merge_rootfiles(const std::string & file1, const std::vector<std::strin
     f1.Write();
     f1.Close();
     
+    merge_manifests(file1, rhs_filenames);
+    
     // TODO: check the TTree entries, if requested.
     LOG_DEBUG("exiting merge_rootfiles");
 }
 
 
-namespace {
-
-void * allocate_type(const std::type_info & ti, std::function<void (void*)> & deallocator){
+void * ra::allocate_type(const std::type_info & ti, std::function<void (void*)> & deallocator){
     TClass * class_ = TBuffer::GetClass(ti);
     EDataType dt = TDataType::GetType(ti);
     void * result;
@@ -205,6 +331,70 @@ void * allocate_type(const std::type_info & ti, std::function<void (void*)> & de
     return result;
 }
 
+namespace {
+
+// the data member path of a sub-branch of the top-level branch topname. Depending on how the branch has been
+// created, sub-branch names are prefixed by the top-level branch name or not.
+string member_path(const string & topname, const string & subname){
+    string prefix = topname;
+    if(prefix.empty() || prefix[prefix.size() - 1] != '.') prefix += '.';
+    if(subname.compare(0, prefix.size(), prefix) == 0) return subname.substr(prefix.size());
+    return subname;
+}
+
+// whether path is equal to or a sub-path of parent
+bool is_subpath(const string & path, const string & parent){
+    return path.compare(0, parent.size(), parent) == 0 && (path.size() == parent.size() || path[parent.size()] == '.' || path[parent.size()] == '[');
+}
+
+void collect_member_branches(TBranch * branch, const string & topname, const vector<string> & data_members, vector<TBranch*> & result, vector<bool> & found){
+    TObjArray * subbranches = branch->GetListOfBranches();
+    for(int i=0; i<subbranches->GetEntriesFast(); ++i){
+        TBranch * sub = static_cast<TBranch*>(subbranches->At(i));
+        const string path = member_path(topname, sub->GetName());
+        bool needed = false;
+        for(size_t k=0; k<data_members.size(); ++k){
+            if(is_subpath(path, data_members[k])){
+                needed = found[k] = true;
+            }
+            else if(is_subpath(data_members[k], path)){
+                needed = true;
+            }
+        }
+        if(needed){
+            result.push_back(sub);
+            collect_member_branches(sub, topname, data_members, result, found);
+        }
+    }
+}
+
+void set_do_not_process(TBranch * branch, bool value){
+    TObjArray * subbranches = branch->GetListOfBranches();
+    for(int i=0; i<subbranches->GetEntriesFast(); ++i){
+        TBranch * sub = static_cast<TBranch*>(subbranches->At(i));
+        sub->SetBit(kDoNotProcess, value);
+        set_do_not_process(sub, value);
+    }
+}
+
+}
+
+std::vector<TBranch*> ra::get_member_branches(TBranch * branch, const std::vector<std::string> & data_members){
+    if(branch->GetListOfBranches()->GetEntriesFast() == 0){
+        throw invalid_argument("get_member_branches: branch '" + string(branch->GetName()) + "' is not split");
+    }
+    vector<TBranch*> result;
+    vector<bool> found(data_members.size(), false);
+    collect_member_branches(branch, branch->GetName(), data_members, result, found);
+    for(size_t k=0; k<data_members.size(); ++k){
+        if(!found[k]){
+            throw invalid_argument("get_member_branches: no sub-branch for data member '" + data_members[k] + "' in branch '" + branch->GetName() + "'");
+        }
+    }
+    return result;
+}
+
+namespace {
 
 char DataTypeToChar(EDataType datatype){
     switch(datatype) {
@@ -324,7 +514,13 @@ InTree::InTree(TTree * tree_, bool lazy_): tree(tree_), lazy(lazy_){
     n_entries = tree->GetEntries();
 }
 
-void InTree::open_branch(const std::type_info & ti, const std::string & branchname, Event & event, const Event::RawHandle & handle){
+InTree::read_buffers::~read_buffers(){
+    for(auto & b : buffers){
+        b.second.deallocator(b.second.object);
+    }
+}
+
+void InTree::open_branch(const std::type_info & ti, const std::string & branchname, Event & event, const Event::RawHandle & handle, read_mode mode){
     for(const auto & bi : branch_infos){
         if(bi.branchname == branchname){
             throw invalid_argument("InTree::open_branch: tried to open branch '" + branchname + "' twice.");
@@ -348,35 +544,189 @@ void InTree::open_branch(const std::type_info & ti, const std::string & branchna
         throw runtime_error(ss.str());
     }
     void * addr = event.get(ti, handle, Event::state::nonexistent);
+    if(addr == nullptr){
+        addr = event.set_inline(ti, handle);
+    }
     if(addr == nullptr){
         std::function<void (void*)> eraser;
         addr = allocate_type(ti, eraser);
         event.set(ti, handle, addr, move(eraser));
         event.set_validity(ti, handle, false);
     }
-    if(detail::is_class(branch_type)){
+    const bool is_class = detail::is_class(branch_type);
+    // read via the buffers if the data can be copied from there, see read_buffers:
+    EventStructure::assign_function assign = is_class ? event.get_assign(handle) : nullptr;
+    InTree::read_buffers::buffer * buffer = nullptr;
+    if(buffers && (assign || !is_class)){
+        buffer = &buffers->buffers[branchname];
+        if(buffer->object == nullptr){
+            buffer->object = allocate_type(ti, buffer->deallocator);
+            buffer->ptr = buffer->object;
+        }
+    }
+    void * branch_address;
+    if(buffer){
+        branch_address = is_class ? &buffer->ptr : buffer->object;
+    }
+    else if(is_class){
         ptrs.push_back(addr);
-        branch->SetAddress(&ptrs.back());
+        branch_address = &ptrs.back();
     }
     else{
-        branch->SetAddress(addr);
+        branch_address = addr;
     }
-    branch_infos.emplace_back(branchname, branch, event, handle);
+    branch->SetAddress(branch_address);
+    branch_infos.emplace_back(branchname, branch, event, handle, branch_address, mode);
     auto & bi = branch_infos.back();
-    if(lazy){
-        event.set_get_callback(ti, handle, [&bi, this](){ this->read_branch(bi); });
+    if(buffer){
+        bi.buffer = buffer->object;
+        bi.target = addr;
+        bi.assign = assign;
+        if(!is_class){
+            bi.size = TDataType::GetDataType(TDataType::GetType(ti))->Size();
+        }
+    }
+    bi.top_index = tree->GetListOfBranches()->IndexOf(branch);
+    if(mode == read_mode::eager){
+        // remove a callback which might have been installed by another InTree for this event before:
+        event.set_get_callback(ti, handle, std::function<void ()>());
+    }
+    else{
+        event.set_get_callback(ti, handle, [&bi, this](){
+            if(this->read_mutex){
+                std::lock_guard<std::mutex> lock(*this->read_mutex);
+                this->read_branch(bi);
+            }
+            else{
+                this->read_branch(bi);
+            }
+        });
+        if(mode == read_mode::disabled){
+            tree->SetBranchStatus(branchname.c_str(), 0);
+        }
     }
 }
 
-void InTree::read_branch(const binfo & bi){
-    int res =  bi.branch->GetEntry(current_index);
+size_t InTree::layout_fingerprint(TTree * tree){
+    size_t result = 0;
+    std::hash<string> h;
+    // walk all branches, including sub-branches of split branches:
+    std::vector<TObjArray*> lists{tree->GetListOfBranches()};
+    while(!lists.empty()){
+        TObjArray * branches = lists.back();
+        lists.pop_back();
+        const int n = branches->GetEntriesFast();
+        result = result * 31 + n;
+        for(int i=0; i<n; ++i){
+            TBranch * branch = static_cast<TBranch*>(branches->UncheckedAt(i));
+            result = result * 31 + h(branch->GetName());
+            result = result * 31 + h(branch->GetTitle());
+            result = result * 31 + h(branch->GetClassName());
+            lists.push_back(branch->GetListOfBranches());
+        }
+    }
+    return result;
+}
+
+void InTree::switch_tree(TTree * tree_){
+    tree = tree_;
+    n_entries = tree->GetEntries();
+    current_index = -1;
+    TObjArray * top_branches = tree->GetListOfBranches();
+    for(auto & bi : branch_infos){
+        TBranch * branch = nullptr;
+        if(bi.top_index >= 0 && bi.top_index < top_branches->GetEntriesFast()){
+            branch = static_cast<TBranch*>(top_branches->UncheckedAt(bi.top_index));
+            if(bi.branchname != branch->GetName()) branch = nullptr;
+        }
+        if(branch == nullptr){
+            branch = tree->GetBranch(bi.branchname.c_str());
+        }
+        if(branch == nullptr){
+            throw runtime_error("InTree::switch_tree: Did not find branch '" + bi.branchname + "'");
+        }
+        bi.branch = branch;
+        bi.nreads = 0;
+        branch->SetAddress(bi.address);
+        if(bi.mode == read_mode::disabled){
+            tree->SetBranchStatus(bi.branchname.c_str(), 0);
+        }
+        if(!bi.data_members.empty()){
+            apply_restriction(bi);
+        }
+    }
+}
+
+std::map<std::string, int64_t> InTree::get_nreads() const{
+    std::map<std::string, int64_t> result;
+    for(const auto & bi : branch_infos){
+        result[bi.branchname] = bi.nreads;
+    }
+    return result;
+}
+
+void InTree::read_branch(binfo & bi){
+    if(bi.mode == read_mode::disabled){
+        auto logger = Logger::get("ra.root-utils.InTree");
+        LOG_WARNING("reading branch '" << bi.branchname << "' which was disabled as it was not expected to be read; enabling it again.");
+        tree->SetBranchStatus(bi.branchname.c_str(), 1);
+        bi.mode = read_mode::lazy;
+        if(!bi.data_members.empty()){
+            apply_restriction(bi);
+        }
+    }
+    if(bi.branch->GetAddress() != bi.address){
+        // another InTree for the same TTree has set its address (not if both read via the same read_buffers):
+        bi.branch->SetAddress(bi.address);
+    }
+    int res;
+    if(bi.data_members.empty()){
+        // getall = 1 reads the branch even if it has been disabled in the meantime by another InTree for the same TTree:
+        res = bi.branch->GetEntry(current_index, 1);
+    }
+    else{
+        // getall = 0 skips the sub-branches not needed. Enable them again if this branch has been disabled in the meantime:
+        if(bi.branch->TestBit(kDoNotProcess)){
+            apply_restriction(bi);
+        }
+        res = bi.branch->GetEntry(current_index, 0);
+    }
     if(res < 0){
         stringstream ss;
         ss << "Error from TBranch::GetEntry reading entry " << current_index;
         throw runtime_error(ss.str());
     }
+    if(bi.assign){
+        bi.assign(bi.target, bi.buffer);
+    }
+    else if(bi.buffer){
+        memcpy(bi.target, bi.buffer, bi.size);
+    }
     bi.event.set_validity(bi.handle, true);
     bytes_read += res;
+    ++bi.nreads;
+}
+
+void InTree::restrict_branch(const std::string & branchname, const std::vector<std::string> & data_members){
+    for(auto & bi : branch_infos){
+        if(bi.branchname != branchname) continue;
+        bi.data_members = data_members;
+        apply_restriction(bi);
+        return;
+    }
+    throw invalid_argument("InTree::restrict_branch: branch '" + branchname + "' has not been opened");
+}
+
+void InTree::apply_restriction(binfo & bi){
+    const auto member_branches = get_member_branches(bi.branch, bi.data_members);
+    set_do_not_process(bi.branch, true);
+    for(TBranch * b : member_branches){
+        b->SetBit(kDoNotProcess, false);
+    }
+    // a disabled branch is enabled when it is read (see read_branch):
+    if(bi.mode != read_mode::disabled){
+        bi.branch->SetBit(kDoNotProcess, false);
+    }
 }
 
 void InTree::get_entry(int64_t index){
@@ -384,16 +734,13 @@ void InTree::get_entry(int64_t index){
         throw runtime_error("InTree::get_entry: index out of bounds");
     }
     current_index = index;
-    if(lazy){
-        for(const auto & bi : branch_infos){
-            bi.event.set_validity(bi.handle, false);
-        }
-    }
-    else{
-        // read all:
-        for(const auto & bi : branch_infos){
+    for(auto & bi : branch_infos){
+        if(bi.mode == read_mode::eager){
             read_branch(bi);
         }
+        else{
+            bi.event.set_validity(bi.handle, false);
+        }
     }
 }
 
@@ -422,23 +769,54 @@ void OutTree::create_branch(const std::type_info & ti, const std::string & branc
     }
 }
 
+void OutTree::set_address(binfo & bi, void * obj){
+    if(bi.address == obj) return;
+    if(bi.is_class){
+        if(!bi.address_ptr){
+            addresses.push_back(obj);
+            bi.address_ptr = &addresses.back();
+        }
+        *bi.address_ptr = obj;
+        bi.branch->SetAddress(bi.address_ptr);
+    }
+    else{
+        bi.branch->SetAddress(obj);
+    }
+    bi.address = obj;
+}
+
 void OutTree::append(){
     for(auto & bi : branch_infos){
         // make sure to read event content (even in case of lazy read / lazy evaluate):
         void * obj = bi.event.get(bi.ti, bi.handle);
         assert(obj != nullptr);
-        // (re-)set branch addresses, if not yet done. Note that now, the object must be available in the event.
-        if(!bi.address_setup){
-            if(bi.is_class){
-                addresses.push_back(obj);
-                bi.branch->SetAddress(&addresses.back());
-            }
-            else{
-                bi.branch->SetAddress(obj);
+        // (re-)set the branch address, if not yet done. Note that now, the object must be available in the event.
+        set_address(bi, obj);
+    }
+    tree->Fill();
+}
+
+void OutTree::append_or_default(uint64_t & valid_mask){
+    if(branch_infos.size() > 64){
+        throw invalid_argument("OutTree::append_or_default: more than 64 branches");
+    }
+    valid_mask = 0;
+    for(size_t i=0; i<branch_infos.size(); ++i){
+        auto & bi = branch_infos[i];
+        void * obj;
+        if(bi.event.get_state(bi.ti, bi.handle) == Event::state::valid){
+            obj = bi.event.get(bi.ti, bi.handle);
+            valid_mask |= uint64_t(1) << i;
+        }
+        else{
+            if(!bi.default_object){
+                std::function<void (void*)> deallocator;
+                void * def = allocate_type(bi.ti, deallocator);
+                bi.default_object.reset(def, deallocator);
             }
-            bi.address_setup = true;
+            obj = bi.default_object.get();
         }
+        set_address(bi, obj);
     }
     tree->Fill();
 }
-
@@ -1,26 +1,121 @@
 #include "selections.hpp"
 #include "context.hpp"
+#include "eventbatch.hpp"
+#include "skim-index.hpp"
+#include "base/include/log.hpp"
 
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
 
 using namespace std;
 using namespace ra;
 
-Selections::Selections(const ptree & cfg_): cfg(cfg_){
+const char * const SelectionMask::member_name = "selection_mask";
+
+void Selection::select_batch(const EventBatch & batch, std::vector<char> & result){
+    for(size_t i=0; i<batch.size(); ++i){
+        if(batch.is_active(i)){
+            result[i] = (*this)(batch.event(i));
+        }
+    }
+}
+
+Selections::Selections(const ptree & cfg_): cfg(cfg_), dataset(0), skim_record(false), skim_nentries(0){
+    auto skim_cfg = cfg.get_child_optional("skim_index");
+    if(skim_cfg){
+        skim_selection = ptree_get<string>(*skim_cfg, "selection");
+    }
 }
 
-void Selections::begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
+void Selections::begin_dataset(const s_dataset & dataset_, InputManager & in, OutputManager & out){
+    write_skim_index();
+    input_file.clear();
+    dataset = &dataset_;
     selections.clear();
     for(const auto & setting : cfg){
-        if(setting.first == "type") continue;
-        selections.emplace_back(in.get_handle<bool>(setting.first), SelectionRegistry::build(setting.second.get<string>("type"), setting.second, in, out));
+        if(setting.first == "type" || setting.first == "skim_index") continue;
+        selections.emplace_back(in.get_handle<bool>(setting.first), SelectionRegistry::build(setting.second.get<string>("type"), setting.second, in, out),
+                                in.register_selection_bit(setting.first));
+    }
+    mask_handle = in.get_handle<SelectionMask>(SelectionMask::member_name);
+    if(!skim_selection.empty()){
+        skim_handle = in.get_handle<bool>(skim_selection);
+        ientry_handle = in.get_handle<size_t>("ientry");
+    }
+}
+
+void Selections::begin_in_file(const std::string & input_file_){
+    write_skim_index();
+    input_file = input_file_;
+    if(skim_selection.empty()) return;
+    // do not record anything for files with a complete index:
+    SkimIndex index(cfg, *dataset, input_file);
+    size_t nentries;
+    vector<size_t> passing;
+    skim_record = !index.read(nentries, passing);
+}
+
+void Selections::end_range(size_t ifirst, size_t ilast, size_t nentries){
+    if(!skim_record) return;
+    skim_ranges.emplace_back(ifirst, ilast);
+    skim_nentries = nentries;
+}
+
+void Selections::write_skim_index(){
+    if(skim_ranges.empty()) return;
+    sort(skim_passing.begin(), skim_passing.end());
+    SkimIndex(cfg, *dataset, input_file).write_part(skim_nentries, skim_ranges, skim_passing);
+    skim_ranges.clear();
+    skim_passing.clear();
+}
+
+Selections::~Selections(){
+    try{
+        write_skim_index();
+    }
+    catch(std::exception & ex){
+        auto logger = Logger::get("ra.Selections");
+        LOG_ERROR("error writing skim index: " << ex.what());
     }
 }
     
 void Selections::process(Event & event){
+    SelectionMask & mask = SelectionMask::get(event, mask_handle);
     for(const auto & h_sel : selections){
         Selection & sel = *(get<1>(h_sel));
-        event.set(get<0>(h_sel), sel(event));
+        const bool result = sel(event);
+        event.set(get<0>(h_sel), result);
+        mask.set(get<2>(h_sel), result);
+    }
+    if(skim_record && event.get(skim_handle)){
+        skim_passing.push_back(event.get(ientry_handle));
+    }
+}
+
+void Selections::process_batch(EventBatch & batch){
+    batch_result.resize(batch.size());
+    batch_masks.assign(batch.size(), nullptr);
+    for(size_t i=0; i<batch.size(); ++i){
+        if(batch.is_active(i)){
+            batch_masks[i] = &SelectionMask::get(batch.event(i), mask_handle);
+        }
+    }
+    for(const auto & h_sel : selections){
+        Selection & sel = *(get<1>(h_sel));
+        sel.select_batch(batch, batch_result);
+        for(size_t i=0; i<batch.size(); ++i){
+            if(batch.is_active(i)){
+                batch.event(i).set(get<0>(h_sel), batch_result[i] != 0);
+                batch_masks[i]->set(get<2>(h_sel), batch_result[i] != 0);
+            }
+        }
+    }
+    if(skim_record){
+        for(size_t i=0; i<batch.size(); ++i){
+            if(batch.is_active(i) && batch.event(i).get(skim_handle)){
+                skim_passing.push_back(batch.event(i).get(ientry_handle));
+            }
+        }
     }
 }
 
@@ -0,0 +1,148 @@
+#include "skim-index.hpp"
+#include "config.hpp"
+#include "base/include/utils.hpp"
+#include "base/include/ptree-utils.hpp"
+
+#include <boost/property_tree/info_parser.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace ra;
+using namespace std;
+
+namespace {
+
+// part file format (all integers are uint64 in host byte order): magic, nentries, nranges, and for each range:
+// first, last, and the bitmap of passing entries in [first, last) with (last - first + 63) / 64 words.
+const char skim_magic[8] = {'r', 'a', 's', 'k', 'i', 'm', '0', '1'};
+
+string hex_string(size_t value){
+    stringstream ss;
+    ss << hex << value;
+    return ss.str();
+}
+
+void write_u64(ostream & out, uint64_t value){
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t read_u64(istream & in){
+    uint64_t result = 0;
+    in.read(reinterpret_cast<char*>(&result), sizeof(result));
+    return result;
+}
+
+}
+
+SkimIndex::SkimIndex(const ptree & selections_cfg, const s_dataset & dataset, const std::string & input_file){
+    const string dir = ptree_get<string>(selections_cfg, "skim_index.dir", "skim");
+    ptree cfg = selections_cfg;
+    cfg.erase("skim_index");
+    stringstream cfg_string;
+    boost::property_tree::write_info(cfg_string, cfg);
+    size_t key = std::hash<string>()(cfg_string.str());
+    key ^= dataset.filenames_hash + 0x9e3779b9 + (key << 6) + (key >> 2);
+    basename = dir + "/" + hex_string(key) + "/" + hex_string(std::hash<string>()(input_file));
+}
+
+void SkimIndex::write_part(size_t nentries, const std::vector<std::pair<size_t, size_t>> & ranges, const std::vector<size_t> & passing) const{
+    static std::atomic<int> counter(0);
+    const size_t p = basename.rfind('/');
+    mkdir_recursive(basename.substr(0, p));
+    const string filename = basename + "-" + hostname() + "-" + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".part";
+    const string tmpfilename = filename + ".tmp";
+    ofstream out(tmpfilename, ios::binary);
+    out.write(skim_magic, sizeof(skim_magic));
+    write_u64(out, nentries);
+    write_u64(out, ranges.size());
+    auto it = passing.begin();
+    for(const auto & r : ranges){
+        write_u64(out, r.first);
+        write_u64(out, r.second);
+        vector<uint64_t> bitmap((r.second - r.first + 63) / 64, 0);
+        it = lower_bound(it, passing.end(), r.first);
+        for(; it != passing.end() && *it < r.second; ++it){
+            const size_t i = *it - r.first;
+            bitmap[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        out.write(reinterpret_cast<const char*>(bitmap.data()), bitmap.size() * sizeof(uint64_t));
+    }
+    out.close();
+    if(!out){
+        unlink(tmpfilename.c_str());
+        throw runtime_error("SkimIndex: error writing '" + filename + "'");
+    }
+    if(rename(tmpfilename.c_str(), filename.c_str()) != 0){
+        unlink(tmpfilename.c_str());
+        throw runtime_error("SkimIndex: error renaming index file to '" + filename + "'");
+    }
+}
+
+bool SkimIndex::read(size_t & nentries, std::vector<size_t> & passing) const{
+    vector<pair<size_t, size_t>> ranges;
+    vector<size_t> all_passing;
+    ssize_t n = -1;
+    // glob fails for non-existing directories, which is the usual case for the first run:
+    if(access(basename.substr(0, basename.rfind('/')).c_str(), F_OK) != 0) return false;
+    for(const string & filename : glob(basename + "-*.part")){
+        ifstream in(filename, ios::binary);
+        char magic[sizeof(skim_magic)];
+        in.read(magic, sizeof(magic));
+        if(!in || !equal(magic, magic + sizeof(magic), skim_magic)){
+            throw runtime_error("SkimIndex: '" + filename + "' is not a valid index file");
+        }
+        const size_t part_nentries = read_u64(in);
+        if(n >= 0 && size_t(n) != part_nentries){
+            throw runtime_error("SkimIndex: inconsistent number of entries in '" + filename + "'");
+        }
+        n = part_nentries;
+        const size_t nranges = read_u64(in);
+        for(size_t ir=0; ir<nranges; ++ir){
+            const size_t first = read_u64(in);
+            const size_t last = read_u64(in);
+            vector<uint64_t> bitmap((last - first + 63) / 64);
+            in.read(reinterpret_cast<char*>(bitmap.data()), bitmap.size() * sizeof(uint64_t));
+            if(!in || last < first || last > part_nentries){
+                throw runtime_error("SkimIndex: '" + filename + "' is not a valid index file");
+            }
+            for(size_t i=0; i<last - first; ++i){
+                if(bitmap[i / 64] & (uint64_t(1) << (i % 64))){
+                    all_passing.push_back(first + i);
+                }
+            }
+            ranges.emplace_back(first, last);
+        }
+    }
+    if(n < 0) return false;
+    // check whether the ranges cover [0, n):
+    sort(ranges.begin(), ranges.end());
+    size_t covered = 0;
+    for(const auto & r : ranges){
+        if(r.first > covered) return false;
+        covered = max(covered, r.second);
+    }
+    if(covered < size_t(n)) return false;
+    // parts can overlap if ranges have been processed more than once, e.g. after failures:
+    sort(all_passing.begin(), all_passing.end());
+    all_passing.erase(unique(all_passing.begin(), all_passing.end()), all_passing.end());
+    nentries = n;
+    passing.swap(all_passing);
+    return true;
+}
+
+const ptree * ra::find_skim_index_cfg(const s_config & config){
+    for(const auto & module_cfg : config.modules_cfg){
+        if(ptree_get<string>(module_cfg.second, "type", "") != "Selections") continue;
+        auto skim_cfg = module_cfg.second.get_child_optional("skim_index");
+        if(skim_cfg && ptree_get<bool>(*skim_cfg, "use", false)){
+            return &module_cfg.second;
+        }
+    }
+    return nullptr;
+}
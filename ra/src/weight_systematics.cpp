@@ -0,0 +1,5 @@
+#include "weight_systematics.hpp"
+
+using namespace ra;
+
+const char * const weight_systematics::member_name = "weight_systematics";
@@ -3,13 +3,21 @@
 #include "ra/include/context.hpp"
 #include "ra/include/config.hpp"
 #include "ra/include/controller.hpp"
+#include "ra/include/selections.hpp"
+#include "ra/include/hists.hpp"
 #include "base/include/ptree-utils.hpp"
+#include "base/include/utils.hpp"
 
 #include <boost/test/unit_test.hpp>
 #include <fstream>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unistd.h>
 
 #include "TFile.h"
 #include "TTree.h"
+#include "TH1D.h"
 
 using namespace ra;
 using namespace std;
@@ -32,13 +40,16 @@ void create_test_tree(const string & filename, int i0, int nentries){
 }
 
 vector<int> ids_seen;
+mutex ids_seen_mutex; // test_module is called from several threads in the threads test
 
 class test_module: public ra::AnalysisModule {
 public:
     test_module(const ptree & cfg);
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out);
     virtual void process(Event & event);
+    virtual bool is_parallel_safe() const { return parallel_safe; }
 private:
+    bool parallel_safe;
     int offset;
     int outdata;
     Event::Handle<int> h_intdata;
@@ -47,6 +58,7 @@ private:
 
 test_module::test_module(const ptree & cfg){
     offset = ptree_get<int>(cfg, "offset", 0);
+    parallel_safe = ptree_get<bool>(cfg, "parallel_safe", true);
 }
 
 void test_module::begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
@@ -55,6 +67,7 @@ void test_module::begin_dataset(const s_dataset & dataset, InputManager & in, Ou
 
 void test_module::process(Event & event){
     int id = event.get(h_intdata);
+    lock_guard<mutex> lock(ids_seen_mutex);
     ids_seen.push_back(id);
 }
 
@@ -72,6 +85,104 @@ public:
 
 REGISTER_ANALYSIS_MODULE(test_module_copy)
 
+// select events with even intdata
+class test_even_selection: public Selection {
+public:
+    test_even_selection(const ptree & cfg, InputManager & in, OutputManager & out){
+        // intdata is declared as input by test_module
+        h_intdata = in.get_handle<int>("intdata");
+    }
+    virtual bool operator()(const Event & event){
+        return event.get(h_intdata) % 2 == 0;
+    }
+private:
+    Event::Handle<int> h_intdata;
+};
+
+REGISTER_SELECTION(test_even_selection)
+
+// sets the event weight to 1 + intdata % 4 and 'w2' to 0.5 + intdata % 3
+class test_weights: public ra::AnalysisModule {
+public:
+    test_weights(const ptree & cfg){}
+    virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
+        h_intdata = in.get_handle<int>("intdata");
+        h_weight = in.get_handle<double>("weight");
+        h_w2 = in.get_handle<double>("w2");
+    }
+    virtual void process(Event & event){
+        const int i = event.get(h_intdata);
+        event.set(h_weight, 1.0 + i % 4);
+        event.set(h_w2, 0.5 + i % 3);
+    }
+private:
+    Event::Handle<int> h_intdata;
+    Event::Handle<double> h_weight, h_w2;
+};
+
+REGISTER_ANALYSIS_MODULE(test_weights)
+
+// fills intdata % 10 and, via process, intdata % 5
+class test_intdata_hists: public Hists {
+public:
+    test_intdata_hists(const ptree & cfg, const std::string & dirname, const s_dataset & dataset, InputManager & in, OutputManager & out): Hists(dirname, dataset, out){
+        h_intdata = in.get_handle<int>("intdata");
+        h_weight = in.get_handle<double>("weight");
+        book_1d_autofill(h_intdata, [](int i){ return i % 10; }, "mod10", 10, 0.0, 10.0);
+        book<TH1D>("mod5", 5, 0.0, 5.0);
+    }
+    virtual void process(Event & event){
+        get("mod5")->Fill(event.get(h_intdata) % 5, event.get(h_weight));
+    }
+private:
+    Event::Handle<int> h_intdata;
+    Event::Handle<double> h_weight;
+};
+
+REGISTER_HISTS(test_intdata_hists)
+
+// computes 'derived' = 2 * intdata for intdata not divisible by 3, and declares it cacheable
+int derived_ncalls = 0;
+
+class test_derived: public ra::AnalysisModule {
+public:
+    test_derived(const ptree & cfg){}
+    virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
+        h_intdata = in.declare_event_input<int>("intdata");
+        h_derived = in.get_handle<int>("derived");
+    }
+    virtual void process(Event & event){
+        ++derived_ncalls;
+        int i = event.get(h_intdata);
+        if(i % 3 != 0){
+            event.set(h_derived, 2 * i);
+        }
+    }
+    virtual std::vector<cacheable_output> cacheable_outputs() const{
+        return {{&typeid(int), "derived"}};
+    }
+private:
+    Event::Handle<int> h_intdata, h_derived;
+};
+
+REGISTER_ANALYSIS_MODULE(test_derived)
+
+// records 'derived' in ids_seen, or -1 if it is not valid
+class test_derived_reader: public ra::AnalysisModule {
+public:
+    test_derived_reader(const ptree & cfg){}
+    virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
+        h_derived = in.get_handle<int>("derived");
+    }
+    virtual void process(Event & event){
+        ids_seen.push_back(event.get_state(h_derived) == Event::state::valid ? event.get(h_derived) : -1);
+    }
+private:
+    Event::Handle<int> h_derived;
+};
+
+REGISTER_ANALYSIS_MODULE(test_derived_reader)
+
 string maketempdir(){
     char pattern[] = "/tmp/tc.XXXXXX";
     char * result = mkdtemp(pattern);
@@ -114,6 +225,7 @@ BOOST_AUTO_TEST_CASE(simple){
        AnalysisController::ProcessStatistics s;
        ac.process(0, 1000, &s);
        BOOST_CHECK_GT(s.nbytes_read, 1000); // should be around 4000 ...
+       BOOST_CHECK_EQUAL(s.nallocations, 0); // only an int which is stored in the Event arena
     }
     // TODO: check for resource leaks (=open files)
     BOOST_REQUIRE_EQUAL(ids_seen.size(), 1000);
@@ -122,6 +234,220 @@ BOOST_AUTO_TEST_CASE(simple){
     }
 }
 
+BOOST_AUTO_TEST_CASE(batch){
+    const int offset = 1234;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    {
+    ofstream configstr(indir + "/cfg.cfg");
+    configstr << "options { batchsize 7 }\n"
+     "dataset {\n"
+     " name testdataset\n"
+     " treename events\n"
+     " file-pattern " << indir << "/*.root\n"
+     "}\n"
+     "modules { testm { type test_module } copy { type test_module_copy } }";
+    }
+    
+    s_config conf(indir + "/cfg.cfg");
+    BOOST_CHECK_EQUAL(conf.options.batchsize, 7);
+    
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       AnalysisController::ProcessStatistics s;
+       ac.process(10, 1000, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 990);
+       BOOST_CHECK_EQUAL(s.nallocations, 0);
+    }
+    BOOST_REQUIRE_EQUAL(ids_seen.size(), 990);
+    for(int i=0; i<990; ++i){
+        BOOST_CHECK_EQUAL(ids_seen[i], i + 10 + offset);
+    }
+    // all events should be written, in order:
+    TFile out((indir + "/out.root").c_str(), "read");
+    TTree * tree = dynamic_cast<TTree*>(out.Get("events"));
+    BOOST_REQUIRE(tree);
+    BOOST_REQUIRE_EQUAL(tree->GetEntries(), 990);
+    int id = -1;
+    tree->SetBranchAddress("intdata", &id);
+    for(int i=0; i<990; ++i){
+        tree->GetEntry(i);
+        BOOST_CHECK_EQUAL(id, offset + 10 + i);
+    }
+}
+
+// read ahead in the background, with lazy input to have reads from both threads; without and with batch processing.
+BOOST_AUTO_TEST_CASE(prefetch){
+    const int offset = 4321;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    for(int batchsize : {1, 7}){
+        {
+        ofstream configstr(indir + "/cfg.cfg");
+        configstr << "options { prefetch 13\n batchsize " << batchsize << " }\n"
+         "input { type root\n lazy true }\n"
+         "dataset {\n"
+         " name testdataset\n"
+         " treename events\n"
+         " file-pattern " << indir << "/*.root\n"
+         "}\n"
+         "modules { testm { type test_module } copy { type test_module_copy } }";
+        }
+        
+        s_config conf(indir + "/cfg.cfg");
+        BOOST_CHECK_EQUAL(conf.options.prefetch, 13);
+        
+        ids_seen.clear();
+        {
+           AnalysisController ac(conf, false);
+           ac.start_dataset(0, indir + "/out");
+           ac.start_file(0);
+           AnalysisController::ProcessStatistics s;
+           ac.process(10, 1000, &s);
+           BOOST_CHECK_EQUAL(s.nevents_survived, 990);
+           BOOST_CHECK_EQUAL(s.nbytes_read, 990 * sizeof(int));
+        }
+        BOOST_REQUIRE_EQUAL(ids_seen.size(), 990);
+        for(int i=0; i<990; ++i){
+            BOOST_CHECK_EQUAL(ids_seen[i], i + 10 + offset);
+        }
+        TFile out((indir + "/out.root").c_str(), "read");
+        TTree * tree = dynamic_cast<TTree*>(out.Get("events"));
+        BOOST_REQUIRE(tree);
+        BOOST_REQUIRE_EQUAL(tree->GetEntries(), 990);
+        int id = -1;
+        tree->SetBranchAddress("intdata", &id);
+        for(int i=0; i<990; ++i){
+            tree->GetEntry(i);
+            BOOST_CHECK_EQUAL(id, offset + 10 + i);
+        }
+    }
+}
+
+// HistFiller directories selected via the SelectionMask and with different 'weights', without and with batch processing:
+BOOST_AUTO_TEST_CASE(histfiller_selections){
+    const int offset = 2468;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    for(int batchsize : {1, 7}){
+        {
+        ofstream configstr(indir + "/cfg.cfg");
+        configstr << "options { batchsize " << batchsize << " }\n"
+         "dataset {\n"
+         " name testdataset\n"
+         " treename events\n"
+         " file-pattern " << indir << "/*.root\n"
+         "}\n"
+         "modules {\n"
+         "  testm { type test_module }\n"
+         "  weights { type test_weights }\n"
+         "  sels { type Selections \n even { type test_even_selection } \n odd { type AndNotSelection \n selections even } \n all { type PassallSelection } }\n"
+         "  histos { type HistFiller \n"
+         "     even { hists test_intdata_hists } \n"
+         "     odd { hists test_intdata_hists \n weights w2 } \n"
+         "     all { hists test_intdata_hists \n weights w2 } \n"
+         "     all_unweighted { selection all \n hists test_intdata_hists } \n"
+         "  }\n"
+         "}";
+        }
+        s_config conf(indir + "/cfg.cfg");
+        {
+           AnalysisController ac(conf, false);
+           ac.start_dataset(0, indir + "/out");
+           ac.start_file(0);
+           ac.process(0, 1000);
+        }
+        map<string, vector<double>> expected10, expected5;
+        for(const char * dir : {"even", "odd", "all", "all_unweighted"}){
+            expected10[dir].assign(12, 0.0);
+            expected5[dir].assign(7, 0.0);
+        }
+        for(int i=offset; i<offset + 1000; ++i){
+            const double weight = 1.0 + i % 4, w2 = 0.5 + i % 3;
+            vector<pair<string, double>> dir_weights = {{"all", weight * w2}, {"all_unweighted", weight}};
+            dir_weights.emplace_back(i % 2 == 0 ? "even" : "odd", i % 2 == 0 ? weight : weight * w2);
+            for(const auto & dw : dir_weights){
+                expected10[dw.first][1 + i % 10] += dw.second;
+                expected5[dw.first][1 + i % 5] += dw.second;
+            }
+        }
+        TFile out((indir + "/out.root").c_str(), "read");
+        for(const char * dir : {"even", "odd", "all", "all_unweighted"}){
+            TH1D * h10 = dynamic_cast<TH1D*>(out.Get((string(dir) + "/mod10").c_str()));
+            TH1D * h5 = dynamic_cast<TH1D*>(out.Get((string(dir) + "/mod5").c_str()));
+            BOOST_REQUIRE(h10);
+            BOOST_REQUIRE(h5);
+            for(int ibin=0; ibin<12; ++ibin){
+                BOOST_CHECK_CLOSE(h10->GetBinContent(ibin) + 1.0, expected10[dir][ibin] + 1.0, 1e-10);
+            }
+            for(int ibin=0; ibin<7; ++ibin){
+                BOOST_CHECK_CLOSE(h5->GetBinContent(ibin) + 1.0, expected5[dir][ibin] + 1.0, 1e-10);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(threads){
+    const int offset = 5678;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    for(bool parallel_safe : {false, true}){
+        ofstream configstr(indir + (parallel_safe ? "/cfg.cfg" : "/cfg-unsafe.cfg"));
+        configstr << "options { nthreads 3 }\n"
+         "dataset {\n"
+         " name testdataset\n"
+         " treename events\n"
+         " file-pattern " << indir << "/*.root\n"
+         "}\n"
+         "modules { testm { type test_module \n parallel_safe " << (parallel_safe ? "true" : "false") << " } copy { type test_module_copy } }";
+    }
+    
+    // each thread has its own module instances, so modules which are not parallel safe are not allowed:
+    s_config conf_unsafe(indir + "/cfg-unsafe.cfg");
+    BOOST_CHECK_THROW(AnalysisController(conf_unsafe, false), runtime_error);
+    
+    s_config conf(indir + "/cfg.cfg");
+    BOOST_CHECK_EQUAL(conf.options.nthreads, 3);
+    
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       // several calls of process re-use the same worker threads:
+       AnalysisController::ProcessStatistics s;
+       ac.process(0, 400, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 400);
+       ac.process(400, 1000, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 600);
+    }
+    BOOST_REQUIRE_EQUAL(ids_seen.size(), 1000);
+    sort(ids_seen.begin(), ids_seen.end());
+    for(int i=0; i<1000; ++i){
+        BOOST_CHECK_EQUAL(ids_seen[i], i + offset);
+    }
+    // the thread outputs are merged into out.root:
+    BOOST_CHECK(access((indir + "/out-thread1.root").c_str(), F_OK) != 0);
+    TFile out((indir + "/out.root").c_str(), "read");
+    TTree * tree = dynamic_cast<TTree*>(out.Get("events"));
+    BOOST_REQUIRE(tree);
+    BOOST_REQUIRE_EQUAL(tree->GetEntries(), 1000);
+    int id = -1;
+    tree->SetBranchAddress("intdata", &id);
+    vector<int> ids_written;
+    for(int i=0; i<1000; ++i){
+        tree->GetEntry(i);
+        ids_written.push_back(id);
+    }
+    sort(ids_written.begin(), ids_written.end());
+    for(int i=0; i<1000; ++i){
+        BOOST_CHECK_EQUAL(ids_written[i], i + offset);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(lazy){
     string indir = maketempdir();
     const int offset = 9824;
@@ -203,4 +529,262 @@ BOOST_AUTO_TEST_CASE(morefiles){
 }
 
 
+// the next file is opened in the background; switching to another file than the prepared one must work as well:
+BOOST_AUTO_TEST_CASE(preopen){
+    const int offset0 = 3461;
+    const int offset1 = 823554;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test0.root", offset0, 1000);
+    create_test_tree(indir + "/test1.root", offset1, 500);
+    {
+    ofstream configstr(indir + "/cfg.cfg");
+    configstr << "options {}\n"
+     "input { type root \n preopen true \n fadvise true }\n"
+     "dataset {\n"
+     " name testdataset\n"
+     " treename events\n"
+     " file-pattern " << indir << "/*.root\n"
+     "}\n"
+     "modules { testm { type test_module } }";
+    }
+    
+    s_config conf(indir + "/cfg.cfg");
+    
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       ac.process(0, 10);
+       ac.start_file(1);
+       BOOST_CHECK_EQUAL(ac.get_file_size(), 500);
+       ac.process(0, 10);
+       ac.start_file(0);
+       BOOST_CHECK_EQUAL(ac.get_file_size(), 1000);
+       ac.process(990, 1000);
+    }
+    BOOST_REQUIRE_EQUAL(ids_seen.size(), 30);
+    for(int i=0; i<10; ++i){
+        BOOST_CHECK_EQUAL(ids_seen[i], offset0 + i);
+        BOOST_CHECK_EQUAL(ids_seen[i + 10], offset1 + i);
+        BOOST_CHECK_EQUAL(ids_seen[i + 20], offset0 + 990 + i);
+    }
+}
+
+// process only an explicit list of entries, with read-ahead and a read cache, which then only reads the required baskets:
+BOOST_AUTO_TEST_CASE(entry_list){
+    const int offset = 7513;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    {
+    ofstream configstr(indir + "/cfg.cfg");
+    configstr << "options { prefetch 2 }\n"
+     "input { type root \n cache_size 100000 }\n"
+     "dataset {\n"
+     " name testdataset\n"
+     " treename events\n"
+     " file { path " << indir << "/test.root \n entries \"999 3 10 11 500\" }\n"
+     "}\n"
+     "modules { testm { type test_module } }";
+    }
+    
+    s_config conf(indir + "/cfg.cfg");
+    const auto & f = conf.datasets[0].files[0];
+    BOOST_REQUIRE(f.has_entries);
+    const vector<size_t> expected_entries = {3, 10, 11, 500, 999};
+    BOOST_REQUIRE(f.entries == expected_entries);
+    
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       BOOST_CHECK_THROW(ac.set_entry_list({5, 3}), invalid_argument);
+       BOOST_CHECK_THROW(ac.set_entry_list({3, 1000}), invalid_argument);
+       ac.set_entry_list(f.entries);
+       AnalysisController::ProcessStatistics s;
+       ac.process(0, 11, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 2);
+       ac.process(11, 1000, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 3);
+       ac.clear_entry_list();
+       ac.process(20, 22, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 2);
+    }
+    const vector<int> expected_ids = {offset + 3, offset + 10, offset + 11, offset + 500, offset + 999, offset + 20, offset + 21};
+    BOOST_CHECK_EQUAL_COLLECTIONS(ids_seen.begin(), ids_seen.end(), expected_ids.begin(), expected_ids.end());
+}
+
+// a first run writes the skim index, later runs only process the selected entries:
+BOOST_AUTO_TEST_CASE(skim_index){
+    const int offset = 4682;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    {
+    ofstream configstr(indir + "/cfg.cfg");
+    configstr << "options {}\n"
+     "dataset {\n"
+     " name testdataset\n"
+     " treename events\n"
+     " file-pattern " << indir << "/*.root\n"
+     "}\n"
+     "modules {\n"
+     "  sels { type Selections \n even { type test_even_selection } \n"
+     "     skim_index { selection even \n dir " << indir << "/skim \n use true } }\n"
+     "  testm { type test_module }\n"
+     "}";
+    }
+    
+    s_config conf(indir + "/cfg.cfg");
+    
+    // process only part of the file: the index is incomplete, so the next run has to process all events again:
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       ac.process(0, 400);
+    }
+    BOOST_CHECK_EQUAL(ids_seen.size(), 400);
+    
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       ac.process(400, 1000);
+    }
+    BOOST_CHECK_EQUAL(ids_seen.size(), 600);
+    
+    // now the index is complete:
+    ids_seen.clear();
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       AnalysisController::ProcessStatistics s;
+       ac.process(0, 1000, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 500);
+       ac.process(101, 106, &s);
+       BOOST_CHECK_EQUAL(s.nevents_survived, 2);
+    }
+    BOOST_REQUIRE_EQUAL(ids_seen.size(), 502);
+    for(size_t i=0; i<500; ++i){
+        BOOST_CHECK_EQUAL((ids_seen[i] - offset) % 2, 0);
+    }
+    BOOST_CHECK_EQUAL(ids_seen[500], offset + 102);
+    BOOST_CHECK_EQUAL(ids_seen[501], offset + 104);
+}
+
+// the first complete run writes the outputs of test_derived to the cache; later runs read them from there instead of calling it:
+BOOST_AUTO_TEST_CASE(derived_cache){
+    const int offset = 3318;
+    string indir = maketempdir();
+    create_test_tree(indir + "/test.root", offset, 1000);
+    {
+    ofstream configstr(indir + "/cfg.cfg");
+    configstr << "options { derived_cache_dir " << indir << "/derived }\n"
+     "dataset {\n"
+     " name testdataset\n"
+     " treename events\n"
+     " file-pattern " << indir << "/*.root\n"
+     "}\n"
+     "modules {\n"
+     "  derived { type test_derived }\n"
+     "  reader { type test_derived_reader }\n"
+     "}";
+    }
+    
+    s_config conf(indir + "/cfg.cfg");
+    vector<int> expected_ids;
+    for(int i=0; i<1000; ++i){
+        const int id = offset + i;
+        expected_ids.push_back(id % 3 == 0 ? -1 : 2 * id);
+    }
+    
+    // entries not processed in order do not create a cache:
+    derived_ncalls = 0;
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       ac.process(500, 1000);
+       ac.process(0, 500);
+    }
+    BOOST_CHECK_EQUAL(derived_ncalls, 1000);
+    BOOST_CHECK_EQUAL(glob(indir + "/derived/*").size(), 0);
+    
+    for(int irun=0; irun<2; ++irun){
+        ids_seen.clear();
+        derived_ncalls = 0;
+        {
+           AnalysisController ac(conf, false);
+           ac.start_dataset(0, indir + "/out");
+           ac.start_file(0);
+           ac.process(0, 600);
+           ac.process(600, 1000);
+        }
+        BOOST_CHECK_EQUAL(derived_ncalls, irun == 0 ? 1000 : 0);
+        BOOST_CHECK_EQUAL(glob(indir + "/derived/*").size(), 1);
+        BOOST_CHECK_EQUAL_COLLECTIONS(ids_seen.begin(), ids_seen.end(), expected_ids.begin(), expected_ids.end());
+    }
+}
+
+// files with and without cache in the same dataset: file 1 is never processed completely, so it has no cache, while files 0 and 2 have one:
+BOOST_AUTO_TEST_CASE(derived_cache_mixed){
+    const int offsets[] = {3318, 72214, 5560};
+    string indir = maketempdir();
+    for(int ifile=0; ifile<3; ++ifile){
+        create_test_tree(indir + "/test" + to_string(ifile) + ".root", offsets[ifile], 1000);
+    }
+    {
+    ofstream configstr(indir + "/cfg.cfg");
+    configstr << "options { derived_cache_dir " << indir << "/derived }\n"
+     "dataset {\n"
+     " name testdataset\n"
+     " treename events\n"
+     " file-pattern " << indir << "/*.root\n"
+     "}\n"
+     "modules {\n"
+     "  derived { type test_derived }\n"
+     "  reader { type test_derived_reader }\n"
+     "}";
+    }
+    
+    s_config conf(indir + "/cfg.cfg");
+    vector<int> expected_ids;
+    for(int ifile=0; ifile<3; ++ifile){
+        for(int i=0; i<1000; ++i){
+            const int id = offsets[ifile] + i;
+            expected_ids.push_back(id % 3 == 0 ? -1 : 2 * id);
+        }
+    }
+    
+    derived_ncalls = 0;
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       ac.start_file(0);
+       ac.process(0, 1000);
+       ac.start_file(2);
+       ac.process(0, 1000);
+    }
+    BOOST_CHECK_EQUAL(derived_ncalls, 2000);
+    BOOST_REQUIRE_EQUAL(glob(indir + "/derived/*").size(), 2);
+    
+    // cached -> uncached -> cached in the same InputManager:
+    ids_seen.clear();
+    derived_ncalls = 0;
+    {
+       AnalysisController ac(conf, false);
+       ac.start_dataset(0, indir + "/out");
+       for(int ifile=0; ifile<3; ++ifile){
+           ac.start_file(ifile);
+           ac.process(0, 1000);
+       }
+    }
+    BOOST_CHECK_EQUAL(derived_ncalls, 1000);
+    BOOST_CHECK_EQUAL_COLLECTIONS(ids_seen.begin(), ids_seen.end(), expected_ids.begin(), expected_ids.end());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
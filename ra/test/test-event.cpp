@@ -1,11 +1,19 @@
 #include <boost/test/unit_test.hpp>
 
 #include "event.hpp"
+#include "eventbatch.hpp"
 #include "context-backend.hpp"
+#include "root-utils.hpp"
 #include "config.hpp"
 #include "TFile.h"
 #include "TTree.h"
 #include "TH1D.h"
+#include "TLorentzVector.h"
+
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include <glob.h>
 
 using namespace ra;
 using namespace std;
@@ -13,7 +21,7 @@ using namespace std;
 
 namespace {
 
-int make_test_tree(const char * filename){
+int make_test_tree(const char * filename, int offset = 0){
     TFile f(filename, "recreate");
     TTree * tree = new TTree("test", "test");
     int i;
@@ -24,8 +32,8 @@ int make_test_tree(const char * filename){
     tree->Branch("doubledata", &d, "doubledata/D");
     tree->Branch("floats", &pfloats);
     for(int k=0; k<100; ++k){
-        i = k+1;
-        d = 100. + k;
+        i = k+1 + offset;
+        d = 100. + k + offset;
         floats = {0.3f + k, 0.4f + k, k - 1000.f};
         tree->Fill();
     }
@@ -35,6 +43,7 @@ int make_test_tree(const char * filename){
 }
 
 int dummy = make_test_tree("tree.root");
+int dummy2 = make_test_tree("tree-offset.root", 1000);
 }
 
 
@@ -109,6 +118,43 @@ BOOST_AUTO_TEST_CASE(addresses){
     BOOST_CHECK_EQUAL(&(e.get(h)), &idata);
 }
 
+// small trivial types are stored in the arena, others out-of-line:
+BOOST_AUTO_TEST_CASE(inline_storage){
+    EventStructure es;
+    auto h_b = es.get_handle<bool>("b");
+    auto h_d = es.get_handle<double>("d");
+    auto h_i = es.get_handle<int>("i");
+    auto h_v = es.get_handle<vector<int>>("v");
+    auto hraw_f = es.get_raw_handle(typeid(float), "f"); // no layout information: out-of-line
+    BOOST_CHECK_EQUAL(es.layout().size, sizeof(double) + sizeof(int) + sizeof(bool));
+
+    Event e(es);
+    BOOST_CHECK_EQUAL(e.get_state(h_i), Event::state::nonexistent);
+    e.set(h_b, true);
+    e.set(h_d, 1.5);
+    e.set(h_i, 3);
+    e.set(h_v, vector<int>{1, 2});
+    BOOST_CHECK(e.get(h_b));
+    BOOST_CHECK_EQUAL(e.get(h_d), 1.5);
+    BOOST_CHECK_EQUAL(e.get(h_i), 3);
+    BOOST_CHECK_EQUAL(e.get(h_v).size(), 2u);
+
+    // the inline members are placed next to each other (largest alignment first):
+    const char * pd = reinterpret_cast<const char*>(&e.get(h_d));
+    BOOST_CHECK_EQUAL(reinterpret_cast<const char*>(&e.get(h_i)), pd + sizeof(double));
+    BOOST_CHECK_EQUAL(reinterpret_cast<const char*>(&e.get(h_b)), pd + sizeof(double) + sizeof(int));
+
+    // set_inline only works for inline members:
+    Event e2(es);
+    void * pi = e2.set_inline(typeid(int), EventStructure::HandleAccess_::create_raw_handle(h_i));
+    BOOST_REQUIRE(pi != nullptr);
+    BOOST_CHECK_EQUAL(e2.get_state(h_i), Event::state::invalid);
+    BOOST_CHECK_EQUAL(e2.get(h_i, false), 0);
+    BOOST_CHECK_THROW(e2.set_inline(typeid(int), EventStructure::HandleAccess_::create_raw_handle(h_i)), std::invalid_argument);
+    BOOST_CHECK(e2.set_inline(typeid(float), hraw_f) == nullptr);
+    BOOST_CHECK_EQUAL(e2.get_state(EventStructure::HandleAccess_::create_handle<float>(hraw_f)), Event::state::nonexistent);
+}
+
 // check that getting handles with same name/type is the same:
 BOOST_AUTO_TEST_CASE(handles){
     EventStructure es;
@@ -158,6 +204,95 @@ BOOST_AUTO_TEST_CASE(unset){
 }
 
 
+BOOST_AUTO_TEST_CASE(invalidate_all){
+    EventStructure es;
+    auto h_i = es.get_handle<int>("i");
+    auto h_d = es.get_handle<double>("d");
+    auto h_unset = es.get_handle<float>("unset");
+
+    Event e(es);
+    e.set(h_i, 1);
+    e.set(h_d, 2.0);
+    const int * iptr = &e.get(h_i);
+
+    for(int k=0; k<3; ++k){
+        e.invalidate_all();
+        BOOST_CHECK_EQUAL(e.get_state(h_i), Event::state::invalid);
+        BOOST_CHECK_EQUAL(e.get_state(h_d), Event::state::invalid);
+        BOOST_CHECK_EQUAL(e.get_state(h_unset), Event::state::nonexistent);
+        BOOST_CHECK_THROW(e.get(h_i), std::runtime_error);
+
+        // setting one member again only makes this one valid:
+        e.set(h_i, k);
+        BOOST_CHECK_EQUAL(e.get_state(h_i), Event::state::valid);
+        BOOST_CHECK_EQUAL(e.get_state(h_d), Event::state::invalid);
+        BOOST_CHECK_EQUAL(e.get(h_i), k);
+        BOOST_CHECK_EQUAL(&e.get(h_i), iptr);
+
+        e.set_validity(h_d, true);
+        BOOST_CHECK_EQUAL(e.get(h_d), 2.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(recycle){
+    EventStructure es;
+    auto h = es.get_handle<vector<int>>("v");
+    auto h_i = es.get_handle<int>("i");
+
+    Event e(es);
+    BOOST_CHECK_EQUAL(e.nallocations(), 0u);
+    vector<int> & v0 = e.recycle(h);
+    BOOST_CHECK_EQUAL(e.get_state(h), Event::state::valid);
+    BOOST_CHECK(v0.empty());
+    e.recycle(h_i) = 3; // inline: no allocation
+    BOOST_CHECK_EQUAL(e.nallocations(), 1u);
+    v0.assign(100, 1);
+    const int * data = v0.data();
+
+    for(int k=0; k<10; ++k){
+        e.invalidate_all();
+        vector<int> & v = e.recycle(h);
+        BOOST_CHECK_EQUAL(&v, &v0);
+        // content is kept until cleared; capacity is kept after clear:
+        BOOST_CHECK_EQUAL(v.size(), 100u);
+        v.clear();
+        v.resize(100, k);
+        BOOST_CHECK_EQUAL(v.data(), data);
+        BOOST_CHECK_EQUAL(e.get(h)[99], k);
+    }
+    BOOST_CHECK_EQUAL(e.nallocations(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(batch){
+    EventStructure es;
+    auto h = es.get_handle<double>("d");
+    BOOST_CHECK_THROW(EventBatch(es, 0), invalid_argument);
+    EventBatch batch(es, 5);
+    BOOST_CHECK_EQUAL(batch.capacity(), 5u);
+    BOOST_CHECK_THROW(batch.reset(6), invalid_argument);
+    batch.reset(4);
+    BOOST_CHECK_EQUAL(batch.size(), 4u);
+    BOOST_CHECK_EQUAL(batch.nactive(), 4u);
+    for(size_t i=0; i<batch.size(); ++i){
+        batch.event(i).set(h, 1.5 * i);
+    }
+    batch.deactivate(1);
+    BOOST_CHECK(!batch.is_active(1));
+    BOOST_CHECK_EQUAL(batch.nactive(), 3u);
+    auto d = batch.get_column(h);
+    BOOST_REQUIRE_EQUAL(d.size(), 4u);
+    BOOST_CHECK_EQUAL(d[0], 0.0);
+    BOOST_CHECK_EQUAL(d[3], 4.5);
+    
+    // reset invalidates all members and activates all events again:
+    batch.reset(2);
+    BOOST_CHECK_EQUAL(batch.nactive(), 2u);
+    BOOST_CHECK(batch.is_active(1));
+    BOOST_CHECK(!batch.is_active(2));
+    BOOST_CHECK_EQUAL(batch.event(0).get_state(h), Event::state::invalid);
+    BOOST_CHECK_THROW(batch.get_column(h), runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(get_callback){
     EventStructure es;
     auto h = es.get_handle<int>("itest");
@@ -236,6 +371,218 @@ BOOST_AUTO_TEST_CASE(read_lazy){
     BOOST_CHECK_EQUAL(in->nbytes_read(), size_t(100) * sizeof(int));
 }
 
+BOOST_AUTO_TEST_CASE(read_prune){
+    const char * profile_filename = "prune-profile.txt";
+    unlink(profile_filename);
+    EventStructure es;
+    ptree cfg;
+    cfg.add_child("prune", ptree("true"));
+    cfg.add_child("prune_nevents", ptree("10"));
+    cfg.add_child("prune_profile", ptree(profile_filename));
+    auto in = InputManagerBackendRegistry::build("root", es, cfg);
+    in->declare_event_input<int>("intdata");
+    in->declare_event_input<double>("doubledata");
+    Event event(es);
+    auto h_intdata = in->get_handle<int>("intdata");
+    auto h_doubledata = in->get_handle<double>("doubledata");
+    in->setup_input_file(event, "test", "tree.root");
+    // only access intdata: doubledata should not be read at all:
+    for(int i=0; i<100; ++i){
+        event.invalidate_all();
+        in->read_event(event, i);
+        BOOST_CHECK_EQUAL(event.get(h_intdata), i+1);
+    }
+    BOOST_CHECK_EQUAL(in->nbytes_read(), size_t(100) * sizeof(int));
+    {
+        ifstream profile(profile_filename);
+        BOOST_REQUIRE(profile);
+        string content((istreambuf_iterator<char>(profile)), istreambuf_iterator<char>());
+        BOOST_CHECK(content.find("intdata eager") != string::npos);
+        BOOST_CHECK(content.find("doubledata disabled") != string::npos);
+    }
+    // reading a disabled branch should still work:
+    event.invalidate_all();
+    in->read_event(event, 50);
+    BOOST_CHECK_EQUAL(event.get(h_doubledata), 150.0);
+    
+    // a new input manager should use the profile right away:
+    EventStructure es2;
+    auto in2 = InputManagerBackendRegistry::build("root", es2, cfg);
+    in2->declare_event_input<int>("intdata");
+    in2->declare_event_input<double>("doubledata");
+    Event event2(es2);
+    auto h_intdata2 = in2->get_handle<int>("intdata");
+    in2->setup_input_file(event2, "test", "tree.root");
+    event2.invalidate_all();
+    in2->read_event(event2, 3);
+    BOOST_CHECK_EQUAL(event2.get_state(h_intdata2), Event::state::valid); // read eagerly
+    BOOST_CHECK_EQUAL(event2.get(h_intdata2), 4);
+    BOOST_CHECK_EQUAL(in2->nbytes_read(), sizeof(int));
+}
+
+// switch between files with the same and with different layout:
+BOOST_AUTO_TEST_CASE(read_switch_files){
+    {
+        TFile f("tree-other.root", "recreate");
+        TTree * tree = new TTree("test", "test");
+        int i;
+        double d;
+        float extra = 0.0f;
+        tree->Branch("extra", &extra, "extra/F");
+        tree->Branch("doubledata", &d, "doubledata/D");
+        tree->Branch("intdata", &i, "intdata/I");
+        for(int k=0; k<50; ++k){
+            i = -k;
+            d = -100. - k;
+            tree->Fill();
+        }
+        tree->Write();
+        delete tree;
+    }
+    EventStructure es;
+    auto in = InputManagerBackendRegistry::build("root", es, ptree());
+    in->declare_event_input<int>("intdata");
+    in->declare_event_input<double>("doubledata");
+    Event event(es);
+    auto h_intdata = in->get_handle<int>("intdata");
+    auto h_doubledata = in->get_handle<double>("doubledata");
+    TFile f1("tree.root", "read"), f2("tree-offset.root", "read"), f3("tree-other.root", "read");
+    auto t1 = dynamic_cast<TTree*>(f1.Get("test")), t2 = dynamic_cast<TTree*>(f2.Get("test")), t3 = dynamic_cast<TTree*>(f3.Get("test"));
+    BOOST_REQUIRE(t1 && t2 && t3);
+    BOOST_CHECK_EQUAL(InTree::layout_fingerprint(t1), InTree::layout_fingerprint(t2));
+    BOOST_CHECK_NE(InTree::layout_fingerprint(t1), InTree::layout_fingerprint(t3));
+    const char * filenames[] = {"tree.root", "tree-offset.root", "tree-other.root", "tree.root"};
+    for(const char * filename : filenames){
+        const int offset = filename == string("tree-offset.root") ? 1000 : 0;
+        const bool other = filename == string("tree-other.root");
+        size_t nentries = in->setup_input_file(event, "test", filename);
+        BOOST_REQUIRE_EQUAL(nentries, other ? 50u : 100u);
+        for(size_t i=0; i<nentries; ++i){
+            event.invalidate_all();
+            in->read_event(event, i);
+            if(other){
+                BOOST_CHECK_EQUAL(event.get(h_intdata), -int(i));
+                BOOST_CHECK_EQUAL(event.get(h_doubledata), -100.0 - i);
+            }
+            else{
+                BOOST_CHECK_EQUAL(event.get(h_intdata), int(i) + 1 + offset);
+                BOOST_CHECK_EQUAL(event.get(h_doubledata), 100.0 + i + offset);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(read_cache){
+    EventStructure es;
+    ptree cfg;
+    cfg.add_child("cache_size", ptree("1000000"));
+    auto in = InputManagerBackendRegistry::build("root", es, cfg);
+    in->declare_event_input<int>("intdata");
+    in->declare_event_input<double>("doubledata");
+    Event event(es);
+    auto h_intdata = in->get_handle<int>("intdata");
+    auto h_doubledata = in->get_handle<double>("doubledata");
+    in->setup_input_file(event, "test", "tree.root");
+    in->get_io_statistics(); // reset the counts from opening the file
+    for(int i=0; i<100; ++i){
+        event.invalidate_all();
+        in->read_event(event, i);
+        BOOST_CHECK_EQUAL(event.get(h_intdata), i+1);
+        BOOST_CHECK_EQUAL(event.get(h_doubledata), i + 100.0);
+    }
+    auto io = in->get_io_statistics();
+    BOOST_CHECK_GT(io.nreadcalls, 0u);
+    BOOST_CHECK_GT(io.nbytes_file, 0u);
+    // all baskets should be read via the cache:
+    BOOST_CHECK_GT(io.ncache_hits, 0u);
+    BOOST_CHECK_EQUAL(io.ncache_misses, 0u);
+    // statistics are reported only once:
+    io = in->get_io_statistics();
+    BOOST_CHECK_EQUAL(io.nreadcalls, 0u);
+    BOOST_CHECK_EQUAL(io.ncache_hits, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(read_parallel_unzip){
+    EventStructure es;
+    ptree cfg;
+    cfg.add_child("cache_size", ptree("1000000"));
+    cfg.add_child("parallel_unzip", ptree("true"));
+    auto in = InputManagerBackendRegistry::build("root", es, cfg);
+    in->declare_event_input<int>("intdata");
+    in->declare_event_input<vector<float>>("floats");
+    Event event(es);
+    auto h_intdata = in->get_handle<int>("intdata");
+    auto h_floats = in->get_handle<vector<float>>("floats");
+    in->setup_input_file(event, "test", "tree.root");
+    for(int i=0; i<100; ++i){
+        event.invalidate_all();
+        in->read_event(event, i);
+        BOOST_CHECK_EQUAL(event.get(h_intdata), i+1);
+        const auto & floats = event.get(h_floats);
+        BOOST_REQUIRE_EQUAL(floats.size(), 3u);
+        BOOST_CHECK_EQUAL(floats[2], i - 1000.f);
+    }
+    // all baskets are decompressed via the cache, either in advance or when needed:
+    auto io = in->get_io_statistics();
+    BOOST_CHECK_GT(io.nunzip_found + io.nunzip_missed, 0u);
+    
+    // parallel unzipping requires a cache:
+    ptree cfg_nocache;
+    cfg_nocache.add_child("parallel_unzip", ptree("true"));
+    BOOST_CHECK_THROW(InputManagerBackendRegistry::build("root", es, cfg_nocache), std::invalid_argument);
+}
+
+// read via the column cache: the first pass creates the cache, the second reads from it.
+BOOST_AUTO_TEST_CASE(read_colcache){
+    char dirpattern[] = "/tmp/colcache.XXXXXX";
+    BOOST_REQUIRE(mkdtemp(dirpattern));
+    for(int pass=0; pass<2; ++pass){
+        for(bool lazy : {false, true}){
+            EventStructure es;
+            ptree cfg;
+            cfg.add_child("cache_dir", ptree(dirpattern));
+            cfg.add_child("lazy", ptree(lazy ? "true" : "false"));
+            auto in = InputManagerBackendRegistry::build("colcache", es, cfg);
+            in->declare_event_input<int>("intdata");
+            in->declare_event_input<vector<float>>("floats");
+            Event event(es);
+            auto h_intdata = in->get_handle<int>("intdata");
+            auto h_floats = in->get_handle<vector<float>>("floats");
+            size_t nentries = in->setup_input_file(event, "test", "tree.root");
+            BOOST_REQUIRE_EQUAL(nentries, size_t(100));
+            for(int i=0; i<100; ++i){
+                event.invalidate_all();
+                in->read_event(event, i);
+                BOOST_CHECK_EQUAL(event.get(h_intdata), i+1);
+                const auto & floats = event.get(h_floats);
+                BOOST_REQUIRE_EQUAL(floats.size(), 3u);
+                BOOST_CHECK_EQUAL(floats[2], i - 1000.f);
+            }
+            BOOST_CHECK_GT(in->nbytes_read(), size_t(100) * sizeof(int));
+        }
+    }
+    // reading with the wrong type should fail:
+    EventStructure es;
+    ptree cfg;
+    cfg.add_child("cache_dir", ptree(dirpattern));
+    auto in = InputManagerBackendRegistry::build("colcache", es, cfg);
+    in->declare_event_input<double>("intdata");
+    Event event(es);
+    BOOST_CHECK_THROW(in->setup_input_file(event, "test", "tree.root"), std::runtime_error);
+
+    // a truncated column file should be detected when opening it, not when reading beyond its end:
+    glob_t g;
+    BOOST_REQUIRE_EQUAL(glob((string(dirpattern) + "/*/test/floats").c_str(), 0, 0, &g), 0);
+    BOOST_REQUIRE_EQUAL(g.gl_pathc, 1u);
+    BOOST_REQUIRE_EQUAL(truncate(g.gl_pathv[0], 100), 0);
+    globfree(&g);
+    EventStructure es2;
+    auto in2 = InputManagerBackendRegistry::build("colcache", es2, cfg);
+    in2->declare_event_input<vector<float>>("floats");
+    Event event2(es2);
+    BOOST_CHECK_THROW(in2->setup_input_file(event2, "test", "tree.root"), std::runtime_error);
+}
+
 // use inputmanager to read data without using an Event
 /*
 BOOST_AUTO_TEST_CASE(read_noevent){
@@ -252,6 +599,79 @@ BOOST_AUTO_TEST_CASE(read_noevent){
     }
 }*/
 
+// weight systematics are declared per InputManager, and the flag returned on declaration is set once they are used:
+BOOST_AUTO_TEST_CASE(weight_systematics_used){
+    EventStructure es;
+    auto in = InputManagerBackendRegistry::build("root", es, ptree());
+    const bool & used = in->declare_weight_systematic("sf1");
+    in->declare_weight_systematic("sf2");
+    BOOST_CHECK_EQUAL(&in->declare_weight_systematic("sf1"), &used);
+    BOOST_CHECK(!used);
+    in->use_weight_systematic("sf1");
+    BOOST_CHECK(used);
+    BOOST_CHECK_THROW(in->use_weight_systematic("sf3"), std::runtime_error);
+    
+    EventStructure es2;
+    auto in2 = InputManagerBackendRegistry::build("root", es2, ptree());
+    BOOST_CHECK_THROW(in2->use_weight_systematic("sf1"), std::runtime_error);
+}
+
+// declare_partial_input only reads the given data members, unless the branch is also declared completely:
+BOOST_AUTO_TEST_CASE(read_partial){
+    {
+        TFile f("tree_partial.root", "recreate");
+        TTree * tree = new TTree("events", "events");
+        TLorentzVector cand;
+        TLorentzVector * pcand = &cand;
+        tree->Branch("cand", "TLorentzVector", &pcand, 32000, 99);
+        for(int k=0; k<100; ++k){
+            cand.SetPxPyPzE(0.1 * k, 0.2 * k, 0.3 * k, 0.5 * k);
+            tree->Fill();
+        }
+        tree->Write();
+        delete tree;
+    }
+    // declare: 0 = complete, 1 = only partial, 2 = partial and complete, 3 = complete and partial
+    size_t nbytes[4];
+    for(int declare=0; declare<4; ++declare){
+        EventStructure es;
+        auto in = InputManagerBackendRegistry::build("root", es, ptree());
+        Event::Handle<TLorentzVector> h_cand;
+        if(declare == 3){
+            h_cand = in->declare_event_input<TLorentzVector>("cand");
+        }
+        if(declare > 0){
+            h_cand = in->declare_partial_input<TLorentzVector>("cand", {"fE"});
+        }
+        if(declare != 1){
+            h_cand = in->declare_event_input<TLorentzVector>("cand");
+        }
+        Event event(es);
+        BOOST_REQUIRE_EQUAL(in->setup_input_file(event, "events", "tree_partial.root"), size_t(100));
+        for(int i=0; i<100; ++i){
+            event.invalidate_all();
+            in->read_event(event, i);
+            const auto & cand = event.get(h_cand);
+            BOOST_CHECK_EQUAL(cand.E(), 0.5 * i);
+            if(declare != 1){
+                BOOST_CHECK_EQUAL(cand.Px(), 0.1 * i);
+            }
+        }
+        nbytes[declare] = in->nbytes_read();
+    }
+    BOOST_CHECK_LT(nbytes[1], nbytes[0]);
+    BOOST_CHECK_EQUAL(nbytes[2], nbytes[0]);
+    BOOST_CHECK_EQUAL(nbytes[3], nbytes[0]);
+    
+    // declaring the same branch again is fine, but not for another Event member:
+    EventStructure es;
+    auto in = InputManagerBackendRegistry::build("root", es, ptree());
+    in->declare_event_input<int>("intdata");
+    in->declare_event_input<int>("intdata");
+    BOOST_CHECK_THROW(in->declare_event_input<int>("intdata", "other_intdata"), std::invalid_argument);
+    BOOST_CHECK_THROW(in->declare_partial_input<TLorentzVector>("cand", {}), std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_CASE(read_wrong_type){
     // it should not work to read intdata as double:
     EventStructure es;
@@ -267,7 +687,7 @@ BOOST_AUTO_TEST_CASE(read_wrong_type){
 BOOST_AUTO_TEST_CASE(outtree){
     { // create output file:
     EventStructure es;
-    auto out = OutputManagerBackendRegistry::build("root", es, "eventtree", "out");
+    auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "out");
     auto h_my_int = out->declare_event_output<int>("my_int");
     Event event(es);
     for(int i=0; i<100; ++i){
@@ -292,12 +712,146 @@ BOOST_AUTO_TEST_CASE(outtree){
 }
 
 
+// write the event tree via the writer thread, with fewer queue slots than events:
+BOOST_AUTO_TEST_CASE(outtree_async){
+    {
+    EventStructure es;
+    ptree cfg;
+    cfg.add_child("write_queue", ptree("4"));
+    auto out = OutputManagerBackendRegistry::build("root", es, cfg, "eventtree", "out_async");
+    auto h_my_int = out->declare_event_output<int>("my_int");
+    auto h_my_floats = out->declare_event_output<vector<float>>("my_floats");
+    Event event(es);
+    for(int i=0; i<100; ++i){
+        event.set(h_my_int, i);
+        event.set(h_my_floats, vector<float>(i % 5, float(i)));
+        out->write_event(event);
+    }
+    out->close();
+    }
+    
+    EventStructure es;
+    ptree cfg;
+    auto in = InputManagerBackendRegistry::build("root", es, cfg);
+    auto h_my_int = in->declare_event_input<int>("my_int");
+    auto h_my_floats = in->declare_event_input<vector<float>>("my_floats");
+    Event inevent(es);
+    size_t nevents = in->setup_input_file(inevent, "eventtree", "out_async.root");
+    BOOST_REQUIRE_EQUAL(nevents, size_t(100));
+    for(int i=0; i<100; ++i){
+        in->read_event(inevent, i);
+        BOOST_CHECK_EQUAL(inevent.get(h_my_int), i);
+        const auto & floats = inevent.get(h_my_floats);
+        BOOST_REQUIRE_EQUAL(floats.size(), size_t(i % 5));
+        for(float f : floats){
+            BOOST_CHECK_EQUAL(f, float(i));
+        }
+    }
+}
+
+// batch processing: write from and read into several Event containers, which copies the members via staging objects / read buffers
+// instead of re-setting the branch addresses for each event:
+BOOST_AUTO_TEST_CASE(outtree_batch){
+    const size_t batchsize = 3;
+    {
+    EventStructure es;
+    auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "out_batch");
+    auto h_my_int = out->declare_event_output<int>("my_int");
+    auto h_my_floats = out->declare_event_output<vector<float>>("my_floats");
+    EventBatch batch(es, batchsize);
+    for(int i=0; i<100; ++i){
+        Event & event = batch.event(i % batchsize);
+        event.set(h_my_int, i);
+        event.set(h_my_floats, vector<float>(i % 5, float(i)));
+        out->write_event(event);
+    }
+    out->close();
+    }
+    
+    for(bool lazy : {false, true}){
+        EventStructure es;
+        ptree cfg;
+        cfg.add_child("lazy", ptree(lazy ? "true" : "false"));
+        auto in = InputManagerBackendRegistry::build("root", es, cfg);
+        auto h_my_int = in->declare_event_input<int>("my_int");
+        auto h_my_floats = in->declare_event_input<vector<float>>("my_floats");
+        EventBatch batch(es, batchsize);
+        size_t nevents = in->setup_input_file(batch.event(0), "eventtree", "out_batch.root");
+        for(size_t k=1; k<batchsize; ++k){
+            in->add_input_event(batch.event(k));
+        }
+        BOOST_REQUIRE_EQUAL(nevents, size_t(100));
+        for(int i0=0; i0<100; i0 += batchsize){
+            const int n = min<int>(batchsize, 100 - i0);
+            batch.reset(n);
+            for(int k=0; k<n; ++k){
+                in->read_event(batch.event(k), i0 + k);
+            }
+            // access in reverse order, so that lazy reads alternate between the Events:
+            for(int k=n-1; k>=0; --k){
+                const int i = i0 + k;
+                BOOST_CHECK_EQUAL(batch.event(k).get(h_my_int), i);
+                const auto & floats = batch.event(k).get(h_my_floats);
+                BOOST_REQUIRE_EQUAL(floats.size(), size_t(i % 5));
+                for(float f : floats){
+                    BOOST_CHECK_EQUAL(f, float(i));
+                }
+            }
+        }
+    }
+}
+
+// roll over to a new chunk file every 30 events, with and without writer thread:
+BOOST_AUTO_TEST_CASE(outtree_rollover){
+    for(int write_queue : {0, 4}){
+        {
+        EventStructure es;
+        ptree cfg;
+        cfg.add_child("rollover_events", ptree("30"));
+        cfg.add_child("write_queue", ptree(std::to_string(write_queue)));
+        auto out = OutputManagerBackendRegistry::build("root", es, cfg, "eventtree", "out_rollover");
+        auto h_my_int = out->declare_event_output<int>("my_int");
+        auto h_my_floats = out->declare_event_output<vector<float>>("my_floats");
+        Event event(es);
+        for(int i=0; i<100; ++i){
+            event.set(h_my_int, i);
+            event.set(h_my_floats, vector<float>(i % 5, float(i)));
+            out->write_event(event);
+        }
+        out->close();
+        }
+        
+        auto chunks = read_manifest(manifest_filename("out_rollover.root"));
+        BOOST_REQUIRE_EQUAL(chunks.size(), 4u);
+        EventStructure es;
+        auto in = InputManagerBackendRegistry::build("root", es, ptree());
+        auto h_my_int = in->declare_event_input<int>("my_int");
+        auto h_my_floats = in->declare_event_input<vector<float>>("my_floats");
+        Event inevent(es);
+        int i = 0;
+        for(const auto & chunk : chunks){
+            size_t nevents = in->setup_input_file(inevent, "eventtree", chunk.filename);
+            BOOST_REQUIRE_EQUAL(nevents, chunk.nentries);
+            BOOST_CHECK_EQUAL(nevents, i < 90 ? 30u : 10u);
+            for(size_t k=0; k<nevents; ++k, ++i){
+                in->read_event(inevent, k);
+                BOOST_CHECK_EQUAL(inevent.get(h_my_int), i);
+                BOOST_CHECK_EQUAL(inevent.get(h_my_floats).size(), size_t(i % 5));
+            }
+        }
+        BOOST_CHECK_EQUAL(i, 100);
+        // the event tree is only in the chunks:
+        TFile f("out_rollover.root", "read");
+        BOOST_CHECK(f.Get("eventtree") == nullptr);
+    }
+}
+
 // output tree in a directory within the output file:
 BOOST_AUTO_TEST_CASE(outtree_dir){
     {
     EventStructure es;
     
-    auto out = OutputManagerBackendRegistry::build("root", es, "dir/eventtree", "out");
+    auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "dir/eventtree", "out");
     auto h_my_int = out->declare_event_output<int>("my_int");
     Event event(es);
     for(int i=0; i<100; ++i){
@@ -325,7 +879,7 @@ BOOST_AUTO_TEST_CASE(outtree_dir){
 
 BOOST_AUTO_TEST_CASE(outhist){
     EventStructure es;
-    auto out = OutputManagerBackendRegistry::build("root", es, "eventtree", "outhist");
+    auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "outhist");
     
     TH1D * histo = new TH1D("h1", "h1", 100, 0, 1);
     out->put("histname", histo);
@@ -342,7 +896,7 @@ BOOST_AUTO_TEST_CASE(outhist){
 
 BOOST_AUTO_TEST_CASE(outhist_dir){
     EventStructure es;
-    auto out = OutputManagerBackendRegistry::build("root", es, "eventtree", "outhist_dir");
+    auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "outhist_dir");
     
     TH1D * histo = new TH1D("h1", "h1", 100, 0, 1);
     out->put("dir1/dir2/dir3/histname", histo);
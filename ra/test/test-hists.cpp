@@ -0,0 +1,196 @@
+#include <boost/test/unit_test.hpp>
+
+#include "hists.hpp"
+#include "event.hpp"
+#include "context-backend.hpp"
+#include "config.hpp"
+#include "weight_systematics.hpp"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TFile.h"
+
+#include <cmath>
+
+using namespace ra;
+using namespace std;
+
+namespace {
+
+void check_equal(TH1 * h, TH1D & ref){
+    BOOST_REQUIRE(h);
+    BOOST_REQUIRE_EQUAL(h->GetNbinsX(), ref.GetNbinsX());
+    for(int i=0; i<ref.GetNbinsX() + 2; ++i){
+        BOOST_CHECK_CLOSE(h->GetBinContent(i) + 1.0, ref.GetBinContent(i) + 1.0, 1e-10);
+        BOOST_CHECK_CLOSE(h->GetBinError(i) + 1.0, ref.GetBinError(i) + 1.0, 1e-10);
+    }
+    BOOST_CHECK_EQUAL(h->GetEntries(), ref.GetEntries());
+    BOOST_CHECK_CLOSE(h->GetMean(), ref.GetMean(), 1e-8);
+    BOOST_CHECK_CLOSE(h->GetRMS(), ref.GetRMS(), 1e-8);
+}
+
+// Hists with a histogram filled in process, to test the weight variations
+class ProcessHists: public Hists {
+public:
+    ProcessHists(const string & dirname, const s_dataset & dataset, OutputManager & out): Hists(dirname, dataset, out){
+        h_x = out.get_handle<double>("x");
+        h_weight = out.get_handle<double>("weight");
+        book<TH1D>("y", 20, -1.0, 1.0);
+        book_1d_autofill(h_x, [](double x){ return x; }, "x", 20, -1.0, 1.0);
+    }
+    
+    virtual void process(Event & event){
+        get("y")->Fill(event.get(h_x), event.get(h_weight));
+    }
+    
+private:
+    Event::Handle<double> h_x, h_weight;
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE(hists)
+
+// the autofill histograms must be the same as filled directly via TH1D::Fill, including under- and overflow and statistics:
+BOOST_AUTO_TEST_CASE(autofill){
+    EventStructure es;
+    ptree dataset_cfg;
+    dataset_cfg.add_child("name", ptree("test"));
+    dataset_cfg.add_child("file", ptree("tree.root"));
+    s_dataset dataset(dataset_cfg);
+    auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "out_hists");
+    auto h_weight = es.get_handle<double>("weight");
+    auto h_x = es.get_handle<double>("x");
+    auto h_n = es.get_handle<int>("n");
+    Hists hists("dir", dataset, *out);
+    hists.book_1d_autofill(h_x, [](double x){ return x; }, "x", 20, -1.0, 1.0);
+    hists.book_1d_autofill(h_x, [](double x){ return x > 0 ? 2 * x : NAN; }, "x2", 10, 0.0, 1.0);
+    hists.book_1d_autofill(h_n, [](int n){ return n; }, "n", 10, 0.0, 10.0);
+    hists.book_1d_autofill([=](Event & e){ return e.get(h_x) * e.get(h_n); }, "xn", 30, -5.0, 5.0);
+    TH1D ref_x("ref_x", "", 20, -1.0, 1.0), ref_x2("ref_x2", "", 10, 0.0, 1.0), ref_n("ref_n", "", 10, 0.0, 10.0), ref_xn("ref_xn", "", 30, -5.0, 5.0);
+    for(TH1D * h : {&ref_x, &ref_x2, &ref_n, &ref_xn}){
+        h->SetDirectory(0);
+        h->Sumw2();
+    }
+    Event event(es);
+    for(int i=0; i<1000; ++i){
+        const double x = sin(i * 0.37) * 1.2;
+        const int n = i % 13;
+        const double weight = 0.5 + (i % 7) * 0.25;
+        event.set(h_x, x);
+        event.set(h_n, n);
+        event.set(h_weight, weight);
+        hists.process_all(event);
+        ref_x.Fill(x, weight);
+        if(x > 0) ref_x2.Fill(2 * x, weight);
+        ref_n.Fill(n, weight);
+        ref_xn.Fill(x * n, weight);
+        // syncing in between must not make a difference:
+        if(i == 500) hists.sync_autofill();
+    }
+    hists.sync_autofill();
+    check_equal(hists.get("x"), ref_x);
+    check_equal(hists.get("x2"), ref_x2);
+    check_equal(hists.get("n"), ref_n);
+    check_equal(hists.get("xn"), ref_xn);
+    // syncing again without new events must not change anything:
+    hists.sync_autofill();
+    check_equal(hists.get("x"), ref_x);
+}
+
+// the histograms of the weight variations must be the same as filling with the varied weight directly:
+BOOST_AUTO_TEST_CASE(weight_variations){
+    EventStructure es;
+    ptree dataset_cfg;
+    dataset_cfg.add_child("name", ptree("test"));
+    dataset_cfg.add_child("file", ptree("tree.root"));
+    s_dataset dataset(dataset_cfg);
+    const identifier syst_sf("test_sf");
+    TH1D ref_minus("ref_minus", "", 20, -1.0, 1.0), ref_plus("ref_plus", "", 20, -1.0, 1.0), ref_nominal("ref_nominal", "", 20, -1.0, 1.0);
+    for(TH1D * h : {&ref_minus, &ref_plus, &ref_nominal}){
+        h->SetDirectory(0);
+        h->Sumw2();
+    }
+    {
+        auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "out_weight_variations");
+        auto h_weight = es.get_handle<double>("weight");
+        auto h_x = es.get_handle<double>("x");
+        auto h_systs = es.get_handle<weight_systematics>(weight_systematics::member_name);
+        ProcessHists hists("dir", dataset, *out);
+        hists.add_weight_variations({syst_sf});
+        Event event(es);
+        for(int i=0; i<1000; ++i){
+            event.invalidate_all();
+            const double x = sin(i * 0.37) * 1.2;
+            const double weight = 0.5 + (i % 7) * 0.25;
+            event.set(h_x, x);
+            event.set(h_weight, weight);
+            // no systematics set for some events, i.e. factor 1:
+            float minus = 1.0f, plus = 1.0f;
+            if(i % 5 != 0){
+                minus = 0.9f - (i % 3) * 0.01f;
+                plus = 1.1f + (i % 3) * 0.01f;
+                weight_systematics::get(event, h_systs).set(syst_sf, minus, plus);
+            }
+            hists.process_all(event);
+            BOOST_CHECK_EQUAL(event.get(h_weight), weight);
+            ref_nominal.Fill(x, weight);
+            ref_minus.Fill(x, weight * minus);
+            ref_plus.Fill(x, weight * plus);
+        }
+        // no explicit sync_autofill: the autofills are synced when the output is written
+        out->close();
+    }
+    TFile f("out_weight_variations.root", "read");
+    for(const char * name : {"x", "y"}){
+        TH1D * nominal = dynamic_cast<TH1D*>(f.Get((string("dir/") + name).c_str()));
+        TH1D * minus = dynamic_cast<TH1D*>(f.Get((string("dir__test_sf_minus/") + name).c_str()));
+        TH1D * plus = dynamic_cast<TH1D*>(f.Get((string("dir__test_sf_plus/") + name).c_str()));
+        check_equal(nominal, ref_nominal);
+        check_equal(minus, ref_minus);
+        check_equal(plus, ref_plus);
+    }
+}
+
+// deferred histograms are only created when filled, and written empty only if requested:
+BOOST_AUTO_TEST_CASE(deferred){
+    EventStructure es;
+    ptree dataset_cfg;
+    dataset_cfg.add_child("name", ptree("test"));
+    dataset_cfg.add_child("file", ptree("tree.root"));
+    s_dataset dataset(dataset_cfg);
+    for(bool write_empty : {true, false}){
+        {
+            auto out = OutputManagerBackendRegistry::build("root", es, ptree(), "eventtree", "out_deferred");
+            Hists hists("dir", dataset, *out);
+            hists.book_deferred<TH1D>("filled", 10, 0.0, 10.0);
+            hists.book_deferred<TH1D>("empty", 10, 0.0, 10.0);
+            hists.book_deferred<TH2D>("filled2d", 10, 0.0, 10.0, 5, 0.0, 5.0);
+            hists.set_write_empty(write_empty);
+            for(int i=0; i<100; ++i){
+                hists.get("filled")->Fill(i % 12, 0.5);
+                static_cast<TH2D*>(hists.get("filled2d"))->Fill(i % 10, i % 5);
+            }
+            BOOST_CHECK_EQUAL(hists.get("filled")->GetEntries(), 100);
+            out->close();
+        }
+        TFile f("out_deferred.root", "read");
+        TH1D * filled = dynamic_cast<TH1D*>(f.Get("dir/filled"));
+        TH2D * filled2d = dynamic_cast<TH2D*>(f.Get("dir/filled2d"));
+        BOOST_REQUIRE(filled);
+        BOOST_REQUIRE(filled2d);
+        BOOST_CHECK_EQUAL(filled->GetEntries(), 100);
+        BOOST_CHECK_EQUAL(filled->GetBinContent(11), 0.5 * 16);
+        BOOST_CHECK_EQUAL(filled2d->GetEntries(), 100);
+        TH1D * empty = dynamic_cast<TH1D*>(f.Get("dir/empty"));
+        if(write_empty){
+            BOOST_REQUIRE(empty);
+            BOOST_CHECK_EQUAL(empty->GetNbinsX(), 10);
+            BOOST_CHECK_EQUAL(empty->GetEntries(), 0);
+        }
+        else{
+            BOOST_CHECK(empty == nullptr);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,8 @@
 #include "TFile.h"
 #include "TH1D.h"
 
+#include <unistd.h>
+
 using namespace std;
 using namespace ra;
 
@@ -192,5 +194,42 @@ BOOST_AUTO_TEST_CASE(many_histos){
     }
 }
 
+// the chunks of the manifests are concatenated when merging and renamed together with the output file:
+BOOST_AUTO_TEST_CASE(manifests){
+    create_test_hfile("test0.root", {"h1"}, 0.0, 0.0);
+    create_test_hfile("test1.root", {"h1"}, 0.5, 0.0);
+    create_test_tree("test0-chunk0.root", 0, 10);
+    create_test_tree("test1-chunk0.root", 10, 5);
+    create_test_tree("test1-chunk1.root", 15, 5);
+    write_manifest(manifest_filename("test0.root"), {{"test0-chunk0.root", 10}});
+    write_manifest(manifest_filename("test1.root"), {{"test1-chunk0.root", 5}, {"test1-chunk1.root", 5}});
+    merge_rootfiles("test0.root", {"test1.root"});
+    // the merged file is kept (e.g. for options.keep_unmerged) until it is removed explicitly:
+    BOOST_CHECK(access("test1.manifest", F_OK) == 0);
+    BOOST_CHECK_EQUAL(remove_rootfile("test1.root"), 0);
+    BOOST_CHECK(access("test1.root", F_OK) != 0);
+    BOOST_CHECK(access("test1.manifest", F_OK) != 0);
+    BOOST_CHECK(access("test1-chunk0.root", F_OK) == 0);
+    
+    rename_rootfile("test0.root", "merged.root");
+    BOOST_CHECK(access("test0.root", F_OK) != 0);
+    BOOST_CHECK(access("test0.manifest", F_OK) != 0);
+    auto chunks = read_manifest("merged.manifest");
+    BOOST_REQUIRE_EQUAL(chunks.size(), 3u);
+    // only the chunks named after the renamed file are renamed:
+    BOOST_CHECK_EQUAL(chunks[0].filename, "merged-chunk0.root");
+    BOOST_CHECK_EQUAL(chunks[1].filename, "test1-chunk0.root");
+    BOOST_CHECK_EQUAL(chunks[2].filename, "test1-chunk1.root");
+    int i0 = 0;
+    for(const auto & chunk : chunks){
+        auto data = get_tree_intdata(chunk.filename, "intdata");
+        BOOST_REQUIRE_EQUAL(data.size(), chunk.nentries);
+        for(size_t i=0; i<data.size(); ++i){
+            BOOST_CHECK_EQUAL(data[i], i0 + int(i));
+        }
+        i0 += data.size();
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -30,6 +30,9 @@ public:
     explicit BJetsProducer(const ptree & cfg);
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out);
     virtual void process(Event & event);
+    virtual std::vector<cacheable_output> cacheable_outputs() const{
+        return {{&typeid(vector<jet>), s_output}};
+    }
 private:
     float drmax, ptjmin;
     string s_output;
@@ -41,6 +44,9 @@ void BJetsProducer::begin_dataset(const s_dataset & dataset, InputManager & in,
     h_output = in.get_handle<vector<jet>>(s_output);
     h_jets = in.get_handle<vector<jet>>("jets");
     h_selected_bcands = in.get_handle<vector<Bcand>>("selected_bcands");
+    if(h_output == h_jets){
+        throw runtime_error("BJetsProducer: output must be different from the input 'jets'");
+    }
 }
 
 BJetsProducer::BJetsProducer(const ptree & cfg){
@@ -53,7 +59,8 @@ void BJetsProducer::process(Event & event){
     const auto & jets = event.get<vector<jet>>(h_jets);
     const auto & bcands = event.get<vector<Bcand> >(h_selected_bcands);
     
-    vector<jet> bjets;
+    auto & bjets = event.recycle(h_output);
+    bjets.clear();
     
     for(const auto & jet : jets){
         for(const auto & bc : bcands){
@@ -63,7 +70,6 @@ void BJetsProducer::process(Event & event){
             }
         }
     }
-    event.set(h_output, move(bjets));
 }
 
 REGISTER_ANALYSIS_MODULE(BJetsProducer)
@@ -100,6 +106,9 @@ private:
 void BJetsProducerCSV::begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
     h_output = in.get_handle<vector<jet>>(s_output);
     h_jets = in.get_handle<vector<jet>>("jets");
+    if(h_output == h_jets){
+        throw runtime_error("BJetsProducerCSV: output must be different from the input 'jets'");
+    }
 }
 
 BJetsProducerCSV::BJetsProducerCSV(const ptree & cfg){
@@ -125,14 +134,14 @@ BJetsProducerCSV::BJetsProducerCSV(const ptree & cfg){
 void BJetsProducerCSV::process(Event & event){
     const auto & jets = event.get<vector<jet>>(h_jets);
     
-    vector<jet> bjets;
+    auto & bjets = event.recycle(h_output);
+    bjets.clear();
     
     for(const auto & jet : jets){
         if(jet.p4.pt() > ptjmin && fabs(jet.p4.eta()) < etajmax && jet.btag > csvmin){
             bjets.push_back(jet);
         }
     }
-    event.set(h_output, move(bjets));
 }
 
 REGISTER_ANALYSIS_MODULE(BJetsProducerCSV)
@@ -3,6 +3,7 @@
 #include "ra/include/config.hpp"
 #include "ra/include/context.hpp"
 #include "ra/include/root-utils.hpp"
+#include "ra/include/weight_systematics.hpp"
 
 #include "TH2F.h"
 #include "TFile.h"
@@ -29,6 +30,9 @@ using namespace zsv;
  *    type dimusf
  * }
  * \endcode
+ * 
+ * The relative uncertainties of the id, isolation and trigger scale factors are set as weight systematics
+ * "musf_id", "musf_iso" and "musf_trigger".
  */
 class dimusf: public AnalysisModule {
 public:
@@ -49,6 +53,10 @@ private:
     
     Event::Handle<double> h_weight, h_musf, h_musf_error_id, h_musf_error_iso, h_musf_error_trigger;
     Event::Handle<lepton> h_lepton_minus, h_lepton_plus;
+    Event::Handle<weight_systematics> h_systs;
+    identifier syst_id, syst_iso, syst_trigger;
+    // whether the variations are used, see InputManager::declare_weight_systematic
+    const bool * syst_id_used, * syst_iso_used, * syst_trigger_used;
 };
 
 
@@ -107,7 +115,7 @@ pair<float, float> get_sf(float eta, float pt, const vector<TGraphAsymmErrors*>
 
 }
 
-dimusf::dimusf(const ptree & cfg){    
+dimusf::dimusf(const ptree & cfg): syst_id("musf_id"), syst_iso("musf_iso"), syst_trigger("musf_trigger"), syst_id_used(nullptr), syst_iso_used(nullptr), syst_trigger_used(nullptr){
     string trigger_filename = resolve_file("MuHLTEfficiencies_Run_2012ABCD_53X_DR03-2.root");
     //sf_dimutrigger = get_th2f(trigger_filename, "DATA_over_MC_Mu17Mu8_Tight_Mu1_20ToInfty_&_Mu2_20ToInfty_with_SYST_uncrt");
     sf_dimutrigger = get_th2f(trigger_filename, "DATA_over_MC_Mu17Mu8_OR_Mu17TkMu8_Tight_Mu1_20ToInfty_&_Mu2_20ToInfty_with_SYST_uncrt");
@@ -138,6 +146,10 @@ void dimusf::begin_dataset(const s_dataset & dataset, InputManager & in, OutputM
     h_musf_error_id = in.get_handle<double>("musf_id");
     h_musf_error_iso = in.get_handle<double>("musf_iso");
     h_musf_error_trigger = in.get_handle<double>("musf_trigger");
+    h_systs = in.get_handle<weight_systematics>(weight_systematics::member_name);
+    syst_id_used = &in.declare_weight_systematic(syst_id);
+    syst_iso_used = &in.declare_weight_systematic(syst_iso);
+    syst_trigger_used = &in.declare_weight_systematic(syst_trigger);
 }
 
 void dimusf::process(Event & event){
@@ -187,6 +199,12 @@ void dimusf::process(Event & event){
     event.set(h_musf_error_id, id_sf_error);
     event.set(h_musf_error_iso, iso_sf_error);
     event.set(h_musf_error_trigger, trigger_sf_error);
+    if(*syst_id_used || *syst_iso_used || *syst_trigger_used){
+        auto & systs = weight_systematics::get(event, h_systs);
+        if(*syst_id_used) systs.set(syst_id, 1.0 - id_sf_error, 1.0 + id_sf_error);
+        if(*syst_iso_used) systs.set(syst_iso, 1.0 - iso_sf_error, 1.0 + iso_sf_error);
+        if(*syst_trigger_used) systs.set(syst_trigger, 1.0 - trigger_sf_error, 1.0 + trigger_sf_error);
+    }
     event.get<double>(h_weight) *= total_sf;
 }
 
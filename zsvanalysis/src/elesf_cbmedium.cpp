@@ -2,6 +2,7 @@
 #include "ra/include/config.hpp"
 #include "ra/include/context.hpp"
 #include "ra/include/event.hpp"
+#include "ra/include/weight_systematics.hpp"
 
 #include "zsvtree.hpp"
 
@@ -13,6 +14,8 @@ using namespace std;
 //
 // works for events with any number of electrons.
 // Assumes pt > 20
+//
+// The relative uncertainty of the scale factor is set as weight systematic "elesf".
 class elesf_cbmedium: public AnalysisModule {
 public:
     
@@ -28,9 +31,12 @@ private:
     
     Event::Handle<double> h_weight, h_elesf, h_elesf_error;
     Event::Handle<lepton> h_lepton_minus, h_lepton_plus;
+    Event::Handle<weight_systematics> h_systs;
+    identifier syst_elesf;
+    const bool * syst_elesf_used; // see InputManager::declare_weight_systematic
 };
 
-elesf_cbmedium::elesf_cbmedium(const ptree & cfg){}
+elesf_cbmedium::elesf_cbmedium(const ptree & cfg): syst_elesf("elesf"), syst_elesf_used(nullptr){}
 
 pair<double, double> elesf_cbmedium::getsf(const lepton & lep){
     auto eta = std::abs(lep.sc_eta);
@@ -75,6 +81,8 @@ void elesf_cbmedium::begin_dataset(const s_dataset & dataset, InputManager & in,
     h_elesf_error = in.get_handle<double>("elesf_error");
     h_lepton_plus = in.get_handle<lepton>("lepton_plus");
     h_lepton_minus = in.get_handle<lepton>("lepton_minus");
+    h_systs = in.get_handle<weight_systematics>(weight_systematics::member_name);
+    syst_elesf_used = &in.declare_weight_systematic(syst_elesf);
 }
 
 void elesf_cbmedium::process(Event & event){
@@ -97,6 +105,9 @@ void elesf_cbmedium::process(Event & event){
     }
     event.set(h_elesf, sf);
     event.set(h_elesf_error, sf_relative_error);
+    if(*syst_elesf_used){
+        weight_systematics::get(event, h_systs).set(syst_elesf, 1.0 - sf_relative_error, 1.0 + sf_relative_error);
+    }
     event.get<double>(h_weight) *= sf;
 }
 
@@ -33,6 +33,9 @@ public:
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out) override {
         h_output = in.get_handle<vector<Bcand>>(output);
         h_selected_bcands = in.get_handle<vector<Bcand>>("selected_bcands");
+        if(h_output == h_selected_bcands){
+            throw runtime_error("filter_bcands: output must be different from the input 'selected_bcands'");
+        }
     }
     virtual void process(Event & event) override;
     
@@ -58,7 +61,8 @@ filter_bcands::filter_bcands(const ptree & cfg){
 
 void filter_bcands::process(Event & event){
     const auto & bcands = event.get<vector<Bcand>>(h_selected_bcands);
-    vector<Bcand> new_bcands;
+    auto & new_bcands = event.recycle(h_output);
+    new_bcands.clear();
     
     for(auto & b : bcands){
         if(fabs(b.flightdir.eta()) >= aetamin && fabs(b.flightdir.eta()) < aetamax && b.p4.pt() >= ptmin && b.p4.pt() < ptmax &&
@@ -66,7 +70,6 @@ void filter_bcands::process(Event & event){
             new_bcands.push_back(b);
         }
     }
-    event.set(h_output, move(new_bcands));
 }
 
 
@@ -40,6 +40,9 @@ public:
         h_mc_bs = in.get_handle<vector<mcparticle>>("mc_bs");
         h_output = in.get_handle<vector<mcparticle>>(output);
         h_output_bool = in.get_handle<bool>(output);
+        if(h_output == h_mc_bs){
+            throw runtime_error("filter_mcb: output_name must be different from the input 'mc_bs'");
+        }
     }
     virtual void process(Event & event) override;
     
@@ -77,13 +80,13 @@ void filter_mcb::process(Event & event){
         }
     }
     
-    vector<mcparticle> new_mc_bs;
+    auto & new_mc_bs = event.recycle(h_output);
+    new_mc_bs.clear();
     for(auto & mcb : mc_bs){
         if(fabs(mcb.p4.eta()) >= aetamin && fabs(mcb.p4.eta()) < aetamax && mcb.p4.pt() >= ptmin && mcb.p4.pt() < ptmax){
             new_mc_bs.push_back(mcb);
         }
     }
-    event.set(h_output, std::move(new_mc_bs));
 }
 
 
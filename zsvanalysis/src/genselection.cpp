@@ -30,6 +30,9 @@ public:
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out){
         h_input = in.get_handle<vector<mcparticle>>(s_input);
         h_output = in.get_handle<vector<mcparticle>>(s_output);
+        if(h_input == h_output){
+            throw runtime_error("select_mcparticles: input and output must be different");
+        }
     }
     virtual void process(Event & event);
     
@@ -50,13 +53,13 @@ select_mcparticles::select_mcparticles(const ptree & cfg){
 
 void select_mcparticles::process(Event & event){
     const auto & input_particles = event.get(h_input);
-    vector<mcparticle> output_particles;
+    auto & output_particles = event.recycle(h_output);
+    output_particles.clear();
     for(const auto & p : input_particles){
         if(p.p4.pt() > ptmin && fabs(p.p4.eta()) < etamax){
             output_particles.push_back(p);
         }
     }
-    event.set(h_output, std::move(output_particles));
 }
 
 REGISTER_ANALYSIS_MODULE(select_mcparticles)
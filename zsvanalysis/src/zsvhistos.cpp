@@ -64,22 +64,22 @@ public:
         h_weight = in.get_handle<double>("weight");
         h_mc_partons = in.get_handle<vector<mcparticle>>("mc_partons");
         
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_plus); return abs(lep.pdgid)==13 ? lep.p4.pt() : NAN; }, "pt_mup", 100, 0, 200);
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_minus); return abs(lep.pdgid)==13 ? lep.p4.pt() : NAN; }, "pt_mum", 100, 0, 200);
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_plus); return abs(lep.pdgid)==11 ? lep.p4.pt() : NAN; }, "pt_elep", 100, 0, 200);
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_minus); return abs(lep.pdgid)==11 ? lep.p4.pt() : NAN; }, "pt_elem", 100, 0, 200);
-        
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_plus); return abs(lep.pdgid)==13 ? lep.p4.eta() : NAN;}, "eta_mup", 60, -3, 3);
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_minus); return abs(lep.pdgid)==13 ? lep.p4.eta() : NAN;}, "eta_mum", 60, -3, 3);
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_plus); return abs(lep.pdgid)==11 ? lep.p4.eta() : NAN;}, "eta_elep", 60, -3, 3);
-        book_1d_autofill([=](Event & e){const auto & lep = e.get(h_lepton_minus); return abs(lep.pdgid)==11 ? lep.p4.eta() : NAN;}, "eta_elem", 60, -3, 3);
-        
-        book_1d_autofill([=](Event & e){return e.get<LorentzVector>(h_zp4).pt();}, "ptz", 100, 0, 200);
-        book_1d_autofill([=](Event & e){return e.get<LorentzVector>(h_zp4).eta();}, "etaz", 200, -5, 5);
-        book_1d_autofill([=](Event & e){return e.get<float>(h_met);}, "met", 200, 0, 200);
-        book_1d_autofill([=](Event & e){return e.get<vector<Bcand> >(h_selected_bcands).size();}, "nbcands", 10, 0, 10);
-        book_1d_autofill([=](Event & e){return e.get<int>(h_mc_n_me_finalstate);}, "mc_n_me_finalstate", 10, 0, 10);
-        book_1d_autofill([=](Event & e){return e.get<int>(h_npv);}, "npv", 60, 0, 60);
+        book_1d_autofill(h_lepton_plus, [](const lepton & lep){ return abs(lep.pdgid)==13 ? lep.p4.pt() : NAN; }, "pt_mup", 100, 0, 200);
+        book_1d_autofill(h_lepton_minus, [](const lepton & lep){ return abs(lep.pdgid)==13 ? lep.p4.pt() : NAN; }, "pt_mum", 100, 0, 200);
+        book_1d_autofill(h_lepton_plus, [](const lepton & lep){ return abs(lep.pdgid)==11 ? lep.p4.pt() : NAN; }, "pt_elep", 100, 0, 200);
+        book_1d_autofill(h_lepton_minus, [](const lepton & lep){ return abs(lep.pdgid)==11 ? lep.p4.pt() : NAN; }, "pt_elem", 100, 0, 200);
+        
+        book_1d_autofill(h_lepton_plus, [](const lepton & lep){ return abs(lep.pdgid)==13 ? lep.p4.eta() : NAN; }, "eta_mup", 60, -3, 3);
+        book_1d_autofill(h_lepton_minus, [](const lepton & lep){ return abs(lep.pdgid)==13 ? lep.p4.eta() : NAN; }, "eta_mum", 60, -3, 3);
+        book_1d_autofill(h_lepton_plus, [](const lepton & lep){ return abs(lep.pdgid)==11 ? lep.p4.eta() : NAN; }, "eta_elep", 60, -3, 3);
+        book_1d_autofill(h_lepton_minus, [](const lepton & lep){ return abs(lep.pdgid)==11 ? lep.p4.eta() : NAN; }, "eta_elem", 60, -3, 3);
+        
+        book_1d_autofill(h_zp4, [](const LorentzVector & p4){ return p4.pt(); }, "ptz", 100, 0, 200);
+        book_1d_autofill(h_zp4, [](const LorentzVector & p4){ return p4.eta(); }, "etaz", 200, -5, 5);
+        book_1d_autofill(h_met, [](float met){ return met; }, "met", 200, 0, 200);
+        book_1d_autofill(h_selected_bcands, [](const vector<Bcand> & bcands){ return bcands.size(); }, "nbcands", 10, 0, 10);
+        book_1d_autofill(h_mc_n_me_finalstate, [](int n){ return n; }, "mc_n_me_finalstate", 10, 0, 10);
+        book_1d_autofill(h_npv, [](int npv){ return npv; }, "npv", 60, 0, 60);
         
         book_1d_autofill([=](Event & e){return e.get_default<double>(h_pileupsf, NAN);}, "pileupsf", 100, 0, 4, h_one);
         book_1d_autofill([=](Event & e){return e.get_default<double>(h_elesf, NAN);}, "elesf", 100, 0, 4, h_one);
@@ -141,64 +141,65 @@ public:
         h_lepton_minus = in.get_handle<lepton>("lepton_minus");
         h_jets = in.get_handle<vector<jet>>("jets");
         
-        book<TH1D>("Bmass", 60, 0, 6);
-        book<TH1D>("Bpt", 200, 0, 200);
-        book<TH1D>("Beta", 100, -3, 3);
-        book<TH1D>("Bntracks", 20, 0, 20);
-        book<TH1D>("Bnsv", 5, 0, 5);
+        // many of these stay empty depending on the dataset and selection, so only allocate them when filled:
+        book_deferred<TH1D>("Bmass", 60, 0, 6);
+        book_deferred<TH1D>("Bpt", 200, 0, 200);
+        book_deferred<TH1D>("Beta", 100, -3, 3);
+        book_deferred<TH1D>("Bntracks", 20, 0, 20);
+        book_deferred<TH1D>("Bnsv", 5, 0, 5);
         
-        book<TH1D>("Bpt_over_jetpt", 150, 0, 1.5);
+        book_deferred<TH1D>("Bpt_over_jetpt", 150, 0, 1.5);
         
-        book<TH1D>("svdist3d", 100, 0, 10);
-        book<TH1D>("svdist2d", 100, 0, 10);
-        book<TH1D>("svdist3dsig", 100, 0, 200);
-        book<TH1D>("svdist2dsig", 100, 0, 200);
-        book<TH1D>("DR_ZB", 50, 0, 5);
+        book_deferred<TH1D>("svdist3d", 100, 0, 10);
+        book_deferred<TH1D>("svdist2d", 100, 0, 10);
+        book_deferred<TH1D>("svdist3dsig", 100, 0, 200);
+        book_deferred<TH1D>("svdist2dsig", 100, 0, 200);
+        book_deferred<TH1D>("DR_ZB", 50, 0, 5);
     
-        book<TH1D>("DR_BB", 200, 0, 5);
-        book<TH1D>("DPhi_BB", 128, 0, 3.2);
-        book<TH1D>("m_BB", 100, 0, 200);
+        book_deferred<TH1D>("DR_BB", 200, 0, 5);
+        book_deferred<TH1D>("DPhi_BB", 128, 0, 3.2);
+        book_deferred<TH1D>("m_BB", 100, 0, 200);
     
-        book<TH1D>("min_DR_ZB", 200, 0, 5);
-        book<TH1D>("min_DR_Blep", 200, 0, 5);
-        book<TH1D>("A_ZBB", 50, 0, 1);
+        book_deferred<TH1D>("min_DR_ZB", 200, 0, 5);
+        book_deferred<TH1D>("min_DR_Blep", 200, 0, 5);
+        book_deferred<TH1D>("A_ZBB", 50, 0, 1);
 
         // b efficiency:
-        book<TH1D>("number_mcbs", 10, 0, 10);
+        book_deferred<TH1D>("number_mcbs", 10, 0, 10);
         
-        book<TH1D>("mcbs_pt", 200, 0, 200);
-        book<TH1D>("mcbs_eta", 120, -3, 3);
+        book_deferred<TH1D>("mcbs_pt", 200, 0, 200);
+        book_deferred<TH1D>("mcbs_eta", 120, -3, 3);
         
-        book<TH1D>("matched_mcb_pt", 200, 0, 200);
-        book<TH1D>("matched_mcb_eta", 120, -3, 3);
-        book<TH1D>("mcb_mass", 80, 0, 8);
-        book<TH1D>("found_bcand_matches", 10, 0, 10);
-        book<TH1D>("mcb_bcand_pt_ratio", 50, 0, 1);
+        book_deferred<TH1D>("matched_mcb_pt", 200, 0, 200);
+        book_deferred<TH1D>("matched_mcb_eta", 120, -3, 3);
+        book_deferred<TH1D>("mcb_mass", 80, 0, 8);
+        book_deferred<TH1D>("found_bcand_matches", 10, 0, 10);
+        book_deferred<TH1D>("mcb_bcand_pt_ratio", 50, 0, 1);
         
-        book<TH1D>("mcb_bcand_dr", 100, 0, 0.2);
-        book<TH1D>("mcb_bcand_dphi", 100, 0, 0.2);
-        book<TH1D>("mcb_bcand_angle", 100, 0, 0.2);
-        book<TH1D>("mcb_bcand_deta", 100, 0, 0.2);
+        book_deferred<TH1D>("mcb_bcand_dr", 100, 0, 0.2);
+        book_deferred<TH1D>("mcb_bcand_dphi", 100, 0, 0.2);
+        book_deferred<TH1D>("mcb_bcand_angle", 100, 0, 0.2);
+        book_deferred<TH1D>("mcb_bcand_deta", 100, 0, 0.2);
         
         // cross-check of pt(B) modeling: plot y = pt(B) versus x = DR(B,B) (and x=DPhi(B,B))
         // to make sure that this is modeled correctly (if not, it means that the efficiency
         // in the DR / DPhi bins is off, as the efficiency depends on pt(B)).
         // Use pt of bcand0 (leading in pt) and bcand1 (subleading in pt).
-        book<TH2D>("bcand0pt_drbb", 50, 0, 5, 100, 0, 100);
-        book<TH2D>("bcand1pt_drbb", 50, 0, 5, 100, 0, 100);
-        book<TH2D>("bcand0pt_dphibb", 32, 0, 3.2, 100, 0, 64);
-        book<TH2D>("bcand1pt_dphibb", 32, 0, 3.2, 100, 0, 64);
+        book_deferred<TH2D>("bcand0pt_drbb", 50, 0, 5, 100, 0, 100);
+        book_deferred<TH2D>("bcand1pt_drbb", 50, 0, 5, 100, 0, 100);
+        book_deferred<TH2D>("bcand0pt_dphibb", 32, 0, 3.2, 100, 0, 64);
+        book_deferred<TH2D>("bcand1pt_dphibb", 32, 0, 3.2, 100, 0, 64);
         
         // same for MC bs:
-        book<TH2D>("mcb0pt_drbb", 50, 0, 5, 100, 0, 100);
-        book<TH2D>("mcb1pt_drbb", 50, 0, 5, 100, 0, 100);
-        book<TH2D>("mcb0pt_dphibb", 32, 0, 3.2, 100, 0, 64);
-        book<TH2D>("mcb1pt_dphibb", 32, 0, 3.2, 100, 0, 64);
+        book_deferred<TH2D>("mcb0pt_drbb", 50, 0, 5, 100, 0, 100);
+        book_deferred<TH2D>("mcb1pt_drbb", 50, 0, 5, 100, 0, 100);
+        book_deferred<TH2D>("mcb0pt_dphibb", 32, 0, 3.2, 100, 0, 64);
+        book_deferred<TH2D>("mcb1pt_dphibb", 32, 0, 3.2, 100, 0, 64);
         
         // y = mll versus x = DR(B,B) or DPhi(B,B). Can be used to estimate
         // purity of Z (?!)
-        book<TH2D>("mll_drbb", 50, 0, 5, 120, 60, 180);
-        book<TH2D>("mll_dphibb", 32, 0, 3.2, 120, 60, 180);
+        book_deferred<TH2D>("mll_drbb", 50, 0, 5, 120, 60, 180);
+        book_deferred<TH2D>("mll_dphibb", 32, 0, 3.2, 120, 60, 180);
         
         // double b efficiency:
         /*book<TH1D>("double_mcb_lower_pt", 200, 0, 200);
@@ -1,5 +1,6 @@
 #include "ra/include/selections.hpp"
 #include "ra/include/context.hpp"
+#include "ra/include/eventbatch.hpp"
 #include "zsvtree.hpp"
 
 using namespace ra;
@@ -62,6 +63,15 @@ public:
         return (ptmin < 0 || zpt >= ptmin) && (ptmax < 0 || zpt <= ptmax);
     }
     
+    virtual void select_batch(const EventBatch & batch, std::vector<char> & result) override{
+        auto zp4 = batch.get_column(h_zp4);
+        for(size_t i=0; i<batch.size(); ++i){
+            if(!batch.is_active(i)) continue;
+            double zpt = zp4[i].pt();
+            result[i] = (ptmin < 0 || zpt >= ptmin) && (ptmax < 0 || zpt <= ptmax);
+        }
+    }
+    
 private:
     double ptmin, ptmax;
     Event::Handle<LorentzVector> h_zp4;
@@ -84,6 +94,15 @@ public:
         return (mllmin < 0 || mll >= mllmin) && (mllmax < 0 || mll <= mllmax);
     }
     
+    virtual void select_batch(const EventBatch & batch, std::vector<char> & result) override{
+        auto zp4 = batch.get_column(h_zp4);
+        for(size_t i=0; i<batch.size(); ++i){
+            if(!batch.is_active(i)) continue;
+            double mll = zp4[i].M();
+            result[i] = (mllmin < 0 || mll >= mllmin) && (mllmax < 0 || mll <= mllmax);
+        }
+    }
+    
 private:
     double mllmin, mllmax;
     Event::Handle<LorentzVector> h_zp4;
@@ -8,16 +8,37 @@
 #include "zsvtree.hpp"
 #include "eventids.hpp"
 
+#include <boost/algorithm/string.hpp>
+
 using namespace ra;
 using namespace std;
 using namespace zsv;
 
+// Declare the input (and optionally output) of the zsv event tree.
+//
+// The optional group 'partial_inputs' gives the data members to read for class-type branches of which not all data members
+// are used, e.g.
+//   partial_inputs {
+//      lepton_plus "p4 pdgid"
+//   }
+// see InputManager::declare_partial_input. Modules using other data members of these branches have to declare the branch input
+// themselves. This setting is ignored with 'out', as the complete objects are written then.
 class zsvtree: public AnalysisModule {
 public:
     
     explicit zsvtree(const ptree & cfg){
         only_re = ptree_get<bool>(cfg, "only_re", false);
         out = ptree_get<bool>(cfg, "out", false);
+        auto partial_cfg = cfg.get_child_optional("partial_inputs");
+        if(partial_cfg){
+            for(const auto & it : *partial_cfg){
+                string members = it.second.data();
+                boost::trim(members);
+                vector<string> vmembers;
+                boost::split(vmembers, members, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+                partial_inputs[it.first] = vmembers;
+            }
+        }
     }
     
     virtual void begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out);
@@ -25,8 +46,21 @@ public:
     virtual void process(Event & event){}
     
 private:
+    // declare the input of a class-type branch, reading only the members given in partial_inputs, if any
+    template<typename T>
+    void declare_input(InputManager & in, const string & bname){
+        auto it = partial_inputs.find(bname);
+        if(out || it == partial_inputs.end()){
+            in.declare_event_input<T>(bname);
+        }
+        else{
+            in.declare_partial_input<T>(bname, it->second);
+        }
+    }
+    
     bool only_re;
     bool out;
+    map<string, vector<string>> partial_inputs;
 };
 
 void zsvtree::begin_dataset(const s_dataset & dataset, InputManager & in, OutputManager & out_){
@@ -43,27 +77,27 @@ void zsvtree::begin_dataset(const s_dataset & dataset, InputManager & in, Output
         in.declare_event_input<float>("met");
         in.declare_event_input<float>("met_phi");
     
-        in.declare_event_input<lepton>("lepton_plus");
-        in.declare_event_input<lepton>("lepton_minus");
+        declare_input<lepton>(in, "lepton_plus");
+        declare_input<lepton>(in, "lepton_minus");
 
-        in.declare_event_input<vector<Bcand>>("selected_bcands");
-        in.declare_event_input<vector<Bcand>>("additional_bcands");
+        declare_input<vector<Bcand>>(in, "selected_bcands");
+        declare_input<vector<Bcand>>(in, "additional_bcands");
         
-        in.declare_event_input<vector<jet>>("jets");
+        declare_input<vector<jet>>(in, "jets");
         
         in.declare_event_input<int>("npv");
     
         // MC info:
         in.declare_event_input<float>("mc_true_pileup");
             
-        in.declare_event_input<vector<mcparticle>>("mc_leptons");
-        in.declare_event_input<vector<LorentzVector>>("mc_jets");
+        declare_input<vector<mcparticle>>(in, "mc_leptons");
+        declare_input<vector<LorentzVector>>(in, "mc_jets");
         
         in.declare_event_input<int>("mc_n_me_finalstate");
         
-        in.declare_event_input<vector<mcparticle>>("mc_bs");
-        in.declare_event_input<vector<mcparticle>>("mc_cs");
-        in.declare_event_input<vector<mcparticle>>("mc_partons");
+        declare_input<vector<mcparticle>>(in, "mc_bs");
+        declare_input<vector<mcparticle>>(in, "mc_cs");
+        declare_input<vector<mcparticle>>(in, "mc_partons");
     }
     
     if(out){
@@ -121,6 +155,10 @@ public:
         event.set<LorentzVector>(h_zp4, event.get<lepton>(h_lepton_plus).p4 + event.get<lepton>(h_lepton_minus).p4);
     }
     
+    virtual std::vector<cacheable_output> cacheable_outputs() const{
+        return {{&typeid(LorentzVector), "zp4"}};
+    }
+    
 private:
     Event::Handle<lepton> h_lepton_plus, h_lepton_minus;
     Event::Handle<LorentzVector> h_zp4;